@@ -8,3 +8,11 @@ HW_VER_STR="1.0"
 SERIAL_NUM="0001"
 PRODUCT_LABEL="LightWarmCold"
 PRODUCT_URL="https://github.com/DimaRU/LightWarmCold"
+# LED calibration, measured per production batch. Leave CAL_WARM_KELVIN empty to skip
+CAL_WARM_KELVIN=2700
+CAL_COLD_KELVIN=6500
+CAL_GAIN="10000 10000"
+CAL_DEAD_ZONE="0 0"
+CAL_CURVE=""
+# Neutral channel "kelvin gain deadZone", empty for warm/cold fixtures
+CAL_NEUTRAL=""
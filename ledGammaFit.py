@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+#
+# Maximum error of the hardware gamma fade against the CIE 1931 curve per range count
+# Fades are linear in lightness, split into equal ranges with CIE corrected endpoints
+# and interpolated linearly in duty by the LEDC (CONFIG_LED_GAMMA_FADE_RANGES).
+# Usage: ledGammaFit.py [duty bits]
+#
+
+import sys
+
+BITS = int(sys.argv[1]) if len(sys.argv) > 1 else 12
+BASE = 1 << BITS
+SAMPLES = 4096
+
+
+def cie_duty(lightness):
+    l = lightness * 100.0 / BASE
+    y = l / 903.3 if l <= 8.0 else ((l + 16.0) / 116.0) ** 3
+    return y * BASE
+
+
+def duty_lightness(duty):
+    y = duty / BASE
+    return (y * 903.3 if y <= 0.008856 else 116.0 * y ** (1.0 / 3.0) - 16.0) * BASE / 100.0
+
+
+def fit_error(start, end, ranges):
+    # Range endpoints are rounded to duty counts as the hardware does
+    points = [round(cie_duty(start + (end - start) * i / ranges)) for i in range(ranges + 1)]
+    max_duty = 0.0
+    max_lightness = 0.0
+    for n in range(SAMPLES + 1):
+        t = n / SAMPLES
+        exact = cie_duty(start + (end - start) * t)
+        position = t * ranges
+        index = min(int(position), ranges - 1)
+        fitted = points[index] + (points[index + 1] - points[index]) * (position - index)
+        max_duty = max(max_duty, abs(fitted - exact))
+        # Perceptual error in L* units
+        max_lightness = max(max_lightness, abs(duty_lightness(fitted) - duty_lightness(exact)) * 100.0 / BASE)
+    return max_duty, max_lightness
+
+
+def main():
+    fades = [('full', 0, BASE), ('low half', 0, BASE // 2), ('high half', BASE // 2, BASE)]
+    print('%d bit duty, errors as max duty counts / max delta L*' % BITS)
+    print('ranges ' + ''.join('%20s' % name for name, _, _ in fades))
+    for ranges in range(2, 17):
+        row = ''
+        for _, start, end in fades:
+            duty, lightness = fit_error(start, end, ranges)
+            row += '%12.1f / %5.2f' % (duty, lightness)
+        print('%6d %s' % (ranges, row))
+
+
+if __name__ == '__main__':
+    main()
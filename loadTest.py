@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Load test of a commissioned light with chip-tool
+#
+# Opens N CurrentLevel subscriptions in one interactive chip-tool, sends MoveToLevel
+# commands at a fixed rate and measures command to report latency and report fan-out
+# (spread between the first and the last subscriber receiving the same value).
+# Device side write to output latency and memory use are read from the console of a
+# CONFIG_LED_SIMULATED build when --port is given.
+#
+# Usage: loadTest.py --node-id 1 [--subscribers 4] [--rate 5] [--duration 60] [--port /dev/ttyUSB0]
+#
+
+import argparse
+import re
+import statistics
+import subprocess
+import sys
+import threading
+import time
+
+REPORT_RE = re.compile(r'^\[(\d+\.\d+)\].*CHIP:TOO:\s+CurrentLevel: (\d+)')
+
+
+class Subscribers:
+    def __init__(self, chip_tool, node_id, endpoint):
+        self.node_id = node_id
+        self.endpoint = endpoint
+        self.lock = threading.Lock()
+        self.reports = {}       # level -> list of receive times
+        self.process = subprocess.Popen([chip_tool, 'interactive', 'start'], stdin=subprocess.PIPE,
+                                        stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, bufsize=1)
+        self.reader = threading.Thread(target=self.read, daemon=True)
+        self.reader.start()
+
+    def read(self):
+        for line in self.process.stdout:
+            match = REPORT_RE.match(line)
+            if match:
+                with self.lock:
+                    self.reports.setdefault(int(match.group(2)), []).append(float(match.group(1)))
+
+    def command(self, command):
+        self.process.stdin.write(command + '\n')
+        self.process.stdin.flush()
+
+    def subscribe(self, count):
+        for _ in range(count):
+            self.command('levelcontrol subscribe current-level 0 10 %d %d --keepSubscriptions true' %
+                         (self.node_id, self.endpoint))
+            time.sleep(1)
+
+    def move_to_level(self, level):
+        with self.lock:
+            self.reports.pop(level, None)
+        self.command('levelcontrol move-to-level %d 0 0 0 %d %d' % (level, self.node_id, self.endpoint))
+
+    def received(self, level):
+        with self.lock:
+            return list(self.reports.get(level, []))
+
+    def close(self):
+        self.command('quit()')
+        try:
+            self.process.wait(5)
+        except subprocess.TimeoutExpired:
+            self.process.kill()
+
+
+def device_stats(port, command):
+    try:
+        import serial
+    except ImportError:
+        return 'pyserial not installed, device stats skipped'
+    with serial.Serial(port, 115200, timeout=1) as console:
+        console.reset_input_buffer()
+        console.write(('matter esp light %s\n' % command).encode())
+        time.sleep(1)
+        return console.read(console.in_waiting or 1).decode(errors='replace')
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+
+def summary(name, values):
+    if not values:
+        print('%s: no samples' % name)
+        return
+    print('%s ms: min %.1f, median %.1f, p95 %.1f, max %.1f, samples %d' %
+          (name, min(values), statistics.median(values), percentile(values, 0.95), max(values), len(values)))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--node-id', type=int, required=True)
+    parser.add_argument('--endpoint', type=int, default=1)
+    parser.add_argument('--subscribers', type=int, default=4)
+    parser.add_argument('--rate', type=float, default=5, help='commands per second')
+    parser.add_argument('--duration', type=float, default=60, help='seconds')
+    parser.add_argument('--chip-tool', default='chip-tool')
+    parser.add_argument('--port', help='device console serial port')
+    args = parser.parse_args()
+
+    if args.port:
+        device_stats(args.port, 'sim reset')
+
+    subscribers = Subscribers(args.chip_tool, args.node_id, args.endpoint)
+    subscribers.subscribe(args.subscribers)
+
+    sent = []
+    period = 1.0 / args.rate
+    level = 1
+    end = time.time() + args.duration
+    while time.time() < end:
+        # Alternate levels, each value identifies its command
+        level = level % 253 + 1
+        sent.append((level, time.time()))
+        subscribers.move_to_level(level)
+        time.sleep(period)
+    time.sleep(2)
+
+    latency = []
+    fan_out = []
+    missing = 0
+    for level, sent_at in sent:
+        received = [t for t in subscribers.received(level) if t >= sent_at]
+        if len(received) < args.subscribers:
+            missing += args.subscribers - len(received)
+        if received:
+            latency.append((min(received) - sent_at) * 1000)
+            fan_out.append((max(received) - min(received)) * 1000)
+    subscribers.close()
+
+    print('commands: %d, subscribers: %d, missing reports: %d' % (len(sent), args.subscribers, missing))
+    summary('command->first report', latency)
+    summary('report fan-out', fan_out)
+    if args.port:
+        print(device_stats(args.port, 'sim'))
+    return 1 if not latency else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
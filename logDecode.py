@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+#
+# Decode the flash log store
+#
+# Input is a raw "logs" partition image read with esptool read_flash. Sectors are ordered by
+# sequence number, every block is LZSS compressed log text. The same text is served by the
+# DiagnosticLogs cluster as the end user support log.
+#
+# Usage: logDecode.py logs.bin [--stats]
+#
+
+import argparse
+import struct
+import sys
+
+SECTOR_SIZE = 4096
+SECTOR_HEADER = struct.Struct('<II')
+BLOCK_HEADER = struct.Struct('<HH')
+MAGIC = 0x31474f4c
+BLOCK_END = 0xFFFF
+MATCH_MIN = 3
+
+
+def decompress(data, raw_length):
+    if len(data) == raw_length:
+        return bytes(data)
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+                continue
+            if pos + 2 > len(data):
+                raise ValueError('truncated match')
+            distance = data[pos] | (data[pos + 1] >> 4) << 8
+            length = (data[pos + 1] & 0x0f) + MATCH_MIN
+            pos += 2
+            if distance == 0 or distance > len(out):
+                raise ValueError('bad match distance')
+            for _ in range(length):
+                out.append(out[-distance])
+    if len(out) != raw_length:
+        raise ValueError('length mismatch')
+    return bytes(out)
+
+
+def sectors(image):
+    found = []
+    for offset in range(0, len(image) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        magic, sequence = SECTOR_HEADER.unpack_from(image, offset)
+        if magic == MAGIC and sequence != 0xFFFFFFFF:
+            found.append((sequence, offset))
+    return sorted(found)
+
+
+def blocks(image, offset):
+    pos = offset + SECTOR_HEADER.size
+    end = offset + SECTOR_SIZE
+    while pos + BLOCK_HEADER.size <= end:
+        compressed, raw = BLOCK_HEADER.unpack_from(image, pos)
+        if compressed == BLOCK_END or compressed > raw or pos + BLOCK_HEADER.size + compressed > end:
+            return
+        data = image[pos + BLOCK_HEADER.size:pos + BLOCK_HEADER.size + compressed]
+        yield compressed, raw, data
+        pos += BLOCK_HEADER.size + compressed
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('image')
+    parser.add_argument('--stats', action='store_true', help='print compression stats instead of the text')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    total_raw = 0
+    total_stored = 0
+    found = sectors(image)
+    for sequence, offset in found:
+        for compressed, raw, data in blocks(image, offset):
+            total_raw += raw
+            total_stored += BLOCK_HEADER.size + compressed
+            if args.stats:
+                continue
+            try:
+                sys.stdout.write(decompress(data, raw).decode(errors='replace'))
+            except ValueError as e:
+                print('\n[sector %d: corrupted block, %s]' % (sequence, e))
+
+    if args.stats or not found:
+        print('sectors: %d of %d, sequence %s, text %d bytes, stored %d bytes (%.1f%%)' %
+              (len(found), len(image) // SECTOR_SIZE,
+               '%d..%d' % (found[0][0], found[-1][0]) if found else '-',
+               total_raw, total_stored, 100.0 * total_stored / total_raw if total_raw else 0))
+    return 0 if found else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
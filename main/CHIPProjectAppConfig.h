@@ -6,3 +6,10 @@
 // #define CHIP_DEVICE_CONFIG_DEVICE_VENDOR_NAME "TEST_VENDOR"
 // #define CHIP_DEVICE_CONFIG_DEVICE_PRODUCT_NAME "TEST_PRODUCT"
 // #define CHIP_DEVICE_CONFIG_DEFAULT_DEVICE_HARDWARE_VERSION_STRING "TEST_VERSION"
+
+#include <sdkconfig.h>
+
+#if CONFIG_FLASH_LOG
+// Flash log store is over the DiagnosticLogs response payload size
+#define CHIP_CONFIG_ENABLE_BDX_LOG_TRANSFER 1
+#endif
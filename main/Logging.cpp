@@ -43,9 +43,9 @@ void matterLoggingCallback(const char * module, uint8_t category, const char * m
     case chip::Logging::kLogCategory_Error:
         {
             if (ESP_LOG_NONE != level_for_tag && ESP_LOG_ERROR <= level_for_tag) {
-                    printf(LOG_COLOR_E "E (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
+                    esp_log_write(ESP_LOG_ERROR, tag, LOG_COLOR_E "E (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
                     esp_log_writev(ESP_LOG_ERROR, tag, msg, v);
-                    printf(LOG_RESET_COLOR "\n");
+                    esp_log_write(ESP_LOG_ERROR, tag, LOG_RESET_COLOR "\n");
                 }
         }
     break;
@@ -54,9 +54,9 @@ void matterLoggingCallback(const char * module, uint8_t category, const char * m
     default: 
         {
             if (ESP_LOG_NONE != level_for_tag && ESP_LOG_INFO <= level_for_tag) {
-                printf(LOG_COLOR_I "I (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
+                esp_log_write(ESP_LOG_INFO, tag, LOG_COLOR_I "I (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
                 esp_log_writev(ESP_LOG_INFO, tag, msg, v);
-                printf(LOG_RESET_COLOR "\n");
+                esp_log_write(ESP_LOG_INFO, tag, LOG_RESET_COLOR "\n");
             }
         }
     break;
@@ -64,9 +64,9 @@ void matterLoggingCallback(const char * module, uint8_t category, const char * m
     case chip::Logging::kLogCategory_Detail:
         {
             if (ESP_LOG_NONE != level_for_tag && ESP_LOG_DEBUG <= level_for_tag) {
-                printf(LOG_COLOR_D "D (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
+                esp_log_write(ESP_LOG_DEBUG, tag, LOG_COLOR_D "D (%" PRIu32 ") %s: ", esp_log_timestamp(), tag);
                 esp_log_writev(ESP_LOG_DEBUG, tag, msg, v);
-                printf(LOG_RESET_COLOR "\n");
+                esp_log_write(ESP_LOG_DEBUG, tag, LOG_RESET_COLOR "\n");
             }
         }
     break;
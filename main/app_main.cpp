@@ -4,7 +4,11 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_app_desc.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 
 #include <esp_matter.h>
 #include <esp_matter_console.h>
@@ -13,8 +17,23 @@
 #include <common_macros.h>
 #include "app_priv.h"
 #include "indicator_driver.h"
+#include "energy_meter.h"
+#include "connectivity_monitor.h"
+#include "light_console.h"
+#include "report_policy.h"
+#include "schedule_engine.h"
+#include "profiler.h"
+#include "led_sim.h"
+#include "boot_profile.h"
+#include "commissioning_timeline.h"
+#include "light_bench.h"
+#include "attribute_trace.h"
+#include "thermal_manager.h"
+#include "flash_log.h"
+#include "ota_pipeline.h"
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD
 #include <platform/ESP32/OpenthreadLauncher.h>
+#include <platform/ThreadStackManager.h>
 #endif
 
 #include <app/server/CommissioningWindowManager.h>
@@ -24,6 +43,8 @@
 
 static const char *TAG = "app_main";
 
+#define BOOT_DRIVERS_READY BIT0
+
 using namespace esp_matter;
 using namespace esp_matter::attribute;
 using namespace esp_matter::endpoint;
@@ -39,6 +60,90 @@ static const char *s_decryption_key = decryption_key_start;
 static const uint16_t s_decryption_key_len = decryption_key_end - decryption_key_start;
 #endif // CONFIG_ENABLE_ENCRYPTED_OTA
 
+// Last fabric removal time, to measure time-to-commissionable
+static int64_t decommissionStart = 0;
+// Clear Wi-Fi and Thread credentials, false if any are left
+static bool app_clear_network_credentials()
+{
+    if (chip::DeviceLayer::ConnectivityMgr().IsWiFiStationProvisioned())
+    {
+        ESP_LOGI(TAG, "ClearWiFiStationProvision");
+        chip::DeviceLayer::ConnectivityMgr().ClearWiFiStationProvision();
+        if (chip::DeviceLayer::ConnectivityMgr().IsWiFiStationProvisioned())
+        {
+            ESP_LOGE(TAG, "WiFi credentials not cleared");
+            return false;
+        }
+    }
+#if CHIP_DEVICE_CONFIG_ENABLE_THREAD
+    if (chip::DeviceLayer::ConnectivityMgr().IsThreadProvisioned())
+    {
+        // OpenThread does not erase the dataset of an attached node
+        CHIP_ERROR err = chip::DeviceLayer::ThreadStackMgr().SetThreadEnabled(false);
+        if (err != CHIP_NO_ERROR)
+        {
+            ESP_LOGE(TAG, "Thread disable failed: %" CHIP_ERROR_FORMAT, err.Format());
+        }
+        ESP_LOGI(TAG, "ErasePersistentInfo");
+        chip::DeviceLayer::ConnectivityMgr().ErasePersistentInfo();
+        if (chip::DeviceLayer::ConnectivityMgr().IsThreadProvisioned())
+        {
+            ESP_LOGE(TAG, "Thread dataset not erased");
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+#if CONFIG_DECOMMISSION_WITHOUT_REBOOT
+// BLE memory is released after commissioning, it can not be initialised again without a restart
+static bool bleDeinitialized = false;
+// Commissioning window reopened in place, restart if it closes with no fabric
+static bool decommissionedInPlace = false;
+
+// Reset network credentials and reopen the commissioning window keeping the led driver running.
+// false if the device has to restart instead
+static bool app_decommission_in_place()
+{
+    if (bleDeinitialized)
+    {
+        ESP_LOGI(TAG, "BLE deinitialized, restart to commission");
+        return false;
+    }
+    CHIP_ERROR err = chip::DeviceLayer::Internal::BLEMgr().Init();
+    if (err != CHIP_NO_ERROR)
+    {
+        ESP_LOGE(TAG, "BLEManager initialization failed: %" CHIP_ERROR_FORMAT, err.Format());
+        return false;
+    }
+    if (!app_clear_network_credentials())
+    {
+        return false;
+    }
+
+    chip::CommissioningWindowManager & commissionMgr = chip::Server::GetInstance().GetCommissioningWindowManager();
+    if (commissionMgr.IsCommissioningWindowOpen())
+    {
+        ESP_LOGI(TAG, "Commissioning window already open");
+        decommissionStart = 0;
+        decommissionedInPlace = true;
+        return true;
+    }
+    // Advertise over BLE
+    constexpr auto kTimeoutSeconds = chip::System::Clock::Seconds16(k_timeout_seconds);
+    chip::DeviceLayer::ConnectivityMgr().SetBLEAdvertisingEnabled(true);
+    err = commissionMgr.OpenBasicCommissioningWindow(kTimeoutSeconds);
+    if (err != CHIP_NO_ERROR)
+    {
+        ESP_LOGE(TAG, "Failed to open commissioning window: %" CHIP_ERROR_FORMAT, err.Format());
+        return false;
+    }
+    decommissionedInPlace = true;
+    return true;
+}
+#endif
+
 static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
 {
     switch (event->Type)
@@ -66,10 +171,14 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
         {
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_Established:
             ESP_LOGI(TAG, "WiFi Connectivity established");
+            boot_profile_mark("connected");
+            connectivity_monitor_event(ConnectivityType::wifi, true);
+            commissioning_timeline_event(CommissioningEvent::networkJoined);
             signalIndicator(SignalIndicator::connected);
             break;
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_Lost:
             ESP_LOGI(TAG, "WiFi Connectivity lost");
+            connectivity_monitor_event(ConnectivityType::wifi, false);
             break;
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_NoChange:
             ESP_LOGI(TAG, "WiFi Connectivity no change");
@@ -82,10 +191,14 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
         {
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_Established:
             ESP_LOGI(TAG, "Thread Connectivity established");
+            boot_profile_mark("connected");
+            connectivity_monitor_event(ConnectivityType::thread, true);
+            commissioning_timeline_event(CommissioningEvent::networkJoined);
             signalIndicator(SignalIndicator::connected);
             break;
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_Lost:
             ESP_LOGI(TAG, "Thread Connectivity lost");
+            connectivity_monitor_event(ConnectivityType::thread, false);
             break;
         case chip::DeviceLayer::ConnectivityChange::kConnectivity_NoChange:
             ESP_LOGI(TAG, "Thread Connectivity no change");
@@ -97,34 +210,63 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
         ESP_LOGI(TAG, "Thread InterfaceState Change");
         break;
 
+    case chip::DeviceLayer::DeviceEventType::kServerReady:
+        ESP_LOGI(TAG, "Server ready");
+        boot_profile_mark("server ready");
+        break;
+
     case chip::DeviceLayer::DeviceEventType::kCommissioningComplete:
         ESP_LOGI(TAG, "Commissioning complete, fabric count: %u", chip::Server::GetInstance().GetFabricTable().FabricCount());
+        commissioning_timeline_event(CommissioningEvent::complete);
         signalIndicator(SignalIndicator::commissioningStop);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kFailSafeTimerExpired:
         ESP_LOGI(TAG, "Commissioning failed, fail safe timer expired");
+        commissioning_timeline_event(CommissioningEvent::failSafeExpired);
         signalIndicator(SignalIndicator::commissioningStop);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCommissioningSessionStarted:
         ESP_LOGI(TAG, "Commissioning session started");
+        commissioning_timeline_event(CommissioningEvent::sessionStarted);
         signalIndicator(SignalIndicator::commissioningStart);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCommissioningSessionStopped:
         ESP_LOGI(TAG, "Commissioning session stopped");
+        commissioning_timeline_event(CommissioningEvent::sessionStopped);
         signalIndicator(SignalIndicator::commissioningStop);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCommissioningWindowOpened:
         ESP_LOGI(TAG, "Commissioning window opened");
+        boot_profile_mark("commissionable");
+        commissioning_timeline_event(CommissioningEvent::windowOpened);
+        if (decommissionStart != 0)
+        {
+            ESP_LOGI(TAG, "Commissionable %lld ms after last fabric removal", (esp_timer_get_time() - decommissionStart) / 1000);
+            decommissionStart = 0;
+        }
         signalIndicator(SignalIndicator::commissioningOpen);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCommissioningWindowClosed:
         ESP_LOGI(TAG, "Commissioning window closed");
+        commissioning_timeline_event(CommissioningEvent::windowClosed);
         signalIndicator(SignalIndicator::commissioningClose);
+#if CONFIG_DECOMMISSION_WITHOUT_REBOOT
+        if (decommissionedInPlace)
+        {
+            decommissionedInPlace = false;
+            if (chip::Server::GetInstance().GetFabricTable().FabricCount() == 0)
+            {
+                // Not commissioned, a clean boot opens a new window
+                ESP_LOGI(TAG, "Window closed without commissioning, restart");
+                esp_restart();
+            }
+        }
+#endif
         break;
 
     case chip::DeviceLayer::DeviceEventType::kFabricRemoved:
@@ -133,36 +275,23 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
         if (chip::Server::GetInstance().GetFabricTable().FabricCount() == 0)
         {
             ESP_LOGI(TAG, "Last fabric removed");
+            decommissionStart = esp_timer_get_time();
+#if CONFIG_DECOMMISSION_WITHOUT_REBOOT
+            // Led driver state is left untouched
+            if (app_decommission_in_place())
+            {
+                break;
+            }
+#else
             // Initialise BLE manager
             CHIP_ERROR err = chip::DeviceLayer::Internal::BLEMgr().Init();
             if (err != CHIP_NO_ERROR)
             {
                 ESP_LOGE(TAG, "BLEManager initialization failed: %" CHIP_ERROR_FORMAT, err.Format());
             }
-            // Clear Wifi credentials if any
-            if (chip::DeviceLayer::ConnectivityMgr().IsWiFiStationProvisioned())
-            {
-                ESP_LOGI(TAG, "ClearWiFiStationProvision");
-                chip::DeviceLayer::ConnectivityMgr().ClearWiFiStationProvision();
-            }
-            // Clear Thread provision if any
-            if (chip::DeviceLayer::ConnectivityMgr().IsThreadProvisioned())
-            {
-                ESP_LOGI(TAG, "ErasePersistentInfo");
-                chip::DeviceLayer::ConnectivityMgr().ErasePersistentInfo();
-            }
+#endif
+            app_clear_network_credentials();
             esp_restart();
-            // if (!commissionMgr.IsCommissioningWindowOpen())
-            // {
-            // Advertise over BLE
-            // chip::CommissioningWindowManager & commissionMgr = chip::Server::GetInstance().GetCommissioningWindowManager();
-            // constexpr auto kTimeoutSeconds = chip::System::Clock::Seconds16(k_timeout_seconds);
-            // chip::DeviceLayer::ConnectivityMgr().SetBLEAdvertisingEnabled(true);
-            // err = commissionMgr.OpenBasicCommissioningWindow(kTimeoutSeconds);
-            // if (err != CHIP_NO_ERROR) {
-            //     ESP_LOGE(TAG, "Failed to open commissioning window: %" CHIP_ERROR_FORMAT, err.Format());
-            // }
-            // }
         }
         break;
     }
@@ -181,14 +310,19 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
 
     case chip::DeviceLayer::DeviceEventType::kCHIPoBLEConnectionEstablished:
         ESP_LOGI(TAG, "BLE connection established");
+        commissioning_timeline_event(CommissioningEvent::bleConnected);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCHIPoBLEConnectionClosed:
         ESP_LOGI(TAG, "BLE connection closed");
+        commissioning_timeline_event(CommissioningEvent::bleClosed);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kBLEDeinitialized:
         ESP_LOGI(TAG, "BLE deinitialized and memory reclaimed");
+#if CONFIG_DECOMMISSION_WITHOUT_REBOOT
+        bleDeinitialized = true;
+#endif
         break;
 
     default:
@@ -196,6 +330,31 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
     }
 }
 
+// Driver bring-up runs in parallel with Matter node construction
+static void driverInitTask(void *pvParameters) {
+    EventGroupHandle_t bootEvents = (EventGroupHandle_t)pvParameters;
+
+    indicator_driver_init();
+    // Indicate start
+    signalIndicator(SignalIndicator::startup);
+    boot_profile_mark("indicator");
+
+    /* Initialize led driver, reads calibration from the factory partition */
+    app_driver_init();
+    boot_profile_mark("led driver");
+
+    xEventGroupSetBits(bootEvents, BOOT_DRIVERS_READY);
+    vTaskDelete(nullptr);
+}
+
+// Delta OTA images are built against the running image, log it to pick the base
+static void printRunningImage() {
+    const esp_app_desc_t *desc = esp_app_get_description();
+    char sha256[17];
+    esp_app_get_elf_sha256(sha256, sizeof(sha256));
+    ESP_LOGI(TAG, "Running image: %s, elf sha256: %s", desc->version, sha256);
+}
+
 static void button_reset_cb() {
     esp_matter::factory_reset();
 }
@@ -221,7 +380,18 @@ static esp_err_t app_attribute_update_cb(attribute::callback_type_t type,
                                          void *priv_data)
 {
     if (type == PRE_UPDATE) {
-        app_driver_attribute_update(endpoint_id, cluster_id, attribute_id, val);
+#if CONFIG_ATTRIBUTE_TRACE
+        attribute_trace_record(endpoint_id, cluster_id, attribute_id, val);
+#endif
+#if CONFIG_LED_SIMULATED
+        // Only writes driving the led output start a latency measurement
+        if (endpoint_id == app_driver_light_endpoint_id() &&
+            (cluster_id == OnOff::Id || cluster_id == LevelControl::Id || cluster_id == ColorControl::Id)) {
+            led_sim_command();
+        }
+#endif
+        report_policy_external(endpoint_id, cluster_id, attribute_id, *val);
+        return app_driver_attribute_update(endpoint_id, cluster_id, attribute_id, val);
     }
     return ESP_OK;
 }
@@ -252,7 +422,12 @@ extern "C" void app_main()
 {
     esp_err_t err = ESP_OK;
 
+    boot_profile_start();
     setupLogging();
+#if CONFIG_FLASH_LOG
+    flash_log_init();
+#endif
+    printRunningImage();
 
 #ifdef CONFIG_XIAO_ESP32C6_EXTERNAL_ANTENNA
     xiao_wifi_init();
@@ -260,13 +435,10 @@ extern "C" void app_main()
     
     /* Initialize the ESP NVS layer */
     nvs_flash_init();
+    boot_profile_mark("nvs");
 
-    /* Initialize led driver */
-    app_driver_init();
-    indicator_driver_init();
-
-    // Indicate start
-    signalIndicator(SignalIndicator::startup);
+    EventGroupHandle_t bootEvents = xEventGroupCreate();
+    xTaskCreate(driverInitTask, "driverInit", 4096, bootEvents, 5, nullptr);
 
     /* Create a Matter node and add the mandatory Root Node device type on endpoint 0 */
     node::config_t node_config;
@@ -274,12 +446,37 @@ extern "C" void app_main()
     // node handle can be used to add/modify other endpoints.
     node_t *node = node::create(&node_config, app_attribute_update_cb, app_identification_cb);
     ABORT_APP_ON_FAILURE(node != nullptr, ESP_LOGE(TAG, "Failed to create Matter node"));
-    
+    boot_profile_mark("node");
+
+    // Endpoint bounds depend on the led calibration
+    xEventGroupWaitBits(bootEvents, BOOT_DRIVERS_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    vEventGroupDelete(bootEvents);
+
     // Create endpoints
     app_driver_create_endpoints(node);
+    boot_profile_mark("endpoints");
+
+    connectivity_monitor_init();
+    commissioning_timeline_init();
+    report_policy_init();
+#if CONFIG_SAMPLING_PROFILER
+    profiler_init();
+#endif
+#if CONFIG_ATTRIBUTE_TRACE
+    attribute_trace_init();
+#endif
+#if CONFIG_THERMAL_FOLDBACK
+    thermal_manager_init();
+#endif
+#if CONFIG_OTA_PIPELINED_WRITE && CONFIG_LIGHT_SELF_CHECK
+    ota_pipeline_add_check();
+#endif
 
     // Install button driver
     app_driver_button_init(button_toggle_cb, button_reset_cb);
+#if CONFIG_ROTARY_ENCODER
+    app_driver_encoder_init(encoder_turn_cb);
+#endif
 
 
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD && CHIP_DEVICE_CONFIG_ENABLE_WIFI_STATION
@@ -305,10 +502,26 @@ extern "C" void app_main()
     esp_matter::cluster::basic_information::attribute::create_serial_number(basic_information_cluster, NULL, 0);
     esp_matter::cluster::basic_information::attribute::create_product_label(basic_information_cluster, NULL, 0);
     esp_matter::cluster::basic_information::attribute::create_product_url(basic_information_cluster, NULL, 0);
+
+#if CONFIG_FLASH_LOG
+    // End user support log from the flash log store
+    cluster::diagnostic_logs::config_t diagnostic_logs_config;
+    diagnostic_logs_config.delegate = flash_log_diagnostic_delegate();
+    if (diagnostic_logs_config.delegate != nullptr) {
+        cluster::diagnostic_logs::create(endpoint::get(node, chip::kRootEndpointId), &diagnostic_logs_config, CLUSTER_FLAG_SERVER);
+    }
+#endif
+
+#if CONFIG_SCHEDULE_ENGINE
+    // Time source for the schedule engine
+    cluster::time_synchronization::config_t time_sync_config;
+    cluster::time_synchronization::create(endpoint::get(node, chip::kRootEndpointId), &time_sync_config, CLUSTER_FLAG_SERVER);
+#endif
     
     /* Matter start */
     err = esp_matter::start(app_event_cb);
     ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to start Matter, err:%d", err));
+    boot_profile_mark("matter start");
 
     auto serial_number_attr = attribute::get(basic_information_cluster, BasicInformation::Attributes::SerialNumber::Id);
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
@@ -318,6 +531,14 @@ extern "C" void app_main()
     }
 
     app_driver_restore_matter_state();
+    boot_profile_mark("restore");
+
+#if CONFIG_ENERGY_METER
+    energy_meter_start();
+#endif
+#if CONFIG_SCHEDULE_ENGINE
+    schedule_engine_init();
+#endif
 
 #if CONFIG_ENABLE_ENCRYPTED_OTA
     err = esp_matter_ota_requestor_encrypted_init(s_decryption_key, s_decryption_key_len);
@@ -336,10 +557,13 @@ extern "C" void app_main()
     esp_matter::console::diagnostics_register_commands();
     esp_matter::console::wifi_register_commands();
     esp_matter::console::factoryreset_register_commands();
+    light_console_register_commands();
+    light_bench_init();
 #if CONFIG_OPENTHREAD_CLI
     esp_matter::console::otcli_register_commands();
 #endif
     esp_matter::console::init();
     ESP_LOGI(TAG, "Console initialized");
 #endif
+    boot_profile_done();
 }
@@ -31,11 +31,21 @@ void app_driver_button_init(void (*button_toggle_callback)(), void (*button_rese
  * @param[in] attribute_id Attribute ID of the attribute.
  * @param[in] val Pointer to `esp_matter_attr_val_t`. Use appropriate elements as per the value type.
  *
+ * @return ESP_OK on success, an error rejects the write.
+ *
  */
-void app_driver_attribute_update(uint16_t endpoint_id,
-                                 uint32_t cluster_id,
-                                 uint32_t attribute_id,
-                                 esp_matter_attr_val_t *val);
+esp_err_t app_driver_attribute_update(uint16_t endpoint_id,
+                                      uint32_t cluster_id,
+                                      uint32_t attribute_id,
+                                      esp_matter_attr_val_t *val);
+
+// Scheduled brightness & color temperature change with explicit fade time in ms
+void app_driver_light_set_scheduled(uint8_t brightness, uint16_t mireds, uint32_t fadeTime);
+// Scheduled fade given up, e.g. overridden: RemainingTime drops to 0
+void app_driver_light_end_scheduled();
+
+// Endpoint id of the color temperature light
+uint16_t app_driver_light_endpoint_id();
 
 // Set defaults for device driver
 void app_driver_restore_matter_state();
@@ -43,6 +53,14 @@ void app_driver_restore_matter_state();
 // Button toggle callback
 void button_toggle_cb();
 
+#if CONFIG_ROTARY_ENCODER
+// Initialize the rotary encoder, turn_callback gets velocity-scaled steps and 0 once the knob stops
+void app_driver_encoder_init(void (*turn_callback)(int32_t steps, bool temperature));
+
+// Encoder turn callback
+void encoder_turn_cb(int32_t steps, bool temperature);
+#endif
+
 // Create device control endpoints
 void app_driver_create_endpoints(esp_matter::node_t *node);
 
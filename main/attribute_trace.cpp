@@ -0,0 +1,474 @@
+//
+// Attribute traffic recorder
+//
+// Attribute updates are packed into fixed size blocks: header with absolute time, then records
+// of varint time delta, kind byte, endpoint/cluster/attribute (omitted if same as the previous
+// record) and varint value. A record is 3-5 bytes for typical light traffic. The last blocks
+// are kept in RAM, sealed blocks are optionally written to the "trace" partition ring.
+// Blocks are dumped as hex over the console, traceDecode.py decodes them.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <platform/PlatformManager.h>
+
+#include "app_priv.h"
+#include "light_console.h"
+#include "attribute_trace.h"
+
+#if CONFIG_ATTRIBUTE_TRACE
+
+using namespace esp_matter;
+
+#define TRACE_BLOCK_SIZE 256
+#define TRACE_BLOCKS (CONFIG_ATTRIBUTE_TRACE_SIZE / TRACE_BLOCK_SIZE)
+#define TRACE_MAGIC 0x5254                  // "TR"
+#define TRACE_RECORD_MAX 29
+#define TRACE_SECTOR_SIZE 4096
+
+// Record kind byte: value kind in bits 0-3, bit 4 set if the key is the same as the previous record
+#define TRACE_KIND_NONE 0                   // value not recorded, e.g. strings
+#define TRACE_KIND_FALSE 1
+#define TRACE_KIND_TRUE 2
+#define TRACE_KIND_UNSIGNED 3
+#define TRACE_KIND_SIGNED 4                 // zigzag
+#define TRACE_KIND_REPEATED_KEY 0x10
+
+static const char *TAG = "attribute_trace";
+
+typedef struct {
+    uint16_t magic;
+    uint16_t used;                          // record bytes
+    uint32_t sequence;
+    uint32_t time;                          // ms since boot at block start
+} trace_block_header_t;
+
+typedef struct {
+    trace_block_header_t header;
+    uint8_t data[TRACE_BLOCK_SIZE - sizeof(trace_block_header_t)];
+} trace_block_t;
+
+static trace_block_t blocks[TRACE_BLOCKS];
+static uint32_t nextSequence = 1;
+static uint32_t oldestSequence = 1;        // oldest block kept in RAM
+static uint32_t flushedSequence;           // last block written to flash
+static uint32_t lastTime;                  // ms, previous record
+static uint16_t lastEndpoint;
+static uint32_t lastCluster;
+static uint32_t lastAttribute;
+static bool blockOpen;                   // records are appended to block nextSequence - 1
+static volatile bool replaying;
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+static const esp_partition_t *partition;
+static TaskHandle_t flushTask;
+static volatile bool flushAll;
+#endif
+
+static trace_block_t *attribute_trace_block(uint32_t sequence) {
+    return &blocks[sequence % TRACE_BLOCKS];
+}
+
+static size_t attribute_trace_put_varint(uint8_t *out, uint64_t value) {
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[length++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return length;
+}
+
+static void attribute_trace_new_block(uint32_t now) {
+    uint32_t sequence = nextSequence++;
+    trace_block_t *block = attribute_trace_block(sequence);
+    if (sequence - oldestSequence >= TRACE_BLOCKS) {
+        oldestSequence = sequence - TRACE_BLOCKS + 1;
+    }
+    block->header.magic = TRACE_MAGIC;
+    block->header.used = 0;
+    block->header.sequence = sequence;
+    block->header.time = now;
+    lastTime = now;
+    lastCluster = UINT32_MAX;
+    blockOpen = true;
+}
+
+// Value kind and raw value of the supported scalar types
+static uint8_t attribute_trace_value(const esp_matter_attr_val_t *val, uint64_t *value) {
+    switch (val->type & ~ESP_MATTER_VAL_NULLABLE_BASE) {
+    case ESP_MATTER_VAL_TYPE_BOOLEAN:
+        return val->val.b ? TRACE_KIND_TRUE : TRACE_KIND_FALSE;
+    case ESP_MATTER_VAL_TYPE_UINT8:
+    case ESP_MATTER_VAL_TYPE_ENUM8:
+    case ESP_MATTER_VAL_TYPE_BITMAP8:
+        *value = val->val.u8;
+        return TRACE_KIND_UNSIGNED;
+    case ESP_MATTER_VAL_TYPE_UINT16:
+    case ESP_MATTER_VAL_TYPE_ENUM16:
+    case ESP_MATTER_VAL_TYPE_BITMAP16:
+        *value = val->val.u16;
+        return TRACE_KIND_UNSIGNED;
+    case ESP_MATTER_VAL_TYPE_UINT32:
+    case ESP_MATTER_VAL_TYPE_BITMAP32:
+        *value = val->val.u32;
+        return TRACE_KIND_UNSIGNED;
+    case ESP_MATTER_VAL_TYPE_UINT64:
+        *value = val->val.u64;
+        return TRACE_KIND_UNSIGNED;
+    case ESP_MATTER_VAL_TYPE_INT8:
+        *value = (uint64_t(int64_t(val->val.i8)) << 1) ^ uint64_t(int64_t(val->val.i8) >> 63);
+        return TRACE_KIND_SIGNED;
+    case ESP_MATTER_VAL_TYPE_INT16:
+        *value = (uint64_t(int64_t(val->val.i16)) << 1) ^ uint64_t(int64_t(val->val.i16) >> 63);
+        return TRACE_KIND_SIGNED;
+    case ESP_MATTER_VAL_TYPE_INT32:
+        *value = (uint64_t(int64_t(val->val.i32)) << 1) ^ uint64_t(int64_t(val->val.i32) >> 63);
+        return TRACE_KIND_SIGNED;
+    case ESP_MATTER_VAL_TYPE_INT64:
+        *value = (uint64_t(val->val.i64) << 1) ^ uint64_t(val->val.i64 >> 63);
+        return TRACE_KIND_SIGNED;
+    default:
+        return TRACE_KIND_NONE;
+    }
+}
+
+void attribute_trace_record(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const esp_matter_attr_val_t *val) {
+    if (replaying) {
+        return;
+    }
+    uint32_t now = uint32_t(esp_timer_get_time() / 1000);
+    uint8_t record[TRACE_RECORD_MAX];
+    uint64_t value = 0;
+    uint8_t kind = attribute_trace_value(val, &value);
+    bool sealed = false;
+
+    portENTER_CRITICAL(&traceLock);
+    trace_block_t *block = attribute_trace_block(nextSequence - 1);
+    if (!blockOpen || block->header.used + TRACE_RECORD_MAX > int(sizeof(block->data))) {
+        sealed = blockOpen;
+        attribute_trace_new_block(now);
+        block = attribute_trace_block(nextSequence - 1);
+    }
+    bool repeated = endpoint_id == lastEndpoint && cluster_id == lastCluster && attribute_id == lastAttribute;
+    size_t length = attribute_trace_put_varint(record, now - lastTime);
+    record[length++] = kind | (repeated ? TRACE_KIND_REPEATED_KEY : 0);
+    if (!repeated) {
+        length += attribute_trace_put_varint(record + length, endpoint_id);
+        length += attribute_trace_put_varint(record + length, cluster_id);
+        length += attribute_trace_put_varint(record + length, attribute_id);
+    }
+    if (kind == TRACE_KIND_UNSIGNED || kind == TRACE_KIND_SIGNED) {
+        length += attribute_trace_put_varint(record + length, value);
+    }
+    memcpy(block->data + block->header.used, record, length);
+    block->header.used += length;
+    lastTime = now;
+    lastEndpoint = endpoint_id;
+    lastCluster = cluster_id;
+    lastAttribute = attribute_id;
+    portEXIT_CRITICAL(&traceLock);
+
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+    if (sealed && flushTask != nullptr) {
+        xTaskNotifyGive(flushTask);
+    }
+#else
+    (void)sealed;
+#endif
+}
+
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+// Write sealed blocks to the partition ring, erasing each sector on entry
+static void attribute_trace_flush() {
+    trace_block_t block;
+    for (;;) {
+        portENTER_CRITICAL(&traceLock);
+        if (flushAll) {
+            // Seal the open block, it can't be written twice
+            flushAll = false;
+            blockOpen = false;
+        }
+        uint32_t sealedEnd = blockOpen ? nextSequence - 1 : nextSequence;
+        if (flushedSequence < oldestSequence - 1) {
+            flushedSequence = oldestSequence - 1;
+        }
+        bool pending = flushedSequence + 1 < sealedEnd;
+        if (pending) {
+            block = *attribute_trace_block(flushedSequence + 1);
+        }
+        portEXIT_CRITICAL(&traceLock);
+        if (!pending) {
+            return;
+        }
+
+        uint32_t flashBlocks = partition->size / TRACE_BLOCK_SIZE;
+        size_t offset = (block.header.sequence % flashBlocks) * TRACE_BLOCK_SIZE;
+        esp_err_t err = ESP_OK;
+        if (offset % TRACE_SECTOR_SIZE == 0) {
+            err = esp_partition_erase_range(partition, offset, TRACE_SECTOR_SIZE);
+        }
+        if (err == ESP_OK) {
+            err = esp_partition_write(partition, offset, &block, sizeof(block));
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Trace flush failed: %s", esp_err_to_name(err));
+            return;
+        }
+        flushedSequence = block.header.sequence;
+    }
+}
+
+static void traceFlushTask(void *pvParameters) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        attribute_trace_flush();
+    }
+}
+
+// Continue block numbering after the newest block in flash
+static void attribute_trace_scan_flash() {
+    trace_block_header_t header;
+    for (size_t offset = 0; offset + TRACE_BLOCK_SIZE <= partition->size; offset += TRACE_BLOCK_SIZE) {
+        if (esp_partition_read(partition, offset, &header, sizeof(header)) == ESP_OK &&
+            header.magic == TRACE_MAGIC && header.sequence != UINT32_MAX && header.sequence >= nextSequence) {
+            nextSequence = header.sequence + 1;
+        }
+    }
+    oldestSequence = nextSequence;
+    flushedSequence = nextSequence - 1;
+}
+#endif
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static size_t attribute_trace_get_varint(const uint8_t *in, size_t size, uint64_t *value) {
+    *value = 0;
+    for (size_t i = 0; i < size && i < 10; i++) {
+        *value |= uint64_t(in[i] & 0x7f) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static void attribute_trace_print_block(const trace_block_t *block) {
+    const uint8_t *bytes = (const uint8_t *)block;
+    printf("TRACE ");
+    for (size_t i = 0; i < sizeof(block->header) + block->header.used; i++) {
+        printf("%02x", bytes[i]);
+    }
+    printf("\n");
+}
+
+static void attribute_trace_dump_ram() {
+    trace_block_t block;
+    for (uint32_t sequence = oldestSequence; sequence < nextSequence; sequence++) {
+        portENTER_CRITICAL(&traceLock);
+        block = *attribute_trace_block(sequence);
+        portEXIT_CRITICAL(&traceLock);
+        if (block.header.magic == TRACE_MAGIC && block.header.sequence == sequence) {
+            attribute_trace_print_block(&block);
+        }
+    }
+}
+
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+static void attribute_trace_dump_flash() {
+    trace_block_t block;
+    for (size_t offset = 0; offset + TRACE_BLOCK_SIZE <= partition->size; offset += TRACE_BLOCK_SIZE) {
+        if (esp_partition_read(partition, offset, &block, sizeof(block)) == ESP_OK &&
+            block.header.magic == TRACE_MAGIC && block.header.used <= sizeof(block.data)) {
+            attribute_trace_print_block(&block);
+        }
+    }
+}
+#endif
+
+// Feed recorded RAM trace back to the driver with the recorded timing. Record deltas are
+// relative to the block header time, each record is due at its recorded time since the first
+// replayed one, so gaps between blocks are kept and delays do not accumulate rounding
+static void traceReplayTask(void *pvParameters) {
+    uint32_t speed = uint32_t(uintptr_t(pvParameters));
+    trace_block_t block;
+    uint32_t first = oldestSequence;
+    uint32_t last = nextSequence;
+    uint32_t count = 0;
+    bool started = false;
+    uint32_t firstTime = 0;             // ms, recorded time of the first replayed record
+    int64_t replayStart = 0;            // us
+
+    replaying = true;
+    for (uint32_t sequence = first; sequence < last; sequence++) {
+        portENTER_CRITICAL(&traceLock);
+        block = *attribute_trace_block(sequence);
+        portEXIT_CRITICAL(&traceLock);
+        if (block.header.magic != TRACE_MAGIC || block.header.sequence != sequence) {
+            continue;
+        }
+        uint16_t endpointId = 0;
+        uint32_t clusterId = 0;
+        uint32_t attributeId = 0;
+        uint32_t recordTime = block.header.time;
+        size_t pos = 0;
+        while (pos < block.header.used) {
+            uint64_t delta, field;
+            size_t n = attribute_trace_get_varint(block.data + pos, block.header.used - pos, &delta);
+            if (n == 0 || pos + n >= block.header.used) {
+                break;
+            }
+            pos += n;
+            recordTime += uint32_t(delta);
+            uint8_t kind = block.data[pos++];
+            if (!(kind & TRACE_KIND_REPEATED_KEY)) {
+                pos += attribute_trace_get_varint(block.data + pos, block.header.used - pos, &field);
+                endpointId = field;
+                pos += attribute_trace_get_varint(block.data + pos, block.header.used - pos, &field);
+                clusterId = field;
+                pos += attribute_trace_get_varint(block.data + pos, block.header.used - pos, &field);
+                attributeId = field;
+            }
+            uint64_t value = 0;
+            kind &= ~TRACE_KIND_REPEATED_KEY;
+            if (kind == TRACE_KIND_UNSIGNED || kind == TRACE_KIND_SIGNED) {
+                pos += attribute_trace_get_varint(block.data + pos, block.header.used - pos, &value);
+            }
+            if (kind == TRACE_KIND_NONE) {
+                continue;
+            }
+            if (!started) {
+                started = true;
+                firstTime = recordTime;
+                replayStart = esp_timer_get_time();
+            }
+            int64_t wait = replayStart + int64_t(recordTime - firstTime) * 1000 * 100 / speed - esp_timer_get_time();
+            if (wait >= 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait / 1000));
+            }
+
+            // Rebuild the value with the type of the attribute, the data model belongs to the
+            // Matter thread
+            esp_matter_attr_val_t val = esp_matter_invalid(NULL);
+            chip::DeviceLayer::PlatformMgr().LockChipStack();
+            attribute_t *attr = attribute::get(endpointId, clusterId, attributeId);
+            bool found = attr != nullptr && attribute::get_val(attr, &val) == ESP_OK;
+            chip::DeviceLayer::PlatformMgr().UnlockChipStack();
+            if (!found) {
+                continue;
+            }
+            if (kind == TRACE_KIND_SIGNED) {
+                value = (value >> 1) ^ -(value & 1);
+            }
+            switch (val.type & ~ESP_MATTER_VAL_NULLABLE_BASE) {
+            case ESP_MATTER_VAL_TYPE_BOOLEAN:
+                val.val.b = kind == TRACE_KIND_TRUE;
+                break;
+            case ESP_MATTER_VAL_TYPE_UINT8:
+            case ESP_MATTER_VAL_TYPE_ENUM8:
+            case ESP_MATTER_VAL_TYPE_BITMAP8:
+            case ESP_MATTER_VAL_TYPE_INT8:
+                val.val.u8 = value;
+                break;
+            case ESP_MATTER_VAL_TYPE_UINT16:
+            case ESP_MATTER_VAL_TYPE_ENUM16:
+            case ESP_MATTER_VAL_TYPE_BITMAP16:
+            case ESP_MATTER_VAL_TYPE_INT16:
+                val.val.u16 = value;
+                break;
+            case ESP_MATTER_VAL_TYPE_UINT32:
+            case ESP_MATTER_VAL_TYPE_BITMAP32:
+            case ESP_MATTER_VAL_TYPE_INT32:
+                val.val.u32 = value;
+                break;
+            case ESP_MATTER_VAL_TYPE_UINT64:
+            case ESP_MATTER_VAL_TYPE_INT64:
+                val.val.u64 = value;
+                break;
+            default:
+                continue;
+            }
+            app_driver_attribute_update(endpointId, clusterId, attributeId, &val);
+            count++;
+        }
+    }
+    replaying = false;
+    printf("Replayed %lu updates\n", count);
+    vTaskDelete(nullptr);
+}
+
+static esp_err_t trace_handler(int argc, char **argv) {
+    if (argc == 0) {
+        printf("blocks: %lu..%lu in RAM, %lu bytes each\n", oldestSequence, nextSequence - 1, (uint32_t)TRACE_BLOCK_SIZE);
+        printf("Usage: trace [dump [flash]|flush|clear|replay [speed %%]]\n");
+        return ESP_OK;
+    }
+    if (strcmp(argv[0], "dump") == 0) {
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+        if (argc > 1 && strcmp(argv[1], "flash") == 0) {
+            attribute_trace_dump_flash();
+            return ESP_OK;
+        }
+#endif
+        attribute_trace_dump_ram();
+        return ESP_OK;
+    }
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+    if (strcmp(argv[0], "flush") == 0 && flushTask != nullptr) {
+        flushAll = true;
+        xTaskNotifyGive(flushTask);
+        return ESP_OK;
+    }
+#endif
+    if (strcmp(argv[0], "clear") == 0) {
+        portENTER_CRITICAL(&traceLock);
+        oldestSequence = nextSequence;
+        // Next record starts a new block, the open one is dropped with the others
+        blockOpen = false;
+        portEXIT_CRITICAL(&traceLock);
+        return ESP_OK;
+    }
+    if (strcmp(argv[0], "replay") == 0 && !replaying) {
+        uint32_t speed = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100;
+        if (speed == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        xTaskCreate(traceReplayTask, "traceReplay", 4096, (void *)uintptr_t(speed), 5, nullptr);
+        return ESP_OK;
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+#endif
+
+void attribute_trace_init() {
+#if CONFIG_ATTRIBUTE_TRACE_FLASH
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "trace");
+    if (partition != nullptr) {
+        attribute_trace_scan_flash();
+        xTaskCreate(traceFlushTask, "traceFlush", 3072, nullptr, 2, &flushTask);
+        ESP_LOGI(TAG, "Trace partition: %lu blocks, next block %lu", partition->size / TRACE_BLOCK_SIZE, nextSequence);
+    } else {
+        ESP_LOGW(TAG, "No trace partition, RAM trace only");
+    }
+#endif
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const console::command_t commands[] = {
+        {
+            .name = "trace",
+            .description = "Attribute traffic trace. Usage: matter esp light trace [dump [flash]|flush|clear|replay [speed %]]",
+            .handler = trace_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
@@ -0,0 +1,14 @@
+//
+// Attribute traffic recorder
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <esp_matter.h>
+
+#if CONFIG_ATTRIBUTE_TRACE
+// Record attribute update at the app_attribute_update_cb boundary
+void attribute_trace_record(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const esp_matter_attr_val_t *val);
+void attribute_trace_init();
+#endif
@@ -0,0 +1,125 @@
+//
+// Boot phase timing
+//
+// Phase end timestamps are kept in RTC memory not initialised at reset, so the timeline
+// of the previous boot survives a software or watchdog reset.
+//
+
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "boot_profile.h"
+#include "light_console.h"
+
+#define BOOT_MARKS 16
+#define BOOT_PHASE_NAME 16
+#define BOOT_PROFILE_MAGIC 0x32544f42      // "BOT2"
+
+static const char *TAG = "boot_profile";
+
+typedef struct {
+    char phase[BOOT_PHASE_NAME];
+    uint32_t time;              // ms since esp_timer start
+    uint32_t freeHeap;          // bytes
+} boot_mark_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t bootCount;
+    uint32_t resetReason;
+    uint32_t count;
+    boot_mark_t marks[BOOT_MARKS];
+} boot_timeline_t;
+
+RTC_NOINIT_ATTR static boot_timeline_t current;
+RTC_NOINIT_ATTR static boot_timeline_t previous;
+static portMUX_TYPE marksLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void boot_profile_print(const boot_timeline_t *timeline) {
+    printf("boot %lu, reset reason %lu\n", timeline->bootCount, timeline->resetReason);
+    uint32_t last = 0;
+    uint32_t lastHeap = 0;
+    for (uint32_t i = 0; i < timeline->count && i < BOOT_MARKS; i++) {
+        const boot_mark_t &mark = timeline->marks[i];
+        int32_t heapDelta = i == 0 ? 0 : int32_t(mark.freeHeap - lastHeap);
+        printf("%6lu ms %+6ld ms  heap %6lu %+7ld  %.*s\n", mark.time, int32_t(mark.time - last),
+               mark.freeHeap, heapDelta, BOOT_PHASE_NAME, mark.phase);
+        last = mark.time;
+        lastHeap = mark.freeHeap;
+    }
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t boot_handler(int argc, char **argv) {
+    boot_timeline_t timeline;
+    portENTER_CRITICAL(&marksLock);
+    timeline = argc > 0 && strcmp(argv[0], "previous") == 0 ? previous : current;
+    portEXIT_CRITICAL(&marksLock);
+
+    if (timeline.magic != BOOT_PROFILE_MAGIC) {
+        printf("No boot timeline\n");
+        return ESP_OK;
+    }
+    boot_profile_print(&timeline);
+    return ESP_OK;
+}
+#endif
+
+void boot_profile_start() {
+    uint32_t bootCount = 0;
+    if (current.magic == BOOT_PROFILE_MAGIC) {
+        previous = current;
+        bootCount = current.bootCount;
+    } else {
+        previous.magic = 0;
+    }
+    memset(&current, 0, sizeof(current));
+    current.magic = BOOT_PROFILE_MAGIC;
+    current.bootCount = bootCount + 1;
+    current.resetReason = esp_reset_reason();
+    boot_profile_mark("app_main");
+}
+
+void boot_profile_mark(const char *phase) {
+    uint32_t time = uint32_t(esp_timer_get_time() / 1000);
+    uint32_t freeHeap = esp_get_free_heap_size();
+
+    portENTER_CRITICAL(&marksLock);
+    bool found = false;
+    for (uint32_t i = 0; i < current.count; i++) {
+        if (strncmp(current.marks[i].phase, phase, BOOT_PHASE_NAME) == 0) {
+            found = true;
+            break;
+        }
+    }
+    if (!found && current.count < BOOT_MARKS) {
+        boot_mark_t *mark = &current.marks[current.count++];
+        strncpy(mark->phase, phase, BOOT_PHASE_NAME);
+        mark->time = time;
+        mark->freeHeap = freeHeap;
+    }
+    portEXIT_CRITICAL(&marksLock);
+}
+
+void boot_profile_done() {
+    boot_profile_mark("done");
+    ESP_LOGI(TAG, "Boot timeline:");
+    boot_profile_print(&current);
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "boot",
+            .description = "Boot phase timeline. Usage: matter esp light boot [previous]",
+            .handler = boot_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
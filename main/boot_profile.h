@@ -0,0 +1,14 @@
+//
+// Boot phase timing
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+// Start a new boot timeline, the previous one is kept for the console
+void boot_profile_start();
+// Record end of a boot phase, repeated phase names are ignored
+void boot_profile_mark(const char *phase);
+// Log the timeline and add console command
+void boot_profile_done();
@@ -0,0 +1,203 @@
+//
+// Per-unit led calibration from the factory partition
+//
+// The factory partition is in NVS format. It is memory-mapped and the calibration
+// blob is located by walking NVS pages. Channel values are parsed, the driver uses the
+// correction curve directly from flash.
+//
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <string.h>
+
+#include "calibration.h"
+
+#define NVS_PAGE_SIZE 4096
+#define NVS_ENTRY_SIZE 32
+#define NVS_ENTRY_COUNT 126
+#define NVS_ENTRY_OFFSET 64             // page header + entry state bitmap
+#define NVS_BITMAP_OFFSET 32
+
+#define NVS_PAGE_STATE_ACTIVE 0xfffffffe
+#define NVS_PAGE_STATE_FULL 0xfffffffc
+
+#define NVS_ENTRY_STATE_WRITTEN 2
+#define NVS_TYPE_U8 0x01
+#define NVS_TYPE_BLOB_DATA 0x42
+#define NVS_NAMESPACE_INDEX_ANY 0xff
+
+static const char *TAG = "calibration";
+static const char *CALIBRATION_NAMESPACE = "led-calibration";
+static const char *CALIBRATION_KEY = "record";
+
+typedef struct {
+    uint8_t nsIndex;
+    uint8_t type;
+    uint8_t span;
+    uint8_t chunkIndex;
+    uint32_t crc32;
+    char key[16];
+    union {
+        uint8_t u8;
+        struct {
+            uint16_t size;
+            uint16_t reserved;
+            uint32_t crc32;
+        } blob;
+    } data;
+} nvs_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;              // record size without crc
+} calibration_header_t;
+
+typedef struct {
+    calibration_header_t header;
+    uint16_t warmKelvin;
+    uint16_t coldKelvin;
+    uint16_t gain[2];
+    uint16_t deadZone[2];
+    uint16_t curvePoints;
+    uint16_t reserved;
+    uint16_t curve[];
+} calibration_record_v1_t;
+
+typedef struct {
+    calibration_header_t header;
+    uint16_t channels;
+    uint16_t curvePoints;
+    led_channel_calibration_t channel[];    // curve follows the channels
+} calibration_record_v2_t;
+
+static led_calibration_t unitCalibration;
+static const led_calibration_t *calibration = nullptr;
+static esp_partition_mmap_handle_t mmapHandle;
+
+static uint8_t nvs_entry_state(const uint8_t *page, int index) {
+    return (page[NVS_BITMAP_OFFSET + index / 4] >> ((index % 4) * 2)) & 3;
+}
+
+// Walk written entries of all active and full pages
+template <typename Visitor>
+static const nvs_entry_t *nvs_find(const uint8_t *base, size_t size, Visitor visit) {
+    for (size_t offset = 0; offset + NVS_PAGE_SIZE <= size; offset += NVS_PAGE_SIZE) {
+        const uint8_t *page = base + offset;
+        uint32_t state = *(const uint32_t *)page;
+        if (state != NVS_PAGE_STATE_ACTIVE && state != NVS_PAGE_STATE_FULL) {
+            continue;
+        }
+        for (int index = 0; index < NVS_ENTRY_COUNT; index++) {
+            if (nvs_entry_state(page, index) != NVS_ENTRY_STATE_WRITTEN) {
+                continue;
+            }
+            const nvs_entry_t *entry = (const nvs_entry_t *)(page + NVS_ENTRY_OFFSET + index * NVS_ENTRY_SIZE);
+            if (index + entry->span > NVS_ENTRY_COUNT || entry->span == 0) {
+                continue;
+            }
+            if (visit(entry)) {
+                return entry;
+            }
+            index += entry->span - 1;
+        }
+    }
+    return nullptr;
+}
+
+// Parse a version 1 or 2 record into out, the curve stays in the mapped record
+static bool calibration_parse(const uint8_t *record, size_t length, led_calibration_t *out) {
+    const calibration_header_t *header = (const calibration_header_t *)record;
+    if (length < sizeof(calibration_header_t) + sizeof(uint32_t) ||
+        header->magic != CALIBRATION_MAGIC ||
+        header->size + sizeof(uint32_t) != length) {
+        return false;
+    }
+    uint32_t crc = *(const uint32_t *)(record + header->size);
+    if (esp_rom_crc32_le(0, record, header->size) != crc) {
+        return false;
+    }
+
+    *out = {};
+    if (header->version == 1) {
+        const calibration_record_v1_t *v1 = (const calibration_record_v1_t *)record;
+        if (header->size < sizeof(calibration_record_v1_t) ||
+            header->size != sizeof(calibration_record_v1_t) + v1->curvePoints * sizeof(uint16_t)) {
+            return false;
+        }
+        out->channels = 2;
+        out->channel[0] = { v1->warmKelvin, v1->gain[0], v1->deadZone[0] };
+        out->channel[1] = { v1->coldKelvin, v1->gain[1], v1->deadZone[1] };
+        out->curvePoints = v1->curvePoints;
+        out->curve = v1->curve;
+    } else if (header->version == CALIBRATION_VERSION) {
+        const calibration_record_v2_t *v2 = (const calibration_record_v2_t *)record;
+        if (header->size < sizeof(calibration_record_v2_t) ||
+            v2->channels < 2 || v2->channels > CALIBRATION_CHANNELS ||
+            header->size != sizeof(calibration_record_v2_t) + v2->channels * sizeof(led_channel_calibration_t) +
+                            v2->curvePoints * sizeof(uint16_t)) {
+            return false;
+        }
+        out->channels = v2->channels;
+        memcpy(out->channel, v2->channel, v2->channels * sizeof(led_channel_calibration_t));
+        out->curvePoints = v2->curvePoints;
+        out->curve = (const uint16_t *)(v2->channel + v2->channels);
+    } else {
+        return false;
+    }
+
+    // Warm and cold bound the range, the neutral channel is inside it
+    uint16_t warm = out->channel[0].kelvin;
+    uint16_t cold = out->channel[1].kelvin;
+    if (warm == 0 || cold <= warm) {
+        return false;
+    }
+    return out->channels < 3 || (out->channel[2].kelvin > warm && out->channel[2].kelvin < cold);
+}
+
+void calibration_load() {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, CONFIG_CHIP_FACTORY_NAMESPACE_PARTITION_LABEL);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No factory partition");
+        return;
+    }
+
+    const void *mapped;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &mmapHandle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Factory partition mmap failed: %s", esp_err_to_name(err));
+        return;
+    }
+    const uint8_t *base = (const uint8_t *)mapped;
+
+    const nvs_entry_t *ns = nvs_find(base, partition->size, [](const nvs_entry_t *entry) {
+        return entry->nsIndex == 0 && entry->type == NVS_TYPE_U8 && strncmp(entry->key, CALIBRATION_NAMESPACE, sizeof(entry->key)) == 0;
+    });
+    const nvs_entry_t *blob = nullptr;
+    if (ns != nullptr) {
+        uint8_t nsIndex = ns->data.u8;
+        blob = nvs_find(base, partition->size, [nsIndex](const nvs_entry_t *entry) {
+            return entry->nsIndex == nsIndex && entry->type == NVS_TYPE_BLOB_DATA && strncmp(entry->key, CALIBRATION_KEY, sizeof(entry->key)) == 0;
+        });
+    }
+
+    // Blob data follows its header entry
+    if (blob != nullptr && blob->data.blob.size <= (blob->span - 1) * NVS_ENTRY_SIZE &&
+        calibration_parse((const uint8_t *)(blob + 1), blob->data.blob.size, &unitCalibration)) {
+        calibration = &unitCalibration;
+        for (int chan = 0; chan < calibration->channels; chan++) {
+            ESP_LOGI(TAG, "Calibration channel %d: %uK, gain: %u, dead zone: %u", chan,
+                     calibration->channel[chan].kelvin, calibration->channel[chan].gain, calibration->channel[chan].deadZone);
+        }
+        ESP_LOGI(TAG, "Calibration curve points: %u", calibration->curvePoints);
+        return;
+    }
+
+    ESP_LOGW(TAG, "No valid calibration, using Kconfig defaults");
+    esp_partition_munmap(mmapHandle);
+}
+
+const led_calibration_t *calibration_get() {
+    return calibration;
+}
@@ -0,0 +1,35 @@
+//
+// Per-unit led calibration from the factory partition
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define CALIBRATION_MAGIC 0x4C41434C    // "LCAL"
+#define CALIBRATION_VERSION 2
+#define CALIBRATION_GAIN_ONE 10000
+#define CALIBRATION_CHANNELS 3          // warm, cold, neutral
+
+// Calibration records, written by makeCalibration.py. Little endian, crc32 of the
+// record follows the curve.
+// Version 1: warmKelvin, coldKelvin, gain[2], deadZone[2], curvePoints, reserved, curve
+// Version 2: channels, curvePoints, per channel kelvin, gain, deadZone, curve
+typedef struct {
+    uint16_t kelvin;            // measured color temperature
+    uint16_t gain;              // CALIBRATION_GAIN_ONE is 1.0
+    uint16_t deadZone;          // duty where the led driver starts to emit
+} led_channel_calibration_t;
+
+typedef struct {
+    uint16_t channels;          // calibrated channels, warm and cold first
+    led_channel_calibration_t channel[CALIBRATION_CHANNELS];
+    uint16_t curvePoints;       // 0 or number of duty correction points
+    const uint16_t *curve;      // corrected duty for equally spaced duties 0..PWM base, in flash
+} led_calibration_t;
+
+// Map calibration record from the factory partition, it stays mapped
+void calibration_load();
+// Calibration of the unit, nullptr if not present or invalid
+const led_calibration_t *calibration_get();
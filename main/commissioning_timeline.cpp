@@ -0,0 +1,211 @@
+//
+// Commissioning timeline recorder
+//
+// Each commissioning attempt is a timeline of event offsets from the window opening.
+// The last attempts are kept in NVS, an attempt cut by a reboot is shown as interrupted.
+// Phases: BLE is the wait for the commissioner, PASE the session setup, network the
+// operational network join, CASE the operational session up to CommissioningComplete.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "commissioning_timeline.h"
+#include "light_console.h"
+
+#define COMMISSIONING_ATTEMPTS 8
+#define COMMISSIONING_EVENTS 9
+#define EVENT_NONE UINT32_MAX
+
+static const char *TAG = "commissioning";
+static const char *NVS_NAMESPACE = "commissioning";
+static const char *NVS_KEY_RING = "ring";
+
+static const char *eventName[COMMISSIONING_EVENTS] = {
+    "window opened", "ble connected", "pase", "network joined", "complete",
+    "fail-safe expired", "session stopped", "ble closed", "window closed"
+};
+
+enum class AttemptResult : uint8_t
+{
+    inProgress,
+    success,
+    failSafeExpired,
+    windowClosed,
+    interrupted
+};
+
+static const char *resultName[] = { "in progress", "success", "fail-safe expired", "window closed", "interrupted by reboot" };
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t offset[COMMISSIONING_EVENTS];  // ms from window opened, EVENT_NONE if not seen
+    AttemptResult result;
+    uint8_t lastEvent;
+} commissioning_attempt_t;
+
+typedef struct {
+    uint32_t count;                         // attempts recorded
+    commissioning_attempt_t attempts[COMMISSIONING_ATTEMPTS];
+} commissioning_ring_t;
+
+static commissioning_ring_t ring;
+static commissioning_attempt_t *attempt;   // current attempt, nullptr if none
+static int64_t attemptStart;               // us
+static portMUX_TYPE ringLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void commissioning_timeline_save() {
+    commissioning_ring_t copy;
+    portENTER_CRITICAL(&ringLock);
+    copy = ring;
+    portEXIT_CRITICAL(&ringLock);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NVS_KEY_RING, &copy, sizeof(copy));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs write failed: %s", esp_err_to_name(err));
+    }
+}
+
+static commissioning_attempt_t *commissioning_timeline_begin(int64_t now) {
+    commissioning_attempt_t *next = &ring.attempts[ring.count % COMMISSIONING_ATTEMPTS];
+    memset(next, 0, sizeof(*next));
+    next->sequence = ++ring.count;
+    for (int i = 0; i < COMMISSIONING_EVENTS; i++) {
+        next->offset[i] = EVENT_NONE;
+    }
+    attemptStart = now;
+    return next;
+}
+
+void commissioning_timeline_event(enum CommissioningEvent event) {
+    int64_t now = esp_timer_get_time();
+    bool recorded = false;
+
+    portENTER_CRITICAL(&ringLock);
+    if (event == CommissioningEvent::windowOpened || (attempt == nullptr && event == CommissioningEvent::sessionStarted)) {
+        // Window reopened after a failure or session started in an already open window
+        if (attempt == nullptr || attempt->offset[int(CommissioningEvent::sessionStarted)] != EVENT_NONE) {
+            attempt = commissioning_timeline_begin(now);
+        }
+    }
+    if (attempt != nullptr) {
+        recorded = true;
+        if (attempt->offset[int(event)] == EVENT_NONE) {
+            attempt->offset[int(event)] = uint32_t((now - attemptStart) / 1000);
+        }
+        attempt->lastEvent = uint8_t(event);
+        switch (event) {
+        case CommissioningEvent::complete:
+            attempt->result = AttemptResult::success;
+            break;
+        case CommissioningEvent::failSafeExpired:
+            attempt->result = AttemptResult::failSafeExpired;
+            break;
+        case CommissioningEvent::windowClosed:
+            if (attempt->result == AttemptResult::inProgress) {
+                attempt->result = AttemptResult::windowClosed;
+            }
+            break;
+        default:
+            break;
+        }
+        if (attempt->result != AttemptResult::inProgress) {
+            ESP_LOGI(TAG, "Attempt %lu: %s in %lu ms", attempt->sequence, resultName[int(attempt->result)],
+                     attempt->offset[int(event)]);
+            attempt = nullptr;
+        }
+    }
+    portEXIT_CRITICAL(&ringLock);
+
+    // Network join is not persisted by itself, it is saved with the following event
+    if (recorded && event != CommissioningEvent::networkJoined) {
+        commissioning_timeline_save();
+    }
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static void commissioning_timeline_print_phase(const commissioning_attempt_t &a, const char *name,
+                                               CommissioningEvent from, CommissioningEvent to) {
+    uint32_t start = a.offset[int(from)];
+    uint32_t end = a.offset[int(to)];
+    if (start != EVENT_NONE && end != EVENT_NONE && end >= start) {
+        printf(" %s: %lu ms", name, end - start);
+    }
+}
+
+static esp_err_t commissioning_handler(int argc, char **argv) {
+    if (argc == 1 && strcmp(argv[0], "clear") == 0) {
+        portENTER_CRITICAL(&ringLock);
+        memset(&ring, 0, sizeof(ring));
+        attempt = nullptr;
+        portEXIT_CRITICAL(&ringLock);
+        commissioning_timeline_save();
+        return ESP_OK;
+    }
+
+    commissioning_ring_t copy;
+    portENTER_CRITICAL(&ringLock);
+    copy = ring;
+    portEXIT_CRITICAL(&ringLock);
+
+    uint32_t count = copy.count < COMMISSIONING_ATTEMPTS ? copy.count : COMMISSIONING_ATTEMPTS;
+    for (uint32_t n = copy.count - count; n != copy.count; n++) {
+        const commissioning_attempt_t &a = copy.attempts[n % COMMISSIONING_ATTEMPTS];
+        printf("attempt %lu: %s, last event: %s\n", a.sequence, resultName[int(a.result)], eventName[a.lastEvent]);
+        printf("\t");
+        commissioning_timeline_print_phase(a, "BLE", CommissioningEvent::windowOpened, CommissioningEvent::bleConnected);
+        commissioning_timeline_print_phase(a, "PASE", CommissioningEvent::bleConnected, CommissioningEvent::sessionStarted);
+        commissioning_timeline_print_phase(a, "network", CommissioningEvent::sessionStarted, CommissioningEvent::networkJoined);
+        commissioning_timeline_print_phase(a, "CASE", CommissioningEvent::networkJoined, CommissioningEvent::complete);
+        commissioning_timeline_print_phase(a, "total", CommissioningEvent::windowOpened, CommissioningEvent::complete);
+        printf("\n\t");
+        for (int i = 0; i < COMMISSIONING_EVENTS; i++) {
+            if (a.offset[i] != EVENT_NONE) {
+                printf("%s@%lu ", eventName[i], a.offset[i]);
+            }
+        }
+        printf("\n");
+    }
+    return ESP_OK;
+}
+#endif
+
+void commissioning_timeline_init() {
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        size_t length = sizeof(ring);
+        if (nvs_get_blob(handle, NVS_KEY_RING, &ring, &length) != ESP_OK || length != sizeof(ring)) {
+            memset(&ring, 0, sizeof(ring));
+        }
+        nvs_close(handle);
+    }
+    for (int i = 0; i < COMMISSIONING_ATTEMPTS; i++) {
+        if (ring.attempts[i].sequence != 0 && ring.attempts[i].result == AttemptResult::inProgress) {
+            ring.attempts[i].result = AttemptResult::interrupted;
+        }
+    }
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "commissioning",
+            .description = "Commissioning attempts timeline. Usage: matter esp light commissioning [clear]",
+            .handler = commissioning_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
@@ -0,0 +1,23 @@
+//
+// Commissioning timeline recorder
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+enum class CommissioningEvent : short
+{
+    windowOpened,       // Commissioning window opened, attempt starts
+    bleConnected,       // Commissioner connected over BLE
+    sessionStarted,     // PASE session established
+    networkJoined,      // Wi-Fi/Thread connectivity established
+    complete,           // CommissioningComplete over CASE
+    failSafeExpired,
+    sessionStopped,
+    bleClosed,
+    windowClosed
+};
+
+void commissioning_timeline_event(enum CommissioningEvent event);
+void commissioning_timeline_init();
@@ -0,0 +1,211 @@
+//
+// Connectivity monitor
+//
+// Timestamps Wi-Fi/Thread connectivity loss and recovery, keeps reattach time histograms.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "connectivity_monitor.h"
+#include "light_console.h"
+
+#define CONNECTIVITY_TYPES 2
+#define REATTACH_BUCKETS 8
+
+static const char *TAG = "connectivity";
+
+static const char *typeName[CONNECTIVITY_TYPES] = { "wifi", "thread" };
+// Upper bounds of reattach histogram buckets in ms, last one is open
+static const uint32_t bucketBound[REATTACH_BUCKETS - 1] = { 1000, 2000, 5000, 10000, 30000, 60000, 300000 };
+
+typedef struct {
+    bool connected;
+    int64_t lostAt;             // us, 0 if never lost since connected
+    int64_t connectedAt;        // us
+    uint32_t losses;
+    uint32_t reattaches;
+    uint32_t reattachMin;       // ms
+    uint32_t reattachMax;       // ms
+    uint64_t reattachTotal;     // ms
+    uint32_t histogram[REATTACH_BUCKETS];
+} connectivity_stats_t;
+
+static connectivity_stats_t stats[CONNECTIVITY_TYPES];
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Histogram bucket of a reattach time, ms
+static int connectivity_bucket(uint32_t outage) {
+    int bucket = 0;
+    while (bucket < REATTACH_BUCKETS - 1 && outage >= bucketBound[bucket]) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Apply a connectivity event at now, us. True and the outage in ms if it is a reattach
+static bool connectivity_stats_event(connectivity_stats_t *s, bool connected, int64_t now, uint32_t *outage) {
+    bool reattached = false;
+    if (connected && !s->connected) {
+        s->connected = true;
+        s->connectedAt = now;
+        if (s->lostAt != 0) {
+            *outage = uint32_t((now - s->lostAt) / 1000);
+            s->histogram[connectivity_bucket(*outage)]++;
+            if (s->reattaches == 0 || *outage < s->reattachMin) {
+                s->reattachMin = *outage;
+            }
+            if (*outage > s->reattachMax) {
+                s->reattachMax = *outage;
+            }
+            s->reattachTotal += *outage;
+            s->reattaches++;
+            s->lostAt = 0;
+            reattached = true;
+        }
+    } else if (!connected && s->connected) {
+        s->connected = false;
+        s->lostAt = now;
+        s->losses++;
+    }
+    return reattached;
+}
+
+void connectivity_monitor_event(enum ConnectivityType type, bool connected) {
+    int64_t now = esp_timer_get_time();
+    uint32_t outage = 0;
+
+    portENTER_CRITICAL(&statsLock);
+    bool reattached = connectivity_stats_event(&stats[int(type)], connected, now, &outage);
+    portEXIT_CRITICAL(&statsLock);
+
+    if (reattached) {
+        ESP_LOGI(TAG, "%s reattached after %lu ms", typeName[int(type)], outage);
+    }
+}
+
+bool connectivity_monitor_is_connected() {
+    return stats[int(ConnectivityType::wifi)].connected || stats[int(ConnectivityType::thread)].connected;
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+// Scripted events on a local instance: bucket bounds, repeated events and aggregates
+static bool connectivity_monitor_check() {
+    static const struct {
+        uint32_t outage;        // ms
+        int bucket;
+    } reattaches[] = {
+        { 0, 0 }, { 999, 0 }, { 1000, 1 }, { 4999, 2 }, { 5000, 3 },
+        { 59999, 5 }, { 60000, 6 }, { 299999, 6 }, { 300000, 7 }, { 3600000, 7 },
+    };
+    const int count = sizeof(reattaches) / sizeof(reattaches[0]);
+    connectivity_stats_t s = {};
+    uint32_t expected[REATTACH_BUCKETS] = {};
+    uint64_t total = 0;
+    int64_t now = 1000000;
+    uint32_t outage = 0;
+    bool pass = true;
+
+    connectivity_stats_event(&s, true, now, &outage);
+    for (int i = 0; i < count; i++) {
+        now += 10000000;
+        connectivity_stats_event(&s, false, now, &outage);
+        // Repeated loss keeps the first timestamp
+        connectivity_stats_event(&s, false, now + 500, &outage);
+        now += int64_t(reattaches[i].outage) * 1000;
+        bool reattached = connectivity_stats_event(&s, true, now, &outage);
+        pass = pass && reattached && outage == reattaches[i].outage && connectivity_bucket(outage) == reattaches[i].bucket;
+        // Repeated connect is not a reattach
+        pass = pass && !connectivity_stats_event(&s, true, now + 500, &outage);
+        expected[reattaches[i].bucket]++;
+        total += reattaches[i].outage;
+    }
+    for (int bucket = 0; bucket < REATTACH_BUCKETS; bucket++) {
+        printf("bucket %d: %lu, expected %lu\n", bucket, s.histogram[bucket], expected[bucket]);
+        pass = pass && s.histogram[bucket] == expected[bucket];
+    }
+    printf("losses %lu, reattaches %lu, min/total/max %lu/%llu/%lu ms\n", s.losses, s.reattaches,
+           s.reattachMin, s.reattachTotal, s.reattachMax);
+    return pass && s.losses == uint32_t(count) && s.reattaches == uint32_t(count) && s.reattachMin == 0 &&
+           s.reattachMax == 3600000 && s.reattachTotal == total && s.connected;
+}
+#endif
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t connectivity_stats_handler(int argc, char **argv) {
+    int64_t now = esp_timer_get_time();
+
+    for (int type = 0; type < CONNECTIVITY_TYPES; type++) {
+        connectivity_stats_t s;
+        portENTER_CRITICAL(&statsLock);
+        s = stats[type];
+        portEXIT_CRITICAL(&statsLock);
+
+        if (s.losses == 0 && !s.connected) {
+            continue;
+        }
+        printf("%s: %s", typeName[type], s.connected ? "connected" : "disconnected");
+        if (!s.connected && s.lostAt != 0) {
+            printf(" for %lld ms", (now - s.lostAt) / 1000);
+        }
+        printf(", losses: %lu, reattaches: %lu", s.losses, s.reattaches);
+        if (s.reattaches != 0) {
+            printf(", reattach min/avg/max: %lu/%llu/%lu ms", s.reattachMin, s.reattachTotal / s.reattaches, s.reattachMax);
+        }
+        printf("\n\t");
+        for (int bucket = 0; bucket < REATTACH_BUCKETS; bucket++) {
+            if (bucket < REATTACH_BUCKETS - 1) {
+                printf("<%lus: %lu ", bucketBound[bucket] / 1000, s.histogram[bucket]);
+            } else {
+                printf(">=%lus: %lu\n", bucketBound[bucket - 1] / 1000, s.histogram[bucket]);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+// Synthetic connectivity events: inject <wifi|thread> <lost|established>
+static esp_err_t connectivity_inject_handler(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: inject <wifi|thread> <lost|established>\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    ConnectivityType type;
+    if (strcmp(argv[0], "wifi") == 0) {
+        type = ConnectivityType::wifi;
+    } else if (strcmp(argv[0], "thread") == 0) {
+        type = ConnectivityType::thread;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    connectivity_monitor_event(type, strcmp(argv[1], "established") == 0);
+    return ESP_OK;
+}
+
+static esp_err_t connectivity_handler(int argc, char **argv) {
+    if (argc > 0 && strcmp(argv[0], "inject") == 0) {
+        return connectivity_inject_handler(argc - 1, argv + 1);
+    }
+    return connectivity_stats_handler(argc, argv);
+}
+#endif
+
+void connectivity_monitor_init() {
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "connectivity",
+            .description = "Connectivity loss/reattach stats. Usage: matter esp light connectivity [inject <wifi|thread> <lost|established>]",
+            .handler = connectivity_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+#if CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("connectivity", connectivity_monitor_check);
+#endif
+}
@@ -0,0 +1,17 @@
+//
+// Connectivity monitor
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+enum class ConnectivityType : short
+{
+    wifi,
+    thread
+};
+
+void connectivity_monitor_event(enum ConnectivityType type, bool connected);
+bool connectivity_monitor_is_connected();
+void connectivity_monitor_init();
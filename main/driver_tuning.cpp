@@ -0,0 +1,277 @@
+//
+// Runtime tunable driver parameters
+//
+// Fade time, PWM frequency, led color temperatures and the default level are exposed as
+// writable attributes of a manufacturer specific cluster. Kconfig values are the defaults.
+// Writes are range checked, applied live and persisted in NVS by this module: the driver
+// needs them before the data model exists.
+//
+
+#include <esp_log.h>
+#include <nvs.h>
+#include <stdio.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_matter.h>
+
+#include <common_macros.h>
+#include "light_driver.h"
+#include "led_driver.h"
+#include "calibration.h"
+#include "light_console.h"
+#include "driver_tuning.h"
+
+#if CONFIG_DRIVER_TUNING_CLUSTER
+
+using namespace esp_matter;
+
+static const char *TAG = "driver_tuning";
+static const char *NVS_NAMESPACE = "tuning";
+
+typedef struct {
+    uint32_t id;
+    esp_matter_val_type_t type;
+    uint32_t min;
+    uint32_t max;
+    const char *nvsKey;
+    const char *name;
+} tuning_attribute_t;
+
+enum {
+    TUNING_FADE_TIME,
+    TUNING_PWM_FREQUENCY,
+    TUNING_WARM_KELVIN,
+    TUNING_COLD_KELVIN,
+    TUNING_DEFAULT_BRIGHTNESS,
+    TUNING_ATTRIBUTES
+};
+
+// Color temperatures are limited to the range of the Planckian locus model of the mixer
+static const tuning_attribute_t attributes[TUNING_ATTRIBUTES] = {
+    { DRIVER_TUNING_FADE_TIME_ID, ESP_MATTER_VAL_TYPE_UINT32, 0, 10000, "fade", "Fade time, ms" },
+    { DRIVER_TUNING_PWM_FREQUENCY_ID, ESP_MATTER_VAL_TYPE_UINT32, 100, 20000, "pwm", "PWM frequency, Hz" },
+    { DRIVER_TUNING_WARM_KELVIN_ID, ESP_MATTER_VAL_TYPE_UINT16, 1667, 25000, "warm", "Warm led, K" },
+    { DRIVER_TUNING_COLD_KELVIN_ID, ESP_MATTER_VAL_TYPE_UINT16, 1667, 25000, "cold", "Cold led, K" },
+    { DRIVER_TUNING_DEFAULT_BRIGHTNESS_ID, ESP_MATTER_VAL_TYPE_UINT8, 1, MATTER_BRIGHTNESS, "level", "Default brightness" },
+};
+
+static const uint32_t defaults[TUNING_ATTRIBUTES] = {
+    CONFIG_FADE_TIME,
+    CONFIG_PWM_FREQUENCY,
+    CONFIG_COLOR_TEMP_WARM,
+    CONFIG_COLOR_TEMP_COLD,
+    CONFIG_DEFAULT_BRIGHTNESS,
+};
+
+static uint32_t values[TUNING_ATTRIBUTES];
+static portMUX_TYPE valuesLock = portMUX_INITIALIZER_UNLOCKED;
+
+static int driver_tuning_index(uint32_t attribute_id) {
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        if (attributes[index].id == attribute_id) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+static esp_matter_attr_val_t driver_tuning_val(int index, uint32_t value) {
+    switch (attributes[index].type) {
+    case ESP_MATTER_VAL_TYPE_UINT8:
+        return esp_matter_uint8(value);
+    case ESP_MATTER_VAL_TYPE_UINT16:
+        return esp_matter_uint16(value);
+    default:
+        return esp_matter_uint32(value);
+    }
+}
+
+static uint32_t driver_tuning_value(const esp_matter_attr_val_t *val) {
+    switch (val->type) {
+    case ESP_MATTER_VAL_TYPE_UINT8:
+        return val->val.u8;
+    case ESP_MATTER_VAL_TYPE_UINT16:
+        return val->val.u16;
+    default:
+        return val->val.u32;
+    }
+}
+
+static void driver_tuning_copy(uint32_t *out) {
+    portENTER_CRITICAL(&valuesLock);
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        out[index] = values[index];
+    }
+    portEXIT_CRITICAL(&valuesLock);
+}
+
+// Range of the value and consistency with the other values
+static esp_err_t driver_tuning_validate(int index, uint32_t value, const uint32_t *current) {
+    if (value < attributes[index].min || value > attributes[index].max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (index != TUNING_WARM_KELVIN && index != TUNING_COLD_KELVIN) {
+        return ESP_OK;
+    }
+    if (calibration_get() != nullptr) {
+        // Measured color temperatures of the unit are used
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint32_t warm = index == TUNING_WARM_KELVIN ? value : current[TUNING_WARM_KELVIN];
+    uint32_t cold = index == TUNING_COLD_KELVIN ? value : current[TUNING_COLD_KELVIN];
+    if (MATTER_TEMPERATURE_FACTOR / warm <= MATTER_TEMPERATURE_FACTOR / cold) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    if (warm >= CONFIG_COLOR_TEMP_NEUTRAL || cold <= CONFIG_COLOR_TEMP_NEUTRAL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#endif
+    return ESP_OK;
+}
+
+static void driver_tuning_persist(int index, uint32_t value) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs open failed: %s", esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_u32(handle, attributes[index].nvsKey, value);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs write failed: %s", esp_err_to_name(err));
+    }
+}
+
+// Stored values are checked again, a value out of the current ranges falls back to Kconfig
+static void driver_tuning_restore() {
+    uint32_t stored[TUNING_ATTRIBUTES];
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        values[index] = defaults[index];
+        stored[index] = defaults[index];
+    }
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        nvs_get_u32(handle, attributes[index].nvsKey, &stored[index]);
+    }
+    nvs_close(handle);
+
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        if (stored[index] == defaults[index]) {
+            continue;
+        }
+        if (driver_tuning_validate(index, stored[index], stored) != ESP_OK) {
+            ESP_LOGW(TAG, "%s: stored %lu is not valid", attributes[index].name, stored[index]);
+            continue;
+        }
+        values[index] = stored[index];
+    }
+    // Color temperatures are valid only as a pair
+    if (driver_tuning_validate(TUNING_WARM_KELVIN, values[TUNING_WARM_KELVIN], values) != ESP_OK) {
+        values[TUNING_WARM_KELVIN] = defaults[TUNING_WARM_KELVIN];
+        values[TUNING_COLD_KELVIN] = defaults[TUNING_COLD_KELVIN];
+    }
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t tuning_handler(int argc, char **argv) {
+    uint32_t current[TUNING_ATTRIBUTES];
+    driver_tuning_copy(current);
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        printf("0x%04lx %s: %lu%s\n", attributes[index].id, attributes[index].name, current[index],
+               current[index] != defaults[index] ? " (tuned)" : "");
+    }
+    return ESP_OK;
+}
+#endif
+
+void driver_tuning_init() {
+    driver_tuning_restore();
+    if (values[TUNING_FADE_TIME] != CONFIG_FADE_TIME) {
+        led_driver_set_fade_time(values[TUNING_FADE_TIME]);
+    }
+    if (values[TUNING_PWM_FREQUENCY] != CONFIG_PWM_FREQUENCY && led_driver_set_pwm_frequency(values[TUNING_PWM_FREQUENCY]) != ESP_OK) {
+        values[TUNING_PWM_FREQUENCY] = CONFIG_PWM_FREQUENCY;
+    }
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "tuning",
+            .description = "Runtime tuned driver parameters. Usage: matter esp light tuning",
+            .handler = tuning_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+driver_tuning_t driver_tuning_get() {
+    uint32_t current[TUNING_ATTRIBUTES];
+    driver_tuning_copy(current);
+    return {
+        .fadeTime = current[TUNING_FADE_TIME],
+        .pwmFrequency = current[TUNING_PWM_FREQUENCY],
+        .warmKelvin = uint16_t(current[TUNING_WARM_KELVIN]),
+        .coldKelvin = uint16_t(current[TUNING_COLD_KELVIN]),
+        .defaultBrightness = uint8_t(current[TUNING_DEFAULT_BRIGHTNESS]),
+    };
+}
+
+void driver_tuning_create_cluster(endpoint_t *endpoint) {
+    cluster_t *cluster = cluster::create(endpoint, DRIVER_TUNING_CLUSTER_ID, CLUSTER_FLAG_SERVER);
+    ABORT_APP_ON_FAILURE(cluster != nullptr, ESP_LOGE(TAG, "Failed to create driver tuning cluster"));
+    cluster::global::attribute::create_cluster_revision(cluster, 1);
+    cluster::global::attribute::create_feature_map(cluster, 0);
+
+    uint32_t current[TUNING_ATTRIBUTES];
+    driver_tuning_copy(current);
+    for (int index = 0; index < TUNING_ATTRIBUTES; index++) {
+        // Not ATTRIBUTE_FLAG_NONVOLATILE, persisted here
+        attribute_t *attribute = attribute::create(cluster, attributes[index].id, ATTRIBUTE_FLAG_WRITABLE,
+                                                   driver_tuning_val(index, current[index]));
+        ABORT_APP_ON_FAILURE(attribute != nullptr, ESP_LOGE(TAG, "Failed to create tuning attribute 0x%04lx", attributes[index].id));
+        attribute::add_bounds(attribute, driver_tuning_val(index, attributes[index].min), driver_tuning_val(index, attributes[index].max));
+    }
+}
+
+esp_err_t driver_tuning_update(uint32_t attribute_id, const esp_matter_attr_val_t *val) {
+    int index = driver_tuning_index(attribute_id);
+    if (index < 0) {
+        return ESP_OK;
+    }
+    uint32_t value = driver_tuning_value(val);
+    uint32_t current[TUNING_ATTRIBUTES];
+    driver_tuning_copy(current);
+    if (value == current[index]) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = driver_tuning_validate(index, value, current);
+    if (err == ESP_OK && index == TUNING_PWM_FREQUENCY) {
+        err = led_driver_set_pwm_frequency(value);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %lu rejected: %s", attributes[index].name, value, esp_err_to_name(err));
+        return err;
+    }
+    if (index == TUNING_FADE_TIME) {
+        led_driver_set_fade_time(value);
+    }
+
+    portENTER_CRITICAL(&valuesLock);
+    values[index] = value;
+    portEXIT_CRITICAL(&valuesLock);
+    driver_tuning_persist(index, value);
+    ESP_LOGI(TAG, "%s: %lu", attributes[index].name, value);
+    return ESP_OK;
+}
+
+#endif
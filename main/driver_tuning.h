@@ -0,0 +1,37 @@
+//
+// Runtime tunable driver parameters
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <esp_matter.h>
+
+#if CONFIG_DRIVER_TUNING_CLUSTER
+// Manufacturer specific cluster of vendor 0xFFF2 on the light endpoint
+#define DRIVER_TUNING_CLUSTER_ID 0xFFF2FC00
+
+// Attributes, all writable and persisted
+#define DRIVER_TUNING_FADE_TIME_ID 0x0000           // uint32, ms for the full range
+#define DRIVER_TUNING_PWM_FREQUENCY_ID 0x0001       // uint32, Hz
+#define DRIVER_TUNING_WARM_KELVIN_ID 0x0002         // uint16, warm led color temperature
+#define DRIVER_TUNING_COLD_KELVIN_ID 0x0003         // uint16, cold led color temperature
+#define DRIVER_TUNING_DEFAULT_BRIGHTNESS_ID 0x0004  // uint8, level of a light with no stored level
+
+typedef struct {
+    uint32_t fadeTime;
+    uint32_t pwmFrequency;
+    uint16_t warmKelvin;
+    uint16_t coldKelvin;
+    uint8_t defaultBrightness;
+} driver_tuning_t;
+
+// Restore persisted values, Kconfig ones if none, and apply them to the led driver
+void driver_tuning_init();
+driver_tuning_t driver_tuning_get();
+void driver_tuning_create_cluster(esp_matter::endpoint_t *endpoint);
+// Validate, apply to the led driver and persist a written value. Runs in Matter context
+// before the write is accepted, an error rejects it
+esp_err_t driver_tuning_update(uint32_t attribute_id, const esp_matter_attr_val_t *val);
+#endif
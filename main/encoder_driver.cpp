@@ -0,0 +1,331 @@
+/*
+    Rotary encoder driver
+
+    Quadrature is decoded by the PCNT peripheral with its glitch filter, the count is
+    sampled at a fixed rate and turned into velocity-scaled steps. Push toggles between
+    level and color temperature. CONFIG_ENCODER_SIMULATED replaces the counter with
+    console-driven turns for bench testing without the hardware.
+*/
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common_macros.h>
+#include <app_priv.h>
+#include "light_console.h"
+
+#if CONFIG_ROTARY_ENCODER
+
+#if CONFIG_ENCODER_SIMULATED
+#include <atomic>
+#else
+#include <driver/pulse_cnt.h>
+#endif
+#if CONFIG_ENCODER_BUTTON_GPIO >= 0
+#include <iot_button.h>
+#include <button_gpio.h>
+#endif
+
+#define ENCODER_PCNT_LIMIT 1000
+#define ENCODER_IDLE_TIME 300               // ms without steps, turn ended
+#define ENCODER_MAX_SCALE 1600              // percent
+
+static const char *TAG = "encoder_driver";
+
+typedef struct {
+    int32_t partialCounts;                  // counts short of a detent
+    int32_t velocity;                       // detents/s, smoothed
+    uint32_t idleTime;                      // ms since the last detent
+    bool moving;
+} encoder_motion_t;
+
+static void (*turnCallback)(int32_t steps, bool temperature);
+static esp_timer_handle_t sampleTimer;
+static volatile bool temperatureMode;
+static int lastCount;
+static encoder_motion_t motion;
+
+#if CONFIG_ENCODER_SIMULATED
+static std::atomic<int> simulatedCount{0};
+static std::atomic<int> simulatedTarget{0};
+static std::atomic<int> simulatedRate{10};  // detents/s
+
+static int encoder_counter_read() {
+    // Move towards the target at the requested speed, as a hand would
+    int count = simulatedCount;
+    int target = simulatedTarget;
+    int step = simulatedRate * CONFIG_ENCODER_COUNTS_PER_DETENT * CONFIG_ENCODER_SAMPLE_INTERVAL / 1000;
+    if (step < 1) {
+        step = 1;
+    }
+    if (count < target) {
+        count = count + step < target ? count + step : target;
+    } else if (count > target) {
+        count = count - step > target ? count - step : target;
+    }
+    simulatedCount = count;
+    return count;
+}
+#else
+static pcnt_unit_handle_t pcntUnit;
+
+static int encoder_counter_read() {
+    int count = 0;
+    pcnt_unit_get_count(pcntUnit, &count);
+    return count;
+}
+
+static void encoder_counter_init() {
+    pcnt_unit_config_t unitConfig = {
+        .low_limit = -ENCODER_PCNT_LIMIT,
+        .high_limit = ENCODER_PCNT_LIMIT,
+        .flags = {
+            .accum_count = 1,
+        },
+    };
+    ESP_ERROR_CHECK(pcnt_new_unit(&unitConfig, &pcntUnit));
+    pcnt_glitch_filter_config_t filterConfig = {
+        .max_glitch_ns = CONFIG_ENCODER_GLITCH_FILTER,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(pcntUnit, &filterConfig));
+
+    // Full quadrature: both edges of both channels
+    pcnt_chan_config_t chanAConfig = {
+        .edge_gpio_num = CONFIG_ENCODER_A_GPIO,
+        .level_gpio_num = CONFIG_ENCODER_B_GPIO,
+    };
+    pcnt_channel_handle_t chanA;
+    ESP_ERROR_CHECK(pcnt_new_channel(pcntUnit, &chanAConfig, &chanA));
+    pcnt_chan_config_t chanBConfig = {
+        .edge_gpio_num = CONFIG_ENCODER_B_GPIO,
+        .level_gpio_num = CONFIG_ENCODER_A_GPIO,
+    };
+    pcnt_channel_handle_t chanB;
+    ESP_ERROR_CHECK(pcnt_new_channel(pcntUnit, &chanBConfig, &chanB));
+    ESP_ERROR_CHECK(pcnt_channel_set_edge_action(chanA, PCNT_CHANNEL_EDGE_ACTION_DECREASE, PCNT_CHANNEL_EDGE_ACTION_INCREASE));
+    ESP_ERROR_CHECK(pcnt_channel_set_level_action(chanA, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
+    ESP_ERROR_CHECK(pcnt_channel_set_edge_action(chanB, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_DECREASE));
+    ESP_ERROR_CHECK(pcnt_channel_set_level_action(chanB, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
+
+    // Limits are watch points, so the count keeps accumulating over them
+    ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcntUnit, -ENCODER_PCNT_LIMIT));
+    ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcntUnit, ENCODER_PCNT_LIMIT));
+    ESP_ERROR_CHECK(pcnt_unit_enable(pcntUnit));
+    ESP_ERROR_CHECK(pcnt_unit_clear_count(pcntUnit));
+    ESP_ERROR_CHECK(pcnt_unit_start(pcntUnit));
+}
+#endif
+
+static void encoder_toggle_mode() {
+    temperatureMode = !temperatureMode;
+    ESP_LOGI(TAG, "Encoder mode: %s", temperatureMode ? "temperature" : "level");
+}
+
+// Counts of one sample to velocity scaled steps, 0 if no detent passed. ended is set on the
+// sample the turn ends
+static int32_t encoder_motion_steps(encoder_motion_t *state, int32_t counts, bool *ended) {
+    int32_t delta = counts + state->partialCounts;
+    int32_t detents = delta / CONFIG_ENCODER_COUNTS_PER_DETENT;
+    state->partialCounts = delta - detents * CONFIG_ENCODER_COUNTS_PER_DETENT;
+    *ended = false;
+
+    if (detents == 0) {
+        if (state->moving) {
+            state->idleTime += CONFIG_ENCODER_SAMPLE_INTERVAL;
+            if (state->idleTime >= ENCODER_IDLE_TIME) {
+                state->moving = false;
+                state->velocity = 0;
+                *ended = true;
+            }
+        }
+        return 0;
+    }
+    // Rate over the time since the previous detent, a slow turn is not one fast sample
+    int32_t elapsed = state->moving ? state->idleTime + CONFIG_ENCODER_SAMPLE_INTERVAL : ENCODER_IDLE_TIME;
+    state->velocity = (state->velocity * 3 + abs(detents) * 1000 / elapsed) / 4;
+    state->idleTime = 0;
+    state->moving = true;
+
+    // Slow turns step by one, fast spins cover the range in a few turns
+    int32_t scale = 100 + state->velocity * CONFIG_ENCODER_ACCELERATION / 10;
+    if (scale > ENCODER_MAX_SCALE) {
+        scale = ENCODER_MAX_SCALE;
+    }
+    return detents * scale / 100;
+}
+
+static void encoder_sample(void *arg) {
+    int count = encoder_counter_read();
+    int32_t counts = count - lastCount;
+    lastCount = count;
+    bool ended;
+    int32_t steps = encoder_motion_steps(&motion, counts, &ended);
+    if (steps != 0 || ended) {
+        turnCallback(steps, temperatureMode);
+    }
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+// Feed detents every period for a time, sum of the steps. Detents fed and turn ends are counted
+static int32_t encoder_check_turn(encoder_motion_t *state, int32_t detents, uint32_t period, uint32_t time,
+                                  int32_t *fed, int *ends) {
+    int32_t steps = 0;
+    uint32_t due = period;
+    for (uint32_t t = CONFIG_ENCODER_SAMPLE_INTERVAL; t <= time; t += CONFIG_ENCODER_SAMPLE_INTERVAL) {
+        int32_t counts = 0;
+        if (t >= due) {
+            due += period;
+            counts = detents * CONFIG_ENCODER_COUNTS_PER_DETENT;
+            *fed += abs(detents);
+        }
+        bool ended;
+        steps += encoder_motion_steps(state, counts, &ended);
+        *ends += ended;
+    }
+    return steps;
+}
+
+// Fixed turns through the step logic: detent accumulation, direction, acceleration and turn end
+static bool encoder_motion_check() {
+    const uint32_t interval = CONFIG_ENCODER_SAMPLE_INTERVAL;
+    bool pass = true;
+    int32_t fed = 0;
+    int ends = 0;
+
+    // Counts one at a time: a single step on the last count of the detent, then the turn ends
+    encoder_motion_t state = {};
+    int32_t first = 0;
+    for (int32_t i = 1; i <= CONFIG_ENCODER_COUNTS_PER_DETENT; i++) {
+        bool ended;
+        first += encoder_motion_steps(&state, 1, &ended);
+        pass = pass && !ended && (i < CONFIG_ENCODER_COUNTS_PER_DETENT ? first == 0 : first == 1);
+    }
+    int32_t idle = encoder_check_turn(&state, 0, UINT32_MAX, ENCODER_IDLE_TIME + interval - 1, &fed, &ends);
+    printf("single detent: %ld step, turn ends: %d\n", first, ends);
+    pass = pass && idle == 0 && ends == 1 && !state.moving && state.velocity == 0;
+
+    // Slow turn, 5 detents/s for 4 s, both directions
+    encoder_motion_t forward = {};
+    encoder_motion_t backward = {};
+    int32_t slowDetents = 0;
+    int32_t backDetents = 0;
+    ends = 0;
+    int32_t slow = encoder_check_turn(&forward, 1, 200, 4000, &slowDetents, &ends);
+    int32_t back = encoder_check_turn(&backward, -1, 200, 4000, &backDetents, &ends);
+    printf("slow: %ld detents, %ld/%ld steps\n", slowDetents, slow, back);
+    pass = pass && slow == -back && slow >= slowDetents && ends == 0;
+#if CONFIG_ENCODER_ACCELERATION <= 200
+    // Steps by one
+    pass = pass && slow == slowDetents;
+#endif
+
+    // Fast spin, about 500 detents/s for 1 s
+    encoder_motion_t spin = {};
+    const int32_t perSample = 500 * interval / 1000;
+    int32_t fastDetents = 0;
+    int32_t fast = encoder_check_turn(&spin, perSample, interval, 1000, &fastDetents, &ends);
+    bool ended;
+    int32_t last = encoder_motion_steps(&spin, perSample * CONFIG_ENCODER_COUNTS_PER_DETENT, &ended);
+    printf("fast: %ld detents, %ld steps, last sample %ld detents %ld steps\n", fastDetents, fast, perSample, last);
+    pass = pass && last >= perSample && last <= perSample * ENCODER_MAX_SCALE / 100;
+    // Faster turns never step less per detent
+    pass = pass && int64_t(fast) * slowDetents >= int64_t(slow) * fastDetents;
+#if CONFIG_ENCODER_ACCELERATION >= 100
+    // Full speed is reached within a second
+    pass = pass && last == perSample * ENCODER_MAX_SCALE / 100;
+#elif CONFIG_ENCODER_ACCELERATION == 0
+    pass = pass && fast == fastDetents && last == perSample;
+#endif
+    return pass;
+}
+#endif
+
+#if CONFIG_ENCODER_BUTTON_GPIO >= 0
+static void encoder_button_cb(void *arg, void *data) {
+    encoder_toggle_mode();
+}
+
+static void encoder_button_init() {
+    static const button_config_t buttonConfig = {
+        .long_press_time = CONFIG_BUTTON_LONG_PRESS_TIME_MS,
+        .short_press_time = CONFIG_BUTTON_SHORT_PRESS_TIME_MS,
+    };
+    static const button_gpio_config_t buttonGpioConfig = {
+        .gpio_num = CONFIG_ENCODER_BUTTON_GPIO,
+        .active_level = 0,
+    };
+    button_handle_t buttonHandle;
+    esp_err_t err = iot_button_new_gpio_device(&buttonConfig, &buttonGpioConfig, &buttonHandle);
+    ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to create encoder button"));
+    ESP_ERROR_CHECK(iot_button_register_cb(buttonHandle, BUTTON_SINGLE_CLICK, NULL, encoder_button_cb, NULL));
+}
+#endif
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t encoder_handler(int argc, char **argv) {
+#if CONFIG_ENCODER_SIMULATED
+    if (argc >= 2 && strcmp(argv[0], "turn") == 0) {
+        if (argc > 2) {
+            int rate = atoi(argv[2]);
+            if (rate <= 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            simulatedRate = rate;
+        }
+        simulatedTarget += atoi(argv[1]) * CONFIG_ENCODER_COUNTS_PER_DETENT;
+        return ESP_OK;
+    }
+#endif
+    if (argc == 1 && strcmp(argv[0], "push") == 0) {
+        encoder_toggle_mode();
+        return ESP_OK;
+    }
+    if (argc != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    printf("Mode: %s, count: %d, velocity: %ld detents/s\n", temperatureMode ? "temperature" : "level", lastCount, motion.velocity);
+    return ESP_OK;
+}
+#endif
+
+void app_driver_encoder_init(void (*turn_callback)(int32_t steps, bool temperature)) {
+    turnCallback = turn_callback;
+#if CONFIG_ENCODER_SIMULATED
+    ESP_LOGI(TAG, "Simulated encoder");
+#else
+    encoder_counter_init();
+#endif
+#if CONFIG_ENCODER_BUTTON_GPIO >= 0
+    encoder_button_init();
+#endif
+
+    const esp_timer_create_args_t timerArgs = {
+        .callback = encoder_sample,
+        .name = "encoder",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &sampleTimer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(sampleTimer, CONFIG_ENCODER_SAMPLE_INTERVAL * 1000));
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "encoder",
+#if CONFIG_ENCODER_SIMULATED
+            .description = "Rotary encoder state. Usage: matter esp light encoder [push|turn <detents> [detents/s]]",
+#else
+            .description = "Rotary encoder state. Usage: matter esp light encoder [push]",
+#endif
+            .handler = encoder_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+#if CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("encoder", encoder_motion_check);
+#endif
+}
+
+#endif
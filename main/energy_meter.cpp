@@ -0,0 +1,308 @@
+//
+// Estimated energy meter
+//
+// Output of every channel is a linear duty ramp (fade) followed by a constant
+// duty, so each segment is integrated analytically when the next one starts
+// or when the meter is sampled. No periodic work at fade rate is needed.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_matter.h>
+#include <app/clusters/electrical-energy-measurement-server/electrical-energy-measurement-server.h>
+#include <platform/PlatformManager.h>
+
+#include <common_macros.h>
+#include "energy_meter.h"
+#include "led_driver.h"
+#include "light_console.h"
+
+#if CONFIG_ENERGY_METER
+
+using namespace esp_matter;
+using namespace chip::app::Clusters;
+
+#define ENERGY_CHANNELS LED_CHANNELS
+
+static const char *TAG = "energy_meter";
+static const char *NVS_NAMESPACE = "energy";
+static const char *NVS_KEY_TOTAL = "total";
+
+// Channel power at full duty, mW
+static const uint32_t channelPower[ENERGY_CHANNELS] = {
+    CONFIG_LED_WARM_POWER,
+    CONFIG_LED_COLD_POWER,
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    CONFIG_LED_NEUTRAL_POWER,
+#endif
+};
+
+static portMUX_TYPE meterLock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t PWMBase;
+static uint16_t meter_endpoint_id;
+
+typedef struct {
+    // Current output segment: ramp from segmentFrom to segmentTo during segmentTime us
+    int64_t segmentStart;
+    int64_t segmentTime;
+    uint32_t segmentFrom[ENERGY_CHANNELS];
+    uint32_t segmentTo[ENERGY_CHANNELS];
+    // Integrated duty * us per channel and standby time in us since start
+    uint64_t dutyTime[ENERGY_CHANNELS];
+    uint64_t standbyTime;
+} energy_integrator_t;
+
+static energy_integrator_t meter;
+
+// Totals in mJ
+static uint64_t restoredTotal;
+static uint64_t persistedTotal;
+
+static esp_timer_handle_t reportTimer;
+static uint32_t reportCount;
+
+// Integrate current segment up to now and split it
+static void energy_integrator_advance(energy_integrator_t *integrator, int64_t now) {
+    int64_t elapsed = now - integrator->segmentStart;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    int64_t segmentTime = integrator->segmentTime;
+    for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+        int64_t from = integrator->segmentFrom[chan];
+        int64_t to = integrator->segmentTo[chan];
+        if (elapsed >= segmentTime) {
+            integrator->dutyTime[chan] += (from + to) * segmentTime / 2 + to * (elapsed - segmentTime);
+            integrator->segmentFrom[chan] = to;
+        } else {
+            int64_t duty = from + (to - from) * elapsed / segmentTime;
+            integrator->dutyTime[chan] += (from + duty) * elapsed / 2;
+            integrator->segmentFrom[chan] = duty;
+        }
+    }
+    integrator->standbyTime += elapsed;
+    integrator->segmentTime = elapsed >= segmentTime ? 0 : segmentTime - elapsed;
+    integrator->segmentStart = now;
+}
+
+// New segment from the current output at now
+static void energy_integrator_start(energy_integrator_t *integrator, int64_t now, const uint32_t *duty, uint32_t fadeTime) {
+    energy_integrator_advance(integrator, now);
+    for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+        integrator->segmentTo[chan] = duty[chan];
+    }
+    integrator->segmentTime = int64_t(fadeTime) * 1000;
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+#define CHECK_COMMANDS 3
+#define CHECK_END 10000000                  // us
+#define CHECK_REPORT 250000                 // us, report interval of the split runs
+
+typedef struct {
+    int64_t time;                           // us
+    uint32_t duty;                          // every channel
+    uint32_t fadeTime;                      // ms
+} check_command_t;
+
+// Commands from duty 0 and the energy of each channel up to CHECK_END, worked out by hand
+typedef struct {
+    const char *name;
+    check_command_t commands[CHECK_COMMANDS];
+    int count;
+    uint64_t expected;                      // duty * us
+} check_case_t;
+
+static const check_case_t checkCases[] = {
+    // 4000 * 10 s
+    { "steady", { { 0, 4000, 0 } }, 1, 40000000000ULL },
+    // 4000 * 2 s / 2 + 4000 * 8 s
+    { "fade", { { 0, 4000, 2000 } }, 1, 36000000000ULL },
+    // Up to 2000 at 1 s, down to 0 by 2 s: 2000 * 1 s / 2 twice
+    { "preempted", { { 0, 4000, 2000 }, { 1000000, 0, 1000 } }, 2, 2000000000ULL },
+    // Up to 1000 at 1 s, held: 1000 * 1 s / 2 + 1000 * 9 s
+    { "retarget", { { 0, 4000, 4000 }, { 1000000, 1000, 1000 } }, 2, 9500000000ULL },
+    // Off at 3 s after a fade to 2000, back to 4000 at 5 s:
+    // 2000 * 2 s / 2 + 2000 * 1 s + 2000 * 1 s / 2 + 4000 * 2 s / 2 + 4000 * 3 s
+    { "off and on", { { 0, 2000, 2000 }, { 3000000, 0, 1000 }, { 5000000, 4000, 2000 } }, 3, 21000000000ULL },
+};
+
+// Commands of a case, with energy reports every CHECK_REPORT if split. Report times fall on
+// whole duties of the ramps, so the integral is exact
+static void energy_check_run(const check_case_t &c, bool split, energy_integrator_t *integrator) {
+    *integrator = {};
+    int64_t nextReport = split ? CHECK_REPORT : CHECK_END;
+    for (int i = 0; i <= c.count; i++) {
+        int64_t time = i < c.count ? c.commands[i].time : CHECK_END;
+        while (nextReport < time) {
+            energy_integrator_advance(integrator, nextReport);
+            nextReport += CHECK_REPORT;
+        }
+        if (i == c.count) {
+            break;
+        }
+        uint32_t duty[ENERGY_CHANNELS];
+        for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+            duty[chan] = c.commands[i].duty;
+        }
+        energy_integrator_start(integrator, time, duty, c.commands[i].fadeTime);
+    }
+    energy_integrator_advance(integrator, CHECK_END);
+}
+
+// Fades preempted by the next command and steady periods, in one piece and split by the
+// energy reports. The integrator must match the closed form energies exactly
+static bool energy_meter_check() {
+    bool pass = true;
+    for (const check_case_t &c : checkCases) {
+        for (int split = 0; split < 2; split++) {
+            energy_integrator_t integrator;
+            energy_check_run(c, split, &integrator);
+            bool match = integrator.standbyTime == CHECK_END;
+            for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+                match = match && integrator.dutyTime[chan] == c.expected;
+            }
+            printf("%s%s: integrated %llu, expected %llu duty*us%s\n", c.name, split ? ", split" : "",
+                   integrator.dutyTime[0], c.expected, match ? "" : " MISMATCH");
+            pass = pass && match;
+        }
+    }
+    return pass;
+}
+#endif
+
+void energy_meter_update(const uint32_t *duty, uint32_t fadeTime) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&meterLock);
+    energy_integrator_start(&meter, now, duty, fadeTime);
+    portEXIT_CRITICAL(&meterLock);
+}
+
+uint64_t energy_meter_get_total() {
+    int64_t now = esp_timer_get_time();
+    uint64_t channelTime[ENERGY_CHANNELS];
+    uint64_t standby;
+
+    portENTER_CRITICAL(&meterLock);
+    energy_integrator_advance(&meter, now);
+    for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+        channelTime[chan] = meter.dutyTime[chan];
+    }
+    standby = meter.standbyTime;
+    portEXIT_CRITICAL(&meterLock);
+
+    // mW * us / 1000000 = mJ
+    uint64_t total = standby * CONFIG_LED_STANDBY_POWER;
+    for (int chan = 0; chan < ENERGY_CHANNELS; chan++) {
+        total += channelTime[chan] / PWMBase * channelPower[chan];
+    }
+    return restoredTotal + total / 1000000;
+}
+
+static void energy_meter_persist(uint64_t total) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs open failed: %s", esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_u64(handle, NVS_KEY_TOTAL, total);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs write failed: %s", esp_err_to_name(err));
+        return;
+    }
+    persistedTotal = total;
+}
+
+static void energy_meter_restore() {
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    nvs_get_u64(handle, NVS_KEY_TOTAL, &restoredTotal);
+    nvs_close(handle);
+    persistedTotal = restoredTotal;
+}
+
+// Runs in Matter context
+static void energy_meter_report(intptr_t arg) {
+    uint64_t total = energy_meter_get_total();
+
+    ElectricalEnergyMeasurement::Structs::EnergyMeasurementStruct::Type energy;
+    energy.energy = int64_t(total / 3600);   // mWh
+    energy.endSystime.SetValue(uint64_t(esp_timer_get_time() / 1000));
+    ElectricalEnergyMeasurement::NotifyCumulativeEnergyMeasured(meter_endpoint_id, chip::MakeOptional(energy), chip::NullOptional);
+
+    // Low write frequency: persist only every CONFIG_ENERGY_METER_PERSIST_INTERVAL minutes
+    reportCount++;
+    if (reportCount * CONFIG_ENERGY_METER_REPORT_INTERVAL >= CONFIG_ENERGY_METER_PERSIST_INTERVAL * 60 && total != persistedTotal) {
+        reportCount = 0;
+        energy_meter_persist(total);
+    }
+}
+
+static void energy_meter_timer_cb(void *arg) {
+    chip::DeviceLayer::PlatformMgr().ScheduleWork(energy_meter_report);
+}
+
+static void energy_meter_set_accuracy(intptr_t arg) {
+    static ElectricalEnergyMeasurement::Structs::MeasurementAccuracyRangeStruct::Type accuracyRange;
+    accuracyRange.rangeMin = 0;
+    accuracyRange.rangeMax = INT64_MAX / 2;
+    accuracyRange.percentMax.SetValue(500);     // Estimated from the power model
+
+    ElectricalEnergyMeasurement::Structs::MeasurementAccuracyStruct::Type accuracy;
+    accuracy.measurementType = ElectricalEnergyMeasurement::MeasurementTypeEnum::kElectricalEnergy;
+    accuracy.measured = false;
+    accuracy.minMeasuredValue = 0;
+    accuracy.maxMeasuredValue = INT64_MAX / 2;
+    accuracy.accuracyRanges = chip::app::DataModel::List<const ElectricalEnergyMeasurement::Structs::MeasurementAccuracyRangeStruct::Type>(&accuracyRange, 1);
+    ElectricalEnergyMeasurement::SetMeasurementAccuracy(meter_endpoint_id, accuracy);
+
+    energy_meter_report(0);
+}
+
+// Public interface
+
+void energy_meter_init(uint32_t pwmBase) {
+    PWMBase = pwmBase;
+    meter.segmentStart = esp_timer_get_time();
+    energy_meter_restore();
+    ESP_LOGI(TAG, "Restored energy total: %llu mJ", restoredTotal);
+#if CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("energy", energy_meter_check);
+#endif
+}
+
+void energy_meter_create_cluster(endpoint_t *endpoint) {
+    cluster::electrical_energy_measurement::config_t config;
+    cluster_t *cluster = cluster::electrical_energy_measurement::create(endpoint, &config, CLUSTER_FLAG_SERVER);
+    ABORT_APP_ON_FAILURE(cluster != nullptr, ESP_LOGE(TAG, "Failed to create energy measurement cluster"));
+    cluster::electrical_energy_measurement::feature::imported_energy::add(cluster);
+    cluster::electrical_energy_measurement::feature::cumulative_energy::add(cluster);
+    meter_endpoint_id = endpoint::get_id(endpoint);
+}
+
+void energy_meter_start() {
+    chip::DeviceLayer::PlatformMgr().ScheduleWork(energy_meter_set_accuracy);
+
+    const esp_timer_create_args_t timerArgs = {
+        .callback = energy_meter_timer_cb,
+        .name = "energy_meter",
+    };
+    esp_timer_create(&timerArgs, &reportTimer);
+    esp_timer_start_periodic(reportTimer, uint64_t(CONFIG_ENERGY_METER_REPORT_INTERVAL) * 1000000);
+}
+
+#endif
@@ -0,0 +1,18 @@
+//
+// Estimated energy meter
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <esp_matter.h>
+
+#if CONFIG_ENERGY_METER
+void energy_meter_init(uint32_t pwmBase);
+// Called by the fade engine when a new output segment starts
+void energy_meter_update(const uint32_t *duty, uint32_t fadeTime);
+// Cumulative estimated energy in mJ
+uint64_t energy_meter_get_total();
+void energy_meter_create_cluster(esp_matter::endpoint_t *endpoint);
+void energy_meter_start();
+#endif
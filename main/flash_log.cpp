@@ -0,0 +1,674 @@
+//
+// Compressed log store
+//
+// esp_log output, matter logging included, is captured by a vprintf hook into a RAM ring.
+// The hook never waits: bytes are dropped and counted when the ring is full. A background
+// task compresses the ring in chunks of up to 2K with LZSS and packs the blocks into a sector
+// image, written to the "logs" partition only when full, so every flash write is a whole
+// sector. The image is kept in memory not initialised at reset, RTC memory where there is room
+// for it, no-init RAM on ESP32-H2 with 4K of LP memory: a sector left open by a panic or
+// watchdog reset is sealed on the next boot. Sectors form a ring numbered by a header sequence,
+// each sector is erased once per lap. The raw size of every sector is counted at boot and kept
+// up to date, so the size of the store is known without reading flash. The store is served by
+// the DiagnosticLogs cluster as the end user support log, BDX is used by the cluster server
+// for logs over the response size.
+// logDecode.py decodes a partition image.
+//
+
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <app/clusters/diagnostic-logs-server/DiagnosticLogsProviderDelegate.h>
+#include <lib/support/CodeUtils.h>
+
+#include "light_console.h"
+#include "flash_log.h"
+
+#if CONFIG_FLASH_LOG
+
+using namespace chip;
+using namespace chip::app::Clusters::DiagnosticLogs;
+
+#define LOG_SECTOR_SIZE 4096
+#define LOG_MAGIC 0x31474f4c                // "LOG1"
+#define LOG_OPEN_MAGIC 0x504f474c           // "LGOP"
+#define LOG_CHUNK_SIZE 2048                 // raw bytes of a block
+#define LOG_LINE_MAX 128                    // bytes of one vprintf call, longer are truncated
+#define LOG_HASH_BITS 10
+#define LOG_MATCH_MIN 3
+#define LOG_MATCH_MAX (LOG_MATCH_MIN + 15)
+#define LOG_WINDOW 4095
+#define LOG_BLOCK_END 0xFFFF                // erased flash after the last block
+
+#if CONFIG_FLASH_LOG_RTC_SECTOR
+#define LOG_OPEN_SECTOR_ATTR RTC_NOINIT_ATTR
+#else
+#define LOG_OPEN_SECTOR_ATTR __NOINIT_ATTR
+#endif
+
+static const char *TAG = "flash_log";
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+} log_sector_header_t;
+
+// Block data is stored as is if compressed length equals raw length
+typedef struct {
+    uint16_t compressed;
+    uint16_t raw;
+} log_block_header_t;
+
+// Sector image being filled, the used length is advanced only after a whole block
+typedef struct {
+    uint32_t magic;                         // LOG_OPEN_MAGIC if used is valid
+    size_t used;
+    uint8_t data[LOG_SECTOR_SIZE];
+} log_open_sector_t;
+
+typedef struct {
+    uint64_t raw;                           // bytes captured, ringLock
+    uint32_t dropped;                       // bytes lost with the ring full, ringLock
+    uint64_t compressed;                    // block bytes with headers, storeLock
+    uint64_t flash;                         // bytes written, storeLock
+    uint32_t sectors;
+    uint32_t erases;
+} flash_log_stats_t;
+
+typedef struct {
+    uint32_t sequence;                      // sector
+    size_t offset;                          // next block in the sector
+    size_t textLength;                      // raw bytes of the current block
+    size_t textPos;
+    uint8_t *text;
+    uint8_t *data;
+} flash_log_reader_t;
+
+static const esp_partition_t *partition;
+static uint32_t sectorCount;
+static vprintf_like_t originalVprintf;
+static TaskHandle_t storeTask;
+static flash_log_stats_t stats;
+
+// Capture ring, filled by every logging task
+static char *ring;
+static size_t ringHead;
+static size_t ringUsed;
+static portMUX_TYPE ringLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Sector image being filled and its sequence
+static SemaphoreHandle_t storeLock;
+LOG_OPEN_SECTOR_ATTR static log_open_sector_t openSector;
+static uint8_t *const sector = openSector.data;
+static uint32_t writeSequence = 1;
+
+// Raw bytes of the sealed sector in every slot, of the open sector and of the whole store. storeLock
+static uint32_t *sectorRaw;
+static size_t openRaw;
+static size_t storeRaw;
+static uint8_t *chunk;
+static uint16_t *hashHead;
+
+static int flash_log_vprintf(const char *format, va_list args) {
+    char line[LOG_LINE_MAX];
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(line, sizeof(line), format, argsCopy);
+    va_end(argsCopy);
+    if (length >= int(sizeof(line))) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+
+    // Strip color escapes
+    size_t kept = 0;
+    for (int i = 0; i < length; i++) {
+        if (line[i] == '\033') {
+            while (i < length && line[i] != 'm') {
+                i++;
+            }
+            continue;
+        }
+        line[kept++] = line[i];
+    }
+
+    bool wake = false;
+    portENTER_CRITICAL(&ringLock);
+    if (kept > CONFIG_FLASH_LOG_BUFFER_SIZE - ringUsed) {
+        stats.dropped += kept;
+    } else {
+        size_t first = CONFIG_FLASH_LOG_BUFFER_SIZE - ringHead;
+        first = first < kept ? first : kept;
+        memcpy(ring + ringHead, line, first);
+        memcpy(ring, line + first, kept - first);
+        ringHead = (ringHead + kept) % CONFIG_FLASH_LOG_BUFFER_SIZE;
+        wake = ringUsed < CONFIG_FLASH_LOG_BUFFER_SIZE / 2 && ringUsed + kept >= CONFIG_FLASH_LOG_BUFFER_SIZE / 2;
+        ringUsed += kept;
+        stats.raw += kept;
+    }
+    portEXIT_CRITICAL(&ringLock);
+    if (wake) {
+        xTaskNotifyGive(storeTask);
+    }
+    return originalVprintf(format, args);
+}
+
+static size_t flash_log_ring_take(uint8_t *out, size_t size) {
+    portENTER_CRITICAL(&ringLock);
+    size_t length = ringUsed < size ? ringUsed : size;
+    size_t tail = (ringHead + CONFIG_FLASH_LOG_BUFFER_SIZE - ringUsed) % CONFIG_FLASH_LOG_BUFFER_SIZE;
+    size_t first = CONFIG_FLASH_LOG_BUFFER_SIZE - tail;
+    first = first < length ? first : length;
+    memcpy(out, ring + tail, first);
+    memcpy(out + first, ring, length - first);
+    ringUsed -= length;
+    portEXIT_CRITICAL(&ringLock);
+    return length;
+}
+
+static inline uint32_t flash_log_hash(const uint8_t *in) {
+    return ((in[0] << 16 | in[1] << 8 | in[2]) * 2654435761u) >> (32 - LOG_HASH_BITS);
+}
+
+// LZSS: a flag byte for the next 8 items, bit set for a literal byte, clear for a match of
+// 12 bit distance and 4 bit length - LOG_MATCH_MIN. Returns 0 if the output exceeds limit
+static size_t flash_log_compress(const uint8_t *in, size_t length, uint8_t *out, size_t limit) {
+    memset(hashHead, 0xff, sizeof(uint16_t) << LOG_HASH_BITS);
+    size_t pos = 0;
+    size_t outPos = 0;
+    size_t flagPos = 0;
+    int bit = 8;
+    while (pos < length) {
+        if (bit == 8) {
+            if (outPos >= limit) {
+                return 0;
+            }
+            flagPos = outPos++;
+            out[flagPos] = 0;
+            bit = 0;
+        }
+        size_t matchLength = 0;
+        size_t distance = 0;
+        if (pos + LOG_MATCH_MIN <= length) {
+            uint32_t hash = flash_log_hash(in + pos);
+            uint16_t candidate = hashHead[hash];
+            hashHead[hash] = pos;
+            if (candidate != UINT16_MAX && pos - candidate <= LOG_WINDOW) {
+                size_t maxLength = length - pos < LOG_MATCH_MAX ? length - pos : LOG_MATCH_MAX;
+                while (matchLength < maxLength && in[candidate + matchLength] == in[pos + matchLength]) {
+                    matchLength++;
+                }
+                distance = pos - candidate;
+            }
+        }
+        if (matchLength >= LOG_MATCH_MIN) {
+            if (outPos + 2 > limit) {
+                return 0;
+            }
+            out[outPos++] = distance & 0xff;
+            out[outPos++] = (distance >> 8) << 4 | (matchLength - LOG_MATCH_MIN);
+            for (size_t i = 1; i < matchLength && pos + i + LOG_MATCH_MIN <= length; i++) {
+                hashHead[flash_log_hash(in + pos + i)] = pos + i;
+            }
+            pos += matchLength;
+        } else {
+            if (outPos >= limit) {
+                return 0;
+            }
+            out[flagPos] |= 1 << bit;
+            out[outPos++] = in[pos++];
+        }
+        bit++;
+    }
+    return outPos;
+}
+
+// Returns raw length, 0 if the data is corrupted
+static size_t flash_log_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t size) {
+    size_t inPos = 0;
+    size_t outPos = 0;
+    while (inPos < length) {
+        uint8_t flags = in[inPos++];
+        for (int bit = 0; bit < 8 && inPos < length; bit++) {
+            if (flags & (1 << bit)) {
+                if (outPos >= size) {
+                    return 0;
+                }
+                out[outPos++] = in[inPos++];
+                continue;
+            }
+            if (inPos + 2 > length) {
+                return 0;
+            }
+            size_t distance = in[inPos] | (in[inPos + 1] >> 4) << 8;
+            size_t matchLength = (in[inPos + 1] & 0x0f) + LOG_MATCH_MIN;
+            inPos += 2;
+            if (distance == 0 || distance > outPos || outPos + matchLength > size) {
+                return 0;
+            }
+            for (size_t i = 0; i < matchLength; i++, outPos++) {
+                out[outPos] = out[outPos - distance];
+            }
+        }
+    }
+    return outPos;
+}
+
+static void flash_log_start_sector() {
+    memset(sector, 0xff, LOG_SECTOR_SIZE);
+    log_sector_header_t header = {
+        .magic = LOG_MAGIC,
+        .sequence = writeSequence,
+    };
+    memcpy(sector, &header, sizeof(header));
+    openSector.used = sizeof(header);
+    openSector.magic = LOG_OPEN_MAGIC;
+    openRaw = 0;
+}
+
+// Write the sector image into its ring slot and start the next one. storeLock held
+static void flash_log_seal() {
+    uint32_t slot = writeSequence % sectorCount;
+    size_t offset = slot * LOG_SECTOR_SIZE;
+    // The previous lap of the slot is gone with the erase
+    storeRaw -= sectorRaw[slot];
+    sectorRaw[slot] = 0;
+    esp_err_t err = esp_partition_erase_range(partition, offset, LOG_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        stats.erases++;
+        err = esp_partition_write(partition, offset, sector, openSector.used);
+    }
+    if (err == ESP_OK) {
+        stats.flash += openSector.used;
+        stats.sectors++;
+        sectorRaw[slot] = openRaw;
+    } else {
+        storeRaw -= openRaw;
+        ESP_LOGE(TAG, "Log sector %lu write failed: %s", writeSequence, esp_err_to_name(err));
+    }
+
+    writeSequence++;
+    flash_log_start_sector();
+}
+
+// Compress the captured text into the sector image. storeLock held
+static void flash_log_drain() {
+    size_t length;
+    while ((length = flash_log_ring_take(chunk, LOG_CHUNK_SIZE)) > 0) {
+        log_block_header_t block = {
+            .compressed = 0,
+            .raw = uint16_t(length),
+        };
+        for (;;) {
+            size_t room = LOG_SECTOR_SIZE - openSector.used;
+            uint8_t *data = sector + openSector.used + sizeof(block);
+            if (room > sizeof(block)) {
+                size_t limit = room - sizeof(block) < length - 1 ? room - sizeof(block) : length - 1;
+                block.compressed = flash_log_compress(chunk, length, data, limit);
+                if (block.compressed == 0 && room >= sizeof(block) + length) {
+                    memcpy(data, chunk, length);
+                    block.compressed = length;
+                }
+            }
+            if (block.compressed != 0) {
+                break;
+            }
+            flash_log_seal();
+        }
+        memcpy(sector + openSector.used, &block, sizeof(block));
+        openSector.used += sizeof(block) + block.compressed;
+        stats.compressed += sizeof(block) + block.compressed;
+        openRaw += block.raw;
+        storeRaw += block.raw;
+    }
+}
+
+static void flashLogTask(void *pvParameters) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_FLASH_LOG_FLUSH_INTERVAL * 1000));
+        xSemaphoreTake(storeLock, portMAX_DELAY);
+        flash_log_drain();
+        xSemaphoreGive(storeLock);
+    }
+}
+
+// Keep the partial sector over esp_restart
+static void flash_log_shutdown() {
+    if (xSemaphoreTake(storeLock, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return;
+    }
+    flash_log_drain();
+    if (openSector.used > sizeof(log_sector_header_t)) {
+        flash_log_seal();
+    }
+    xSemaphoreGive(storeLock);
+}
+
+// Continue numbering after the newest sector
+static void flash_log_scan() {
+    log_sector_header_t header;
+    for (uint32_t i = 0; i < sectorCount; i++) {
+        if (esp_partition_read(partition, i * LOG_SECTOR_SIZE, &header, sizeof(header)) == ESP_OK &&
+            header.magic == LOG_MAGIC && header.sequence != UINT32_MAX && header.sequence >= writeSequence) {
+            writeSequence = header.sequence + 1;
+        }
+    }
+}
+
+// Seal a sector left open by a reset that skipped the shutdown handler. False if there is none
+static bool flash_log_recover() {
+    log_sector_header_t header;
+    memcpy(&header, sector, sizeof(header));
+    // Sealed or stale images are older than the newest sector in flash
+    if (openSector.magic != LOG_OPEN_MAGIC || openSector.used <= sizeof(header) || openSector.used > LOG_SECTOR_SIZE ||
+        header.magic != LOG_MAGIC || header.sequence == UINT32_MAX || header.sequence < writeSequence) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Sealing sector %lu left open, %u bytes", header.sequence, openSector.used);
+    writeSequence = header.sequence;
+    flash_log_seal();
+    return true;
+}
+
+// Start reading at the oldest sector, with buffers for decoding if decode is set
+static bool flash_log_reader_open(flash_log_reader_t *reader, bool decode) {
+    *reader = {};
+    if (decode) {
+        reader->text = (uint8_t *)malloc(LOG_CHUNK_SIZE);
+        reader->data = (uint8_t *)malloc(LOG_CHUNK_SIZE);
+        if (reader->text == nullptr || reader->data == nullptr) {
+            free(reader->text);
+            free(reader->data);
+            reader->text = nullptr;
+            return false;
+        }
+    }
+    // Include everything logged so far
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    flash_log_drain();
+    reader->sequence = writeSequence > sectorCount ? writeSequence - sectorCount : 1;
+    reader->offset = sizeof(log_sector_header_t);
+    xSemaphoreGive(storeLock);
+    return true;
+}
+
+static void flash_log_reader_close(flash_log_reader_t *reader) {
+    free(reader->text);
+    free(reader->data);
+    reader->text = nullptr;
+    reader->data = nullptr;
+}
+
+// Load the next block, false at the end of the log. Without decode buffers only the length is read
+static bool flash_log_next_block(flash_log_reader_t *reader) {
+    for (;;) {
+        log_block_header_t block = {
+            .compressed = LOG_BLOCK_END,
+            .raw = 0,
+        };
+        bool found = false;
+        bool end = false;
+
+        // The lock keeps the sector from being overwritten while read
+        xSemaphoreTake(storeLock, portMAX_DELAY);
+        if (reader->sequence >= writeSequence) {
+            if (reader->sequence == writeSequence && reader->offset + sizeof(block) <= openSector.used) {
+                memcpy(&block, sector + reader->offset, sizeof(block));
+                if (reader->data != nullptr) {
+                    memcpy(reader->data, sector + reader->offset + sizeof(block), block.compressed);
+                }
+                found = true;
+            } else {
+                end = true;
+            }
+        } else if (reader->offset + sizeof(block) <= LOG_SECTOR_SIZE) {
+            size_t base = (reader->sequence % sectorCount) * LOG_SECTOR_SIZE;
+            log_sector_header_t header;
+            found = esp_partition_read(partition, base, &header, sizeof(header)) == ESP_OK &&
+                    header.magic == LOG_MAGIC && header.sequence == reader->sequence &&
+                    esp_partition_read(partition, base + reader->offset, &block, sizeof(block)) == ESP_OK &&
+                    block.compressed != LOG_BLOCK_END && block.raw <= LOG_CHUNK_SIZE && block.compressed <= block.raw &&
+                    reader->offset + sizeof(block) + block.compressed <= LOG_SECTOR_SIZE &&
+                    (reader->data == nullptr ||
+                     esp_partition_read(partition, base + reader->offset + sizeof(block), reader->data, block.compressed) == ESP_OK);
+        }
+        xSemaphoreGive(storeLock);
+
+        if (end) {
+            return false;
+        }
+        if (!found) {
+            reader->sequence++;
+            reader->offset = sizeof(log_sector_header_t);
+            continue;
+        }
+        reader->offset += sizeof(block) + block.compressed;
+        reader->textPos = 0;
+        if (reader->text == nullptr) {
+            reader->textLength = block.raw;
+        } else if (block.compressed == block.raw) {
+            memcpy(reader->text, reader->data, block.raw);
+            reader->textLength = block.raw;
+        } else {
+            reader->textLength = flash_log_decompress(reader->data, block.compressed, reader->text, LOG_CHUNK_SIZE);
+        }
+        return true;
+    }
+}
+
+// Copy log text, returns bytes copied, less than size at the end of the log
+static size_t flash_log_read(flash_log_reader_t *reader, uint8_t *out, size_t size) {
+    size_t length = 0;
+    while (length < size) {
+        if (reader->textPos == reader->textLength && !flash_log_next_block(reader)) {
+            break;
+        }
+        size_t count = reader->textLength - reader->textPos;
+        count = count < size - length ? count : size - length;
+        memcpy(out + length, reader->text + reader->textPos, count);
+        reader->textPos += count;
+        length += count;
+    }
+    return length;
+}
+
+// Count the raw bytes of every sector from the block headers, once at boot
+static void flash_log_count() {
+    flash_log_reader_t reader;
+    flash_log_reader_open(&reader, false);
+    while (flash_log_next_block(&reader)) {
+        if (reader.sequence < writeSequence) {
+            sectorRaw[reader.sequence % sectorCount] += reader.textLength;
+        } else {
+            openRaw += reader.textLength;
+        }
+    }
+    storeRaw = openRaw;
+    for (uint32_t i = 0; i < sectorCount; i++) {
+        storeRaw += sectorRaw[i];
+    }
+}
+
+// Raw bytes in the store, everything logged so far included
+static size_t flash_log_size() {
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    flash_log_drain();
+    size_t size = storeRaw;
+    xSemaphoreGive(storeLock);
+    return size;
+}
+
+class FlashLogProvider : public LogProviderDelegate {
+public:
+    CHIP_ERROR StartLogCollection(IntentEnum intent, LogSessionHandle &outHandle, Optional<uint64_t> &outTimeStamp,
+                                  Optional<uint64_t> &outTimeSinceBoot) override {
+        if (intent != IntentEnum::kEndUserSupport) {
+            return CHIP_ERROR_NOT_FOUND;
+        }
+        if (reader.text != nullptr) {
+            return CHIP_ERROR_BUSY;
+        }
+        if (!flash_log_reader_open(&reader, true)) {
+            return CHIP_ERROR_NO_MEMORY;
+        }
+        if (++session == kInvalidLogSessionHandle) {
+            session = 1;
+        }
+        outHandle = session;
+        outTimeSinceBoot.SetValue(esp_timer_get_time());
+        ESP_LOGI(TAG, "Log collection %u started", session);
+        return CHIP_NO_ERROR;
+    }
+
+    CHIP_ERROR EndLogCollection(LogSessionHandle sessionHandle) override {
+        VerifyOrReturnError(sessionHandle == session && reader.text != nullptr, CHIP_ERROR_INVALID_ARGUMENT);
+        flash_log_reader_close(&reader);
+        return CHIP_NO_ERROR;
+    }
+
+    CHIP_ERROR CollectLog(LogSessionHandle sessionHandle, MutableByteSpan &outBuffer, bool &outIsEndOfLog) override {
+        VerifyOrReturnError(sessionHandle == session && reader.text != nullptr, CHIP_ERROR_INVALID_ARGUMENT);
+        size_t length = flash_log_read(&reader, outBuffer.data(), outBuffer.size());
+        outIsEndOfLog = length < outBuffer.size();
+        outBuffer.reduce_size(length);
+        return CHIP_NO_ERROR;
+    }
+
+    size_t GetSizeForIntent(IntentEnum intent) override {
+        return intent == IntentEnum::kEndUserSupport ? flash_log_size() : 0;
+    }
+
+    // Response payload, the newest text that fits
+    CHIP_ERROR GetLogForIntent(IntentEnum intent, MutableByteSpan &outBuffer, Optional<uint64_t> &outTimeStamp,
+                               Optional<uint64_t> &outTimeSinceBoot) override {
+        size_t size = GetSizeForIntent(intent);
+        LogSessionHandle sessionHandle;
+        ReturnErrorOnFailure(StartLogCollection(intent, sessionHandle, outTimeStamp, outTimeSinceBoot));
+        size_t skip = size > outBuffer.size() ? size - outBuffer.size() : 0;
+        while (skip > 0) {
+            size_t count = flash_log_read(&reader, outBuffer.data(), skip < outBuffer.size() ? skip : outBuffer.size());
+            if (count == 0) {
+                break;
+            }
+            skip -= count;
+        }
+        size_t length = flash_log_read(&reader, outBuffer.data(), outBuffer.size());
+        outBuffer.reduce_size(length);
+        return EndLogCollection(sessionHandle);
+    }
+
+private:
+    flash_log_reader_t reader = {};
+    LogSessionHandle session = 0;
+};
+
+static FlashLogProvider provider;
+
+void *flash_log_diagnostic_delegate() {
+    return partition != nullptr ? &provider : nullptr;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static void flash_log_dump() {
+    flash_log_reader_t reader;
+    uint8_t text[256];
+    if (!flash_log_reader_open(&reader, true)) {
+        return;
+    }
+    size_t length;
+    do {
+        length = flash_log_read(&reader, text, sizeof(text));
+        fwrite(text, 1, length, stdout);
+    } while (length == sizeof(text));
+    flash_log_reader_close(&reader);
+}
+
+static esp_err_t logs_handler(int argc, char **argv) {
+    if (argc == 1 && strcmp(argv[0], "dump") == 0) {
+        flash_log_dump();
+        return ESP_OK;
+    }
+    if (argc == 1 && strcmp(argv[0], "flush") == 0) {
+        flash_log_shutdown();
+        return ESP_OK;
+    }
+    if (argc != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    flash_log_stats_t s;
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    portENTER_CRITICAL(&ringLock);
+    s = stats;
+    size_t used = ringUsed;
+    portEXIT_CRITICAL(&ringLock);
+    uint32_t sequence = writeSequence;
+    size_t pending = openSector.used;
+    size_t raw = storeRaw;
+    xSemaphoreGive(storeLock);
+
+    float hours = esp_timer_get_time() / 3600e6f;
+    float erasesPerHour = s.erases / hours;
+    printf("Store: %lu sectors, %u bytes of text, sector %lu at %u bytes, ring %u/%u bytes\n",
+           sectorCount, raw, sequence, pending, used, CONFIG_FLASH_LOG_BUFFER_SIZE);
+    printf("Captured: %llu bytes, dropped: %lu, compressed: %llu bytes (%.1f%%)\n",
+           s.raw, s.dropped, s.compressed, s.raw ? 100.0f * s.compressed / s.raw : 0.0f);
+    printf("Flash: %llu bytes in %lu sectors, %lu erases; %.0f bytes/h, %.2f erases/h, ring lap %.1f h\n",
+           s.flash, s.sectors, s.erases, s.flash / hours, erasesPerHour,
+           erasesPerHour > 0 ? sectorCount / erasesPerHour : 0.0f);
+    return ESP_OK;
+}
+#endif
+
+void flash_log_init() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "logs");
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No logs partition, log store disabled");
+        return;
+    }
+    sectorCount = partition->size / LOG_SECTOR_SIZE;
+    ring = (char *)malloc(CONFIG_FLASH_LOG_BUFFER_SIZE);
+    chunk = (uint8_t *)malloc(LOG_CHUNK_SIZE);
+    hashHead = (uint16_t *)malloc(sizeof(uint16_t) << LOG_HASH_BITS);
+    sectorRaw = (uint32_t *)calloc(sectorCount, sizeof(uint32_t));
+    storeLock = xSemaphoreCreateMutex();
+    if (ring == nullptr || chunk == nullptr || hashHead == nullptr || sectorRaw == nullptr || storeLock == nullptr) {
+        ESP_LOGE(TAG, "No memory for the log store");
+        partition = nullptr;
+        return;
+    }
+
+    // The slot of the new sector keeps its previous lap until the sector is full
+    flash_log_scan();
+    if (!flash_log_recover()) {
+        flash_log_start_sector();
+    }
+    flash_log_count();
+
+    xTaskCreate(flashLogTask, "flashLog", 3072, nullptr, 2, &storeTask);
+    originalVprintf = esp_log_set_vprintf(flash_log_vprintf);
+    esp_register_shutdown_handler(flash_log_shutdown);
+    ESP_LOGI(TAG, "Log store: %lu sectors, sector %lu, reset reason %d", sectorCount, writeSequence, esp_reset_reason());
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "logs",
+            .description = "Flash log store. Usage: matter esp light logs [dump|flush]",
+            .handler = logs_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
@@ -0,0 +1,15 @@
+//
+// Compressed log store in the "logs" partition
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#if CONFIG_FLASH_LOG
+// Capture esp_log output and start the store task
+void flash_log_init();
+// DiagnosticLogs provider delegate, for diagnostic_logs::config_t
+void *flash_log_diagnostic_delegate();
+#endif
@@ -1,28 +1,110 @@
 //
-// Two color led driver
+// Tunable white led driver
+//
+// Every channel declares its color temperature, flux and power. With a neutral channel, duties
+// giving the best lumens per watt at each color temperature are solved when the bounds are set
+// and the fade path only interpolates the solved table. Warm and cold channels alone follow
+// the two channel curve. All channels fade on one LEDC timeline, fades slower than the LEDC
+// can step are stepped by the fade task.
 //
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include <common_macros.h>
 #include "app_priv.h"
+#include "light_driver.h"
+#include "light_state.h"
 #include "led_driver.h"
+#include "energy_meter.h"
+#include "calibration.h"
+#include "led_sim.h"
+#include "light_console.h"
 #include "driver/ledc.h"
 #include "soc/ledc_reg.h"
 
 static void fadeTask( void *pvParameters );
-static void led_driver_queue_pwm(uint32_t warmPWM, uint32_t coldPWM);
+static void led_driver_mix(uint8_t brightness, uint16_t temperature, uint32_t *pwm);
+static uint32_t led_driver_fade_time(const uint32_t *pwm, uint32_t fadeTime);
 
 static const char *TAG = "led_driver";
 
-static uint8_t MinBrightness;
-static uint8_t MaxBrightness;
-static uint16_t MiredsWarm;
-static uint16_t MiredsCold;
+typedef struct {
+    uint16_t miredsWarm;
+    uint16_t miredsCold;
+    uint8_t minBrightness;
+    uint8_t maxBrightness;
+} led_bounds_t;
+
+static SeqLock<led_bounds_t> bounds;
+
+#define LED_MIX_POINTS 33
+#if CONFIG_LED_NEUTRAL_CHANNEL
+#define LED_MIX_ITERATIONS 16
+#define LED_MIX_MAX_DUV (CONFIG_LED_MIX_MAX_DUV / 1000.0f)
+#define LED_MIX_SAG 0.0005f                 // Duv, locus curvature over a table step
+#endif
+
+typedef struct {
+    uint16_t flux;              // lm at full duty
+    uint16_t power;             // mW at full duty
+} led_channel_t;
+
+static const led_channel_t channels[LED_CHANNELS] = {
+    { CONFIG_LED_WARM_FLUX, CONFIG_LED_WARM_POWER },
+    { CONFIG_LED_COLD_FLUX, CONFIG_LED_COLD_POWER },
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    { CONFIG_LED_NEUTRAL_FLUX, CONFIG_LED_NEUTRAL_POWER },
+#endif
+};
 
-static QueueHandle_t fadeEventQueue;
+#if CONFIG_LED_NEUTRAL_CHANNEL
+// Channel duties over the color temperature range at full brightness, PWMBase for the
+// brightest channel. Equally spaced from miredsCold to miredsWarm
+typedef struct {
+    uint16_t miredsWarm;
+    uint16_t miredsCold;
+    uint16_t duty[LED_MIX_POINTS][LED_CHANNELS];
+} led_mix_table_t;
 
+static SeqLock<led_mix_table_t> mixTable;
+#endif
+
+typedef struct {
+    uint32_t fadeTime;
+    int64_t time;               // us, command received or request enqueued
+#if CONFIG_LED_FIXED_LATENCY
+    light_state_t state;        // output at time + fixed latency
+#endif
+} fade_request_t;
+
+#define FADE_TASK_PRIORITY 15
+#define FADE_QUEUE_LENGTH 10
+
+// Fade requests, oldest first. A request finding the queue full is merged into the last
+// one, so the newest state is never lost
+static fade_request_t fadeQueue[FADE_QUEUE_LENGTH];
+static size_t fadeQueueHead;
+static size_t fadeQueueCount;
+static portMUX_TYPE fadeQueueLock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t fadeQueueSignal;       // given on every request
+static led_driver_stats_t stats;
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+static void (*latencyProbe)(uint32_t latency);
+static std::atomic<uint16_t> outputLimit{LED_OUTPUT_LIMIT_FULL};
+// Runtime tunable, Kconfig values until set
+static std::atomic<uint32_t> fullFadeTime{CONFIG_FADE_TIME};
+static std::atomic<uint32_t> pwmFrequency{CONFIG_PWM_FREQUENCY};
+
+#if !CONFIG_LED_SIMULATED
 static ledc_timer_config_t ledc_timer = {
     .speed_mode = LEDC_LOW_SPEED_MODE,        // timer mode
     .duty_resolution = LEDC_TIMER_12_BIT,     // resolution of PWM duty
@@ -31,7 +113,7 @@ static ledc_timer_config_t ledc_timer = {
     .clk_cfg = LEDC_AUTO_CLK,                 // Auto select the source clock
 };
 
-static ledc_channel_config_t ledcChannel[2] = {
+static ledc_channel_config_t ledcChannel[LED_CHANNELS] = {
     {
         .gpio_num   = CONFIG_LED_WARM_GPIO,
         .speed_mode = LEDC_LOW_SPEED_MODE,
@@ -48,80 +130,926 @@ static ledc_channel_config_t ledcChannel[2] = {
         .duty       = 0,
         .hpoint     = 0,
     },
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    {
+        .gpio_num   = CONFIG_LED_NEUTRAL_GPIO,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .channel    = LEDC_CHANNEL_2,
+        .timer_sel  = LEDC_TIMER_0,
+        .duty       = 0,
+        .hpoint     = 0,
+    },
+#endif
 };
+#endif
 
 static uint32_t PWMBase = 1 << LEDC_TIMER_12_BIT;
 
+#if CONFIG_LED_GAMMA_FADE
+// CIE 1931 lightness to duty, both scaled to PWMBase
+static uint32_t led_driver_cie_duty(uint32_t lightness) {
+    float l = lightness * 100.0f / PWMBase;
+    float y = l <= 8.0f ? l / 903.3f : powf((l + 16.0f) / 116.0f, 3);
+    return uint32_t(lroundf(y * PWMBase));
+}
+
+// Inverse of led_driver_cie_duty
+static uint32_t led_driver_cie_lightness(uint32_t duty) {
+    float y = float(duty) / PWMBase;
+    float l = y <= 0.008856f ? y * 903.3f : 116.0f * cbrtf(y) - 16.0f;
+    return uint32_t(lroundf(l * PWMBase / 100.0f));
+}
+
+// Perceptually uniform fade: linear in lightness, compiled into hardware fade ranges
+// approximating the CIE curve, so the LEDC runs it without CPU interpolation
+static bool led_driver_set_gamma_fade(int chan, uint32_t duty, uint32_t fadeTime) {
+    ledc_fade_param_config_t ranges[SOC_LEDC_GAMMA_CURVE_FADE_RANGE_MAX];
+    uint32_t rangeCount = 0;
+    uint32_t startDuty = ledc_get_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+    if (fadeTime == 0 || startDuty == duty) {
+        return false;
+    }
+    uint32_t startLightness = led_driver_cie_lightness(startDuty);
+    esp_err_t err = ledc_fill_multi_fade_param_list(ledcChannel[chan].speed_mode, ledcChannel[chan].channel,
+                                                    startLightness, led_driver_cie_lightness(duty),
+                                                    CONFIG_LED_GAMMA_FADE_RANGES, fadeTime, led_driver_cie_duty,
+                                                    SOC_LEDC_GAMMA_CURVE_FADE_RANGE_MAX, ranges, &rangeCount);
+    if (err == ESP_OK) {
+        err = ledc_set_multi_fade(ledcChannel[chan].speed_mode, ledcChannel[chan].channel,
+                                  led_driver_cie_duty(startLightness), ranges, rangeCount);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Gamma fade failed, linear fade: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+#endif
+
+#if !CONFIG_LED_SIMULATED
+#define LED_FADE_STEP_CYCLES 1023       // PWM periods per duty step of a hardware fade, at most
+#if SOC_LEDC_SUPPORT_FADE_STOP
+#define LED_FADE_SEGMENT 1000           // ms, hardware fade of a software stepped fade
+#define LED_FADE_HW_MAX UINT32_MAX      // ms, longest fade left to the hardware
+#else
+// A running hardware fade can not be preempted on this target (ESP32). Longer fades are
+// stepped in short segments and a new fade starts when the running segment ends, so the
+// fade task never waits for the LEDC
+#define LED_FADE_SEGMENT 50
+#define LED_FADE_HW_MAX LED_FADE_SEGMENT
+
+// Duty the last fade of each channel ends at and its end, us
+static uint32_t fadeTarget[LED_CHANNELS];
+static int64_t fadeTargetTime;
+#endif
+
+// Fade slower than the LEDC can step, run by fadeTask as a series of hardware fades
+typedef struct {
+    uint32_t from[LED_CHANNELS];
+    uint32_t to[LED_CHANNELS];
+    int64_t start;              // us
+    int64_t end;                // us, 0 if no stepped fade is running
+    int64_t segmentEnd;         // us
+} led_stepped_fade_t;
+
+static led_stepped_fade_t steppedFade;
+
+// Stop the fade in progress at its current duty
+static void led_driver_stop_fade(int chan) {
+#if SOC_LEDC_SUPPORT_FADE_STOP
+    ledc_fade_stop(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+#else
+    // No fade stop on this target: setting the duty waits for the running fade to release
+    // the channel, the duty is held where it ended. Fades are started after it ended
+    ledc_set_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel, fadeTarget[chan]);
+    ledc_update_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+#endif
+}
+
+// Start new hardware fade of all channels. Channel updates are latched by the LEDC on timer
+// overflow, the timer is held while they are started, so new duty and fade parameters of all
+// channels take effect on the same PWM period.
+static void led_driver_hw_fade(const uint32_t *pwm, uint32_t fadeTime) {
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        // Preempt fade in progress
+        led_driver_stop_fade(chan);
+    }
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        int duty = pwm[chan];
+#if !SOC_LEDC_SUPPORT_FADE_STOP
+        fadeTarget[chan] = duty;
+#endif
+#if CONFIG_LED_GAMMA_FADE
+        if (led_driver_set_gamma_fade(chan, duty, fadeTime)) {
+            continue;
+        }
+#endif
+        ledc_set_fade_with_time(ledcChannel[chan].speed_mode, ledcChannel[chan].channel, duty, fadeTime);
+    }
+    ledc_timer_pause(ledc_timer.speed_mode, ledc_timer.timer_num);
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        ledc_fade_start(ledcChannel[chan].speed_mode, ledcChannel[chan].channel, LEDC_FADE_NO_WAIT);
+    }
+    ledc_timer_resume(ledc_timer.speed_mode, ledc_timer.timer_num);
+#if !SOC_LEDC_SUPPORT_FADE_STOP
+    fadeTargetTime = esp_timer_get_time() + int64_t(fadeTime) * 1000;
+#endif
+}
+
+// A hardware fade steps the duty at most every LED_FADE_STEP_CYCLES periods, a slower one
+// would end early
+static bool led_driver_hw_can_fade(const uint32_t *from, const uint32_t *to, uint32_t fadeTime) {
+    uint64_t cycles = uint64_t(fadeTime) * pwmFrequency / 1000;
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        uint32_t delta = from[chan] > to[chan] ? from[chan] - to[chan] : to[chan] - from[chan];
+        if (delta != 0 && cycles > uint64_t(delta) * LED_FADE_STEP_CYCLES) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Duty of the stepped fade at time
+static void led_driver_stepped_duty(int64_t time, uint32_t *pwm) {
+    int64_t span = steppedFade.end - steppedFade.start;
+    int64_t done = time - steppedFade.start;
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+#if CONFIG_LED_GAMMA_FADE
+        // Linear in lightness, as the gamma fade of a segment
+        int64_t from = led_driver_cie_lightness(steppedFade.from[chan]);
+        int64_t to = led_driver_cie_lightness(steppedFade.to[chan]);
+        pwm[chan] = led_driver_cie_duty(uint32_t(from + (to - from) * done / span));
+#else
+        int64_t from = steppedFade.from[chan];
+        int64_t to = steppedFade.to[chan];
+        pwm[chan] = uint32_t(from + (to - from) * done / span);
+#endif
+    }
+}
+
+// Start the next segment of the stepped fade, the last one ends it
+static void led_driver_stepped_segment() {
+    uint32_t pwm[LED_CHANNELS];
+    int64_t now = esp_timer_get_time();
+    int64_t segmentEnd = now + LED_FADE_SEGMENT * 1000;
+    if (segmentEnd >= steppedFade.end) {
+        segmentEnd = steppedFade.end > now ? steppedFade.end : now;
+        memcpy(pwm, steppedFade.to, sizeof(pwm));
+        steppedFade.end = 0;
+    } else {
+        led_driver_stepped_duty(segmentEnd, pwm);
+    }
+    steppedFade.segmentEnd = segmentEnd;
+    led_driver_hw_fade(pwm, uint32_t((segmentEnd - now) / 1000));
+}
+
+// Start new fade of all channels from the current output. Fades too slow for the LEDC, e.g.
+// a small change over a schedule slot, are stepped by fadeTask in LED_FADE_SEGMENT fades
+static void led_driver_start_fade(const uint32_t *pwm, uint32_t fadeTime) {
+    int64_t now = esp_timer_get_time();
+    uint32_t from[LED_CHANNELS];
+#if SOC_LEDC_SUPPORT_FADE_STOP
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        from[chan] = ledc_get_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+    }
+    int64_t start = now;
+#else
+    memcpy(from, fadeTarget, sizeof(from));
+    int64_t start = fadeTargetTime > now ? fadeTargetTime : now;
+#endif
+    if (start == now && fadeTime <= LED_FADE_HW_MAX && led_driver_hw_can_fade(from, pwm, fadeTime)) {
+        steppedFade.end = 0;
+        led_driver_hw_fade(pwm, fadeTime);
+        return;
+    }
+    memcpy(steppedFade.from, from, sizeof(from));
+    memcpy(steppedFade.to, pwm, sizeof(steppedFade.to));
+    steppedFade.start = start;
+    steppedFade.end = start + int64_t(fadeTime) * 1000;
+    if (start > now) {
+        // The first segment is started by fadeTask when the running fade ends
+        steppedFade.segmentEnd = start;
+        return;
+    }
+    led_driver_stepped_segment();
+}
+
+// Ticks fadeTask may wait for a request before the next stepped fade segment is due
+static TickType_t led_driver_fade_wait() {
+    if (steppedFade.end == 0) {
+        return portMAX_DELAY;
+    }
+    int64_t wait = steppedFade.segmentEnd - esp_timer_get_time();
+    return wait > 0 ? pdMS_TO_TICKS(wait / 1000) + 1 : 0;
+}
+#endif
+
+#if CONFIG_LED_FIXED_LATENCY
+#define FIXED_LATENCY (int64_t(CONFIG_LED_FIXED_LATENCY_MS) * 1000)
+#define FIXED_LATENCY_SPIN 100          // us before the deadline busy waited
+#define FIXED_LATENCY_LATE 1000         // us
+
+static void led_driver_deadline_cb(void *arg) {
+    xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+// Deadline timer of the calling task, it is woken by the timer
+static esp_timer_handle_t led_driver_deadline_timer() {
+    const esp_timer_create_args_t timerArgs = {
+        .callback = led_driver_deadline_cb,
+        .arg = xTaskGetCurrentTaskHandle(),
+        .name = "fade_deadline",
+    };
+    esp_timer_handle_t timer = nullptr;
+    esp_timer_create(&timerArgs, &timer);
+    return timer;
+}
+
+// Sleep until shortly before the deadline, spin the rest. Returns the time reached
+static int64_t led_driver_wait_until(esp_timer_handle_t timer, int64_t deadline) {
+    int64_t now = esp_timer_get_time();
+    if (deadline - now > FIXED_LATENCY_SPIN) {
+        esp_timer_start_once(timer, deadline - now - FIXED_LATENCY_SPIN);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    while ((now = esp_timer_get_time()) < deadline) {
+    }
+    return now;
+}
+#endif
+
+// Merge a newer request into an older one. Retarget must not shorten a requested fade
+static void led_driver_merge_request(fade_request_t *request, const fade_request_t &newer) {
+    if (newer.fadeTime != LED_FADE_RETARGET) {
+        request->fadeTime = newer.fadeTime;
+    }
+#if CONFIG_LED_FIXED_LATENCY
+    request->state = newer.state;
+#endif
+}
+
+// Oldest queued request, only if it was received by notAfter
+static bool led_driver_receive_request(fade_request_t *request, int64_t notAfter = INT64_MAX) {
+    bool received = false;
+    portENTER_CRITICAL(&fadeQueueLock);
+    if (fadeQueueCount != 0 && fadeQueue[fadeQueueHead].time <= notAfter) {
+        *request = fadeQueue[fadeQueueHead];
+        fadeQueueHead = (fadeQueueHead + 1) % FADE_QUEUE_LENGTH;
+        fadeQueueCount--;
+        received = true;
+    }
+    portEXIT_CRITICAL(&fadeQueueLock);
+    return received;
+}
+
+// Output is computed here from the latest light state snapshot, so concurrent
+// updates from the Matter, button and schedule contexts always converge to it
+// Requests queued meanwhile are coalesced, the latest fade time is used.
+// With CONFIG_LED_FIXED_LATENCY each request carries its own state and is output a fixed
+// time after it was received, whatever the processing took. Only overdue requests are coalesced.
 static void fadeTask( void *pvParameters ) {
-    uint32_t pwm[3];
-    int fadeTime;
+    uint32_t pwm[LED_CHANNELS];
+    fade_request_t request;
+    fade_request_t next;
+    int64_t fadeEnd = 0;
+#if CONFIG_LED_FIXED_LATENCY
+    esp_timer_handle_t deadlineTimer = led_driver_deadline_timer();
+#endif
 
     ESP_LOGI(TAG, "Init fade task chan");
     for( ;; ) {
-        if (xQueueReceive(fadeEventQueue, &pwm, portMAX_DELAY)) {
-            fadeTime = pwm[2];
-            for(int chan = 0; chan < 2; chan++) {
-                // const int duty = CIEL_10_12[fade->target];
-                int duty = pwm[chan];
-                ledc_set_fade_with_time(ledcChannel[chan].speed_mode, ledcChannel[chan].channel, duty, fadeTime);
+        if (!led_driver_receive_request(&request)) {
+#if CONFIG_LED_SIMULATED
+            xSemaphoreTake(fadeQueueSignal, portMAX_DELAY);
+#else
+            if (xSemaphoreTake(fadeQueueSignal, led_driver_fade_wait()) != pdTRUE && steppedFade.end != 0) {
+                led_driver_stepped_segment();
+            }
+#endif
+        } else {
+            int64_t start = esp_timer_get_time();
+            uint32_t coalesced = 0;
+#if CONFIG_LED_FIXED_LATENCY
+            int64_t deadline = request.time + FIXED_LATENCY;
+            while (led_driver_receive_request(&next, start - FIXED_LATENCY)) {
+                led_driver_merge_request(&request, next);
+                deadline = next.time + FIXED_LATENCY;
+                coalesced++;
+            }
+            int64_t outputTime = deadline > start ? deadline : start;
+            light_state_t state = request.state;
+#else
+            while (led_driver_receive_request(&next)) {
+                led_driver_merge_request(&request, next);
+                coalesced++;
+            }
+            int64_t outputTime = start;
+            light_state_t state = light_state_get();
+#endif
+            uint32_t fadeTime = request.fadeTime;
+            if (fadeTime == LED_FADE_RETARGET) {
+                fadeTime = fadeEnd > outputTime ? uint32_t((fadeEnd - outputTime) / 1000) : LED_FADE_AUTO;
+            }
+
+            led_driver_mix(state.power ? state.brightness : 0, state.mireds, pwm);
+            fadeTime = led_driver_fade_time(pwm, fadeTime);
+            fadeEnd = outputTime + int64_t(fadeTime) * 1000;
+#if CONFIG_ENERGY_METER
+            energy_meter_update(pwm, fadeTime);
+#endif
+#if CONFIG_LED_FIXED_LATENCY
+            int64_t waitStart = esp_timer_get_time();
+            int64_t reached = led_driver_wait_until(deadlineTimer, deadline);
+            int64_t waited = reached - waitStart;
+            uint32_t jitter = uint32_t(reached - deadline);
+#endif
+#if CONFIG_LED_SIMULATED
+            led_sim_output(pwm, fadeTime);
+#else
+            led_driver_start_fade(pwm, fadeTime);
+#endif
+            int64_t end = esp_timer_get_time();
+            portENTER_CRITICAL(&statsLock);
+            stats.outputs++;
+            stats.coalesced += coalesced;
+#if CONFIG_LED_FIXED_LATENCY
+            stats.busyTime += end - start - waited;
+            stats.jitterSum += jitter;
+            stats.jitterMax = jitter > stats.jitterMax ? jitter : stats.jitterMax;
+            if (jitter > FIXED_LATENCY_LATE) {
+                stats.late++;
+            }
+#else
+            stats.busyTime += end - start;
+#endif
+            portEXIT_CRITICAL(&statsLock);
+            // Latency of the oldest request served by this output
+            if (latencyProbe != nullptr) {
+                latencyProbe(uint32_t(end - request.time));
+            }
+        }
+    }
+}
+
+#if CONFIG_LED_FIXED_LATENCY && CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t led_latency_handler(int argc, char **argv) {
+    led_driver_stats_t s;
+    led_driver_get_stats(&s);
+    printf("latency: %d ms, outputs: %lu, jitter avg/max: %llu/%lu us, late: %lu\n", CONFIG_LED_FIXED_LATENCY_MS,
+           s.outputs, s.outputs ? s.jitterSum / s.outputs : 0, s.jitterMax, s.late);
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_LED_FIXED_LATENCY && CONFIG_LIGHT_SELF_CHECK
+#define LATENCY_CHECK_LIGHTS 16
+
+typedef struct {
+    int64_t received;           // us, the group command
+    uint32_t processing;        // us before the deadline wait
+    int64_t started;            // us, output start after received
+    esp_timer_handle_t timer;
+    SemaphoreHandle_t done;
+} latency_light_t;
+
+// One light of a group: its own task at the fade task priority and its own deadline timer.
+// Processing is blocked, as a fade task waiting for the stack or the LEDC, then mixing
+static void latencyLightTask(void *pvParameters) {
+    latency_light_t *light = (latency_light_t *)pvParameters;
+    uint32_t pwm[LED_CHANNELS];
+    light->timer = led_driver_deadline_timer();
+    led_driver_wait_until(light->timer, light->received + light->processing);
+    led_driver_mix(light->processing % (MATTER_BRIGHTNESS + 1), REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_WARM, MATTER_TEMPERATURE_FACTOR), pwm);
+    light->started = led_driver_wait_until(light->timer, light->received + FIXED_LATENCY) - light->received;
+    xSemaphoreGive(light->done);
+    vTaskDelete(nullptr);
+}
+
+// Lights of a group receive the same command, each takes a different processing time up to
+// half of the latency. Their outputs must start within FIXED_LATENCY_LATE of each other
+static bool led_driver_latency_check() {
+    // Static, tasks left behind by a timeout must not use dead memory
+    static latency_light_t lights[LATENCY_CHECK_LIGHTS];
+    static SemaphoreHandle_t done;
+    if (done == nullptr) {
+        done = xSemaphoreCreateCounting(LATENCY_CHECK_LIGHTS, 0);
+    }
+    uint32_t seed = LIGHT_CHECK_SEED;
+    int64_t received = esp_timer_get_time();
+    for (int i = 0; i < LATENCY_CHECK_LIGHTS; i++) {
+        lights[i] = { received, uint32_t(light_check_random(&seed) % (FIXED_LATENCY / 2)), 0, nullptr, done };
+        xTaskCreate(latencyLightTask, "checkLight", 2048, &lights[i], FADE_TASK_PRIORITY, nullptr);
+    }
+    int finished = 0;
+    while (finished < LATENCY_CHECK_LIGHTS && xSemaphoreTake(done, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        finished++;
+    }
+    if (finished < LATENCY_CHECK_LIGHTS) {
+        printf("check lights did not finish\n");
+        return false;
+    }
+    int64_t minStart = INT64_MAX;
+    int64_t maxStart = 0;
+    for (latency_light_t &light : lights) {
+        esp_timer_delete(light.timer);
+        minStart = light.started < minStart ? light.started : minStart;
+        maxStart = light.started > maxStart ? light.started : maxStart;
+    }
+    printf("%d lights, output start after receive min/max: %lld/%lld us, spread %lld us\n", LATENCY_CHECK_LIGHTS,
+           minStart, maxStart, maxStart - minStart);
+    return minStart >= FIXED_LATENCY && maxStart - minStart <= FIXED_LATENCY_LATE;
+}
+#endif
+
+#if CONFIG_LED_SKEW_MEASURE && !CONFIG_LED_SIMULATED && CONFIG_ENABLE_CHIP_SHELL
+// Inter-channel skew of a duty update, read back from the LEDC duty registers
+static int64_t led_driver_measure_update_skew(const uint32_t *duty, bool batched) {
+    int64_t changedAt[LED_CHANNELS] = {};
+    uint32_t startDuty[LED_CHANNELS];
+
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        startDuty[chan] = ledc_get_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+        ledc_set_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel, duty[chan]);
+    }
+    if (batched) {
+        ledc_timer_pause(ledc_timer.speed_mode, ledc_timer.timer_num);
+    }
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        ledc_update_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+    }
+    if (batched) {
+        ledc_timer_resume(ledc_timer.speed_mode, ledc_timer.timer_num);
+    }
+
+    // Poll for a few PWM periods
+    int64_t deadline = esp_timer_get_time() + 4 * 1000000 / pwmFrequency + 100;
+    int changed = 0;
+    while (changed < LED_CHANNELS && esp_timer_get_time() < deadline) {
+        for(int chan = 0; chan < LED_CHANNELS; chan++) {
+            if (changedAt[chan] == 0 && ledc_get_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel) != startDuty[chan]) {
+                changedAt[chan] = esp_timer_get_time();
+                changed++;
             }
-            ledc_fade_start(ledcChannel[0].speed_mode, ledcChannel[0].channel, LEDC_FADE_NO_WAIT);
-            ledc_fade_start(ledcChannel[1].speed_mode, ledcChannel[1].channel, LEDC_FADE_WAIT_DONE);
         }
     }
+    if (changed < LED_CHANNELS) {
+        return -1;
+    }
+    int64_t first = changedAt[0];
+    int64_t last = changedAt[0];
+    for(int chan = 1; chan < LED_CHANNELS; chan++) {
+        first = changedAt[chan] < first ? changedAt[chan] : first;
+        last = changedAt[chan] > last ? changedAt[chan] : last;
+    }
+    return last - first;
 }
 
-static void led_driver_queue_pwm(uint32_t warmPWM, uint32_t coldPWM) {
-    static uint32_t currentPWM[2] = { 0, 0 };
+// Toggle all channels by one duty step and measure skew, sequential vs batched update
+static esp_err_t led_skew_handler(int argc, char **argv) {
+    const int count = argc > 0 ? atoi(argv[0]) : 100;
+    uint32_t base[LED_CHANNELS];
+    uint32_t step[LED_CHANNELS];
 
-    uint32_t pwm[3];
-    pwm[0] = warmPWM;
-    pwm[1] = coldPWM;
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
+        led_driver_stop_fade(chan);
+        base[chan] = ledc_get_duty(ledcChannel[chan].speed_mode, ledcChannel[chan].channel);
+        step[chan] = base[chan] > 0 ? base[chan] - 1 : 1;
+    }
+
+    for (int batched = 0; batched < 2; batched++) {
+        int64_t maxSkew = 0;
+        int64_t totalSkew = 0;
+        int samples = 0;
+        for (int i = 0; i < count; i++) {
+            int64_t skew = led_driver_measure_update_skew(i % 2 ? base : step, batched);
+            if (skew < 0) {
+                continue;
+            }
+            maxSkew = skew > maxSkew ? skew : maxSkew;
+            totalSkew += skew;
+            samples++;
+        }
+        printf("%s: samples: %d, skew avg/max: %lld/%lld us, period: %d us\n", batched ? "batched" : "sequential",
+               samples, samples ? totalSkew / samples : 0, maxSkew, int(1000000 / pwmFrequency));
+        led_driver_measure_update_skew(base, true);
+    }
+    return ESP_OK;
+}
+#endif
 
-    uint32_t fadeTime = 0;
-    for(int chan = 0; chan < 2; chan++) {
+// Fade time of the change from the current output, runs in the fade task only
+static uint32_t led_driver_fade_time(const uint32_t *pwm, uint32_t fadeTime) {
+    static uint32_t currentPWM[LED_CHANNELS] = {};
+
+    bool autoFade = fadeTime == LED_FADE_AUTO;
+    const uint32_t fullRange = fullFadeTime;
+    if (autoFade) {
+        fadeTime = 0;
+    }
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
         uint32_t time = 0;
         if (currentPWM[chan] > pwm[chan]) {
-            time = (currentPWM[chan] - pwm[chan]) * CONFIG_FADE_TIME / PWMBase;
+            time = (currentPWM[chan] - pwm[chan]) * fullRange / PWMBase;
         } else {
-            time = (pwm[chan] - currentPWM[chan]) * CONFIG_FADE_TIME / PWMBase;
+            time = (pwm[chan] - currentPWM[chan]) * fullRange / PWMBase;
         }
         // const int duty = CIEL_10_12[fade->target];
         currentPWM[chan] = pwm[chan];
-        if (time > fadeTime) {
+        if (autoFade && time > fadeTime) {
             fadeTime = time;
         }
     }
-    pwm[2] = fadeTime;
+    ESP_LOGD(TAG, "time: %lu", fadeTime);
+    return fadeTime;
+}
 
-    ESP_LOGI(TAG, "time: %lu", fadeTime);
-    
-    xQueueSend(fadeEventQueue, pwm, 0);
+// Calibrated channel duty: gain, driver dead zone and optional correction curve
+static uint32_t led_driver_calibrate(int chan, uint32_t duty) {
+    const led_calibration_t *calibration = calibration_get();
+    if (calibration == nullptr || duty == 0) {
+        return duty;
+    }
+
+    uint32_t out = duty;
+    if (chan < calibration->channels) {
+        uint32_t deadZone = calibration->channel[chan].deadZone;
+        out = deadZone + duty * calibration->channel[chan].gain / CALIBRATION_GAIN_ONE * (PWMBase - deadZone) / PWMBase;
+        if (out > PWMBase) {
+            out = PWMBase;
+        }
+    }
+
+    uint32_t points = calibration->curvePoints;
+    if (points >= 2) {
+        // Piecewise linear over equally spaced duties
+        uint32_t position = out * (points - 1);
+        uint32_t index = position / PWMBase;
+        if (index >= points - 1) {
+            out = calibration->curve[points - 1];
+        } else {
+            int32_t from = calibration->curve[index];
+            int32_t to = calibration->curve[index + 1];
+            out = from + (to - from) * int32_t(position % PWMBase) / int32_t(PWMBase);
+        }
+    }
+    return out > PWMBase ? PWMBase : out;
+}
+
+#if CONFIG_LED_NEUTRAL_CHANNEL
+typedef struct {
+    float x;
+    float y;
+} led_xy_t;
+
+// Planckian locus chromaticity, Kim et al. cubic spline, 1667-25000K
+static led_xy_t led_driver_planck_xy(float kelvin) {
+    float t = kelvin;
+    float x = t <= 4000.0f ? -0.2661239e9f / (t * t * t) - 0.2343589e6f / (t * t) + 0.8776956e3f / t + 0.179910f
+                           : -3.0258469e9f / (t * t * t) + 2.1070379e6f / (t * t) + 0.2226347e3f / t + 0.240390f;
+    float y;
+    if (t <= 2222.0f) {
+        y = -1.1063814f * x * x * x - 1.34811020f * x * x + 2.18555832f * x - 0.20219683f;
+    } else if (t <= 4000.0f) {
+        y = -0.9549476f * x * x * x - 1.37418593f * x * x + 2.09137015f * x - 0.16748867f;
+    } else {
+        y = 3.0817580f * x * x * x - 5.87338670f * x * x + 3.75112997f * x - 0.37001483f;
+    }
+    return { x, y };
+}
+
+// Correlated color temperature, McCamy
+static float led_driver_cct(led_xy_t c) {
+    float n = (c.x - 0.3320f) / (0.1858f - c.y);
+    return 449.0f * n * n * n + 3525.0f * n * n + 6823.3f * n + 5520.33f;
+}
+
+// Distance from the Planckian locus in CIE 1960 uv
+static float led_driver_duv(led_xy_t c) {
+    led_xy_t p = led_driver_planck_xy(led_driver_cct(c));
+    float d = -2.0f * c.x + 12.0f * c.y + 3.0f;
+    float dp = -2.0f * p.x + 12.0f * p.y + 3.0f;
+    return hypotf(4.0f * c.x / d - 4.0f * p.x / dp, 6.0f * c.y / d - 6.0f * p.y / dp);
+}
+
+// Chromaticity of two channels, share is the flux part of a. Chromaticities add weighted by X+Y+Z
+static led_xy_t led_driver_mix_xy(led_xy_t a, led_xy_t b, float share) {
+    float wa = share / a.y;
+    float wb = (1.0f - share) / b.y;
+    return { (wa * a.x + wb * b.x) / (wa + wb), 1.0f / (wa + wb) };
 }
 
+// Flux share of the warmer channel a for the mix at mireds
+static float led_driver_mix_share(led_xy_t a, led_xy_t b, float mireds) {
+    float low = 0.0f;
+    float high = 1.0f;
+    for (int i = 0; i < LED_MIX_ITERATIONS; i++) {
+        float share = (low + high) / 2;
+        if (MATTER_TEMPERATURE_FACTOR / led_driver_cct(led_driver_mix_xy(a, b, share)) < mireds) {
+            low = share;
+        } else {
+            high = share;
+        }
+    }
+    return (low + high) / 2;
+}
+
+// Pick the channel pair with the best lumens per watt within the tint limit at every point,
+// the least tinted one if none is within it. Efficacy is linear-fractional in the channel
+// fluxes, so its optimum along a color temperature is a mix of two channels.
+static void led_driver_solve_mix(const float *channelMireds, led_mix_table_t *table) {
+    led_xy_t xy[LED_CHANNELS];
+    float efficacy[LED_CHANNELS];
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        xy[chan] = led_driver_planck_xy(MATTER_TEMPERATURE_FACTOR / channelMireds[chan]);
+        efficacy[chan] = float(channels[chan].flux) / channels[chan].power;
+    }
+
+    for (int point = 0; point < LED_MIX_POINTS; point++) {
+        float mireds = table->miredsCold + float(table->miredsWarm - table->miredsCold) * point / (LED_MIX_POINTS - 1);
+        float bestEfficacy = 0;
+        float bestDuv = INFINITY;
+        float flux[LED_CHANNELS] = {};
+        for (int a = 0; a < LED_CHANNELS; a++) {
+            for (int b = 0; b < LED_CHANNELS; b++) {
+                if (channelMireds[a] <= channelMireds[b] || mireds > channelMireds[a] || mireds < channelMireds[b]) {
+                    continue;
+                }
+                float share = led_driver_mix_share(xy[a], xy[b], mireds);
+                float duv = led_driver_duv(led_driver_mix_xy(xy[a], xy[b], share));
+                float pairEfficacy = 1.0f / (share / efficacy[a] + (1.0f - share) / efficacy[b]);
+                bool better = duv <= LED_MIX_MAX_DUV ? bestDuv > LED_MIX_MAX_DUV || pairEfficacy > bestEfficacy
+                                                     : bestDuv > LED_MIX_MAX_DUV && duv < bestDuv;
+                if (better) {
+                    bestEfficacy = pairEfficacy;
+                    bestDuv = duv;
+                    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+                        flux[chan] = chan == a ? share : chan == b ? 1.0f - share : 0.0f;
+                    }
+                }
+            }
+        }
+
+        // Full brightness drives the brightest channel at full duty
+        float duty[LED_CHANNELS];
+        float maxDuty = 0;
+        for (int chan = 0; chan < LED_CHANNELS; chan++) {
+            duty[chan] = flux[chan] / channels[chan].flux;
+            maxDuty = duty[chan] > maxDuty ? duty[chan] : maxDuty;
+        }
+        for (int chan = 0; chan < LED_CHANNELS; chan++) {
+            table->duty[point][chan] = maxDuty > 0 ? uint16_t(lroundf(duty[chan] / maxDuty * PWMBase)) : 0;
+        }
+    }
+}
+
+// Channel color temperatures of the table, warm and cold are its ends
+static void led_driver_channel_mireds(uint16_t warm, uint16_t cold, float *channelMireds) {
+    const led_calibration_t *calibration = calibration_get();
+    uint32_t neutralKelvin = CONFIG_COLOR_TEMP_NEUTRAL;
+    if (calibration != nullptr && calibration->channels > LED_CHANNEL_NEUTRAL) {
+        neutralKelvin = calibration->channel[LED_CHANNEL_NEUTRAL].kelvin;
+    }
+    channelMireds[LED_CHANNEL_WARM] = warm;
+    channelMireds[LED_CHANNEL_COLD] = cold;
+    channelMireds[LED_CHANNEL_NEUTRAL] = float(MATTER_TEMPERATURE_FACTOR) / neutralKelvin;
+}
+
+// Interpolate between the solved points. Tristimulus values are linear in the duties, so the
+// chromaticity moves on the straight line between two points, also when they are solved with
+// different channel pairs. The mix then stays within their tint plus the locus curvature over
+// one step, "check mix" verifies it
+static void led_driver_table_duty(const led_mix_table_t *table, uint16_t temperature, uint32_t *duty) {
+    uint32_t span = table->miredsWarm > table->miredsCold ? table->miredsWarm - table->miredsCold : 1;
+    uint32_t offset = temperature > table->miredsCold ? temperature - table->miredsCold : 0;
+    uint32_t position = (offset < span ? offset : span) * (LED_MIX_POINTS - 1);
+    uint32_t index = position / span;
+    uint32_t fraction = position % span;
+    if (index == LED_MIX_POINTS - 1) {
+        index--;
+        fraction = span;
+    }
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        int32_t from = table->duty[index][chan];
+        int32_t to = table->duty[index + 1][chan];
+        duty[chan] = from + (to - from) * int32_t(fraction) / int32_t(span);
+    }
+}
+#else
+// Two channels: the one nearer to the color temperature at full duty, the other one rises to
+// full duty at the middle of the range
+static void led_driver_curve_duty(const led_bounds_t *b, uint16_t temperature, uint32_t *duty) {
+    const uint32_t topMargin = 2;
+    uint32_t miredsNeutral = (b->miredsWarm + b->miredsCold) / 2;
+    uint32_t span = b->miredsWarm > b->miredsCold ? b->miredsWarm - b->miredsCold : 1;
+    uint32_t mireds = temperature < b->miredsCold ? b->miredsCold : temperature > b->miredsWarm ? b->miredsWarm : temperature;
+
+    uint32_t tempCoeff = (mireds - b->miredsCold) * PWMBase / span;
+    if (mireds >= miredsNeutral) {
+        duty[LED_CHANNEL_COLD] = topMargin * (PWMBase - tempCoeff);
+        duty[LED_CHANNEL_WARM] = PWMBase;
+    } else {
+        duty[LED_CHANNEL_WARM] = topMargin * tempCoeff;
+        duty[LED_CHANNEL_COLD] = PWMBase;
+    }
+}
+#endif
+
+static void led_driver_mix(uint8_t brightness, uint16_t temperature, uint32_t *pwm) {
+    const led_bounds_t b = bounds.load();
+    // Full range until the bounds are set
+    uint32_t maxBrightness = b.maxBrightness != 0 ? b.maxBrightness : MATTER_BRIGHTNESS;
+    uint32_t brightnessCoeff = uint32_t(brightness) * PWMBase / maxBrightness * outputLimit / LED_OUTPUT_LIMIT_FULL;
+
+    uint32_t duty[LED_CHANNELS];
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    const led_mix_table_t table = mixTable.load();
+    led_driver_table_duty(&table, temperature, duty);
+#else
+    led_driver_curve_duty(&b, temperature, duty);
+#endif
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        pwm[chan] = led_driver_calibrate(chan, duty[chan] * brightnessCoeff / PWMBase);
+    }
+
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    ESP_LOGD(TAG, "brightness: %u, temp: %u, warmPWM: %lu, coldPWM: %lu, neutralPWM: %lu", brightness, temperature,
+             pwm[LED_CHANNEL_WARM], pwm[LED_CHANNEL_COLD], pwm[LED_CHANNEL_NEUTRAL]);
+#else
+    ESP_LOGD(TAG, "brightness: %u, temp: %u, warmPWM: %lu, coldPWM: %lu", brightness, temperature,
+             pwm[LED_CHANNEL_WARM], pwm[LED_CHANNEL_COLD]);
+#endif
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+// Channel duties at full brightness over the color temperature range with their efficacy
+static esp_err_t led_mix_handler(int argc, char **argv) {
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    const led_mix_table_t table = mixTable.load();
+    const uint32_t warm = table.miredsWarm;
+    const uint32_t cold = table.miredsCold;
+#else
+    const led_bounds_t b = bounds.load();
+    const uint32_t warm = b.miredsWarm;
+    const uint32_t cold = b.miredsCold;
+#endif
+    for (int point = 0; point < LED_MIX_POINTS; point++) {
+        uint32_t mireds = cold + (warm - cold) * point / (LED_MIX_POINTS - 1);
+        uint32_t duty[LED_CHANNELS];
+#if CONFIG_LED_NEUTRAL_CHANNEL
+        led_driver_table_duty(&table, mireds, duty);
+#else
+        led_driver_curve_duty(&b, mireds, duty);
+#endif
+        float flux = 0;
+        float power = 0;
+        printf("%4lu mireds:", mireds);
+        for (int chan = 0; chan < LED_CHANNELS; chan++) {
+            printf(" %4lu", duty[chan]);
+            flux += float(duty[chan]) * channels[chan].flux;
+            power += float(duty[chan]) * channels[chan].power;
+        }
+        printf(", %.1f lm/W\n", power > 0 ? flux * 1000 / power : 0.0f);
+    }
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_LED_NEUTRAL_CHANNEL && CONFIG_LIGHT_SELF_CHECK
+// Chromaticity of channel duties, fluxes add weighted by X+Y+Z
+static led_xy_t led_driver_duty_xy(const led_xy_t *xy, const uint32_t *duty) {
+    float weight = 0;
+    float weightX = 0;
+    float flux = 0;
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        float channelFlux = float(duty[chan]) * channels[chan].flux;
+        weight += channelFlux / xy[chan].y;
+        weightX += channelFlux / xy[chan].y * xy[chan].x;
+        flux += channelFlux;
+    }
+    return { weightX / weight, flux / weight };
+}
+
+// Mixes output between the solved points, at quarters of every table step: tint within that of
+// the two points plus the locus sag, color temperature within a quarter step of the target
+static bool led_driver_mix_check() {
+    const led_mix_table_t table = mixTable.load();
+    float channelMireds[LED_CHANNELS];
+    led_xy_t xy[LED_CHANNELS];
+    led_driver_channel_mireds(table.miredsWarm, table.miredsCold, channelMireds);
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        xy[chan] = led_driver_planck_xy(MATTER_TEMPERATURE_FACTOR / channelMireds[chan]);
+    }
+
+    const uint32_t span = table.miredsWarm - table.miredsCold;
+    // Quarter step, at least the integer mireds rounding
+    const float tolerance = fmaxf(float(span) / (LED_MIX_POINTS - 1) / 4, 1.0f);
+    float worstDuv = 0;
+    float worstError = 0;
+    bool pass = true;
+    for (int point = 0; point < LED_MIX_POINTS - 1; point++) {
+        uint32_t duty[LED_CHANNELS];
+        float pointDuv = 0;
+        for (int side = 0; side < 2; side++) {
+            for (int chan = 0; chan < LED_CHANNELS; chan++) {
+                duty[chan] = table.duty[point + side][chan];
+            }
+            float duv = led_driver_duv(led_driver_duty_xy(xy, duty));
+            pointDuv = duv > pointDuv ? duv : pointDuv;
+        }
+        for (int quarter = 1; quarter < 4; quarter++) {
+            uint32_t mireds = table.miredsCold + span * (4 * point + quarter) / (4 * (LED_MIX_POINTS - 1));
+            led_driver_table_duty(&table, mireds, duty);
+            led_xy_t mix = led_driver_duty_xy(xy, duty);
+            float duv = led_driver_duv(mix);
+            float error = fabsf(MATTER_TEMPERATURE_FACTOR / led_driver_cct(mix) - mireds);
+            if (!(duv <= pointDuv + LED_MIX_SAG && error <= tolerance)) {
+                printf("%4lu mireds: Duv %.4f, points %.4f, off by %.1f mireds\n", mireds, duv, pointDuv, error);
+                pass = false;
+            }
+            worstDuv = duv > worstDuv ? duv : worstDuv;
+            worstError = error > worstError ? error : worstError;
+        }
+    }
+    printf("Between points: Duv max %.4f, limit %.4f, color temperature off by %.1f mireds max\n",
+           worstDuv, LED_MIX_MAX_DUV, worstError);
+    return pass;
+}
+#endif
+
 // Public interface
 
-void led_driver_set_pwm(uint8_t brightness, int16_t temperature) {
-    uint32_t topMargin = 2;
-    uint32_t miredsNeutral = (MiredsWarm + MiredsCold) / 2;
-    
-    uint32_t tempCoeff = (temperature - MiredsCold) * PWMBase / (MiredsWarm - MiredsCold);
-    uint32_t brightnessCoeff = uint32_t(brightness) * PWMBase / uint32_t(MaxBrightness);
-    
-    uint32_t warmPWM;
-    uint32_t coldPWM;
-    
-    if (temperature >= miredsNeutral) {
-        coldPWM = topMargin * (PWMBase - tempCoeff) * brightnessCoeff / PWMBase;
-        warmPWM = brightnessCoeff;
+void led_driver_update(uint32_t fadeTime, int64_t receiveTime) {
+    fade_request_t request = { fadeTime, receiveTime != 0 ? receiveTime : esp_timer_get_time() };
+#if CONFIG_LED_FIXED_LATENCY
+    request.state = light_state_get();
+#endif
+    bool merged = false;
+    portENTER_CRITICAL(&fadeQueueLock);
+    if (fadeQueueCount < FADE_QUEUE_LENGTH) {
+        fadeQueue[(fadeQueueHead + fadeQueueCount) % FADE_QUEUE_LENGTH] = request;
+        fadeQueueCount++;
     } else {
-        warmPWM = topMargin * tempCoeff * brightnessCoeff / PWMBase;
-        coldPWM = brightnessCoeff;
+        fade_request_t *last = &fadeQueue[(fadeQueueHead + FADE_QUEUE_LENGTH - 1) % FADE_QUEUE_LENGTH];
+        led_driver_merge_request(last, request);
+#if CONFIG_LED_FIXED_LATENCY
+        // Output with the newest command, a fixed latency after it
+        last->time = request.time;
+#endif
+        merged = true;
     }
-    
-    ESP_LOGI(TAG, "brightness: %u, temp: %u, warmPWM: %lu, coldPWM: %lu", brightness, temperature, warmPWM, coldPWM);
-    
-    led_driver_queue_pwm(warmPWM, coldPWM);
+    portEXIT_CRITICAL(&fadeQueueLock);
+    xSemaphoreGive(fadeQueueSignal);
+
+    portENTER_CRITICAL(&statsLock);
+    stats.requests++;
+    if (merged) {
+        stats.merged++;
+    }
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void led_driver_get_stats(led_driver_stats_t *out) {
+    portENTER_CRITICAL(&statsLock);
+    *out = stats;
+    portEXIT_CRITICAL(&statsLock);
+    out->outputLimit = outputLimit;
+}
+
+void led_driver_set_output_limit(uint16_t limit) {
+    outputLimit = limit < LED_OUTPUT_LIMIT_FULL ? limit : LED_OUTPUT_LIMIT_FULL;
+}
+
+void led_driver_set_latency_probe(void (*probe)(uint32_t latency)) {
+    latencyProbe = probe;
+}
+
+void led_driver_set_fade_time(uint32_t fadeTime) {
+    fullFadeTime = fadeTime;
+    ESP_LOGI(TAG, "Fade time: %lu ms", fadeTime);
+}
+
+uint32_t led_driver_get_fade_time() {
+    return fullFadeTime;
+}
+
+uint32_t led_driver_get_pwm_frequency() {
+    return pwmFrequency;
+}
+
+esp_err_t led_driver_set_pwm_frequency(uint32_t frequency) {
+#if !CONFIG_LED_SIMULATED
+    // Duty resolution is kept, only the timer divider changes. Fades started later are timed
+    // at the new period
+    esp_err_t err = ledc_set_freq(ledc_timer.speed_mode, ledc_timer.timer_num, frequency);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "PWM frequency %lu Hz not supported: %s", frequency, esp_err_to_name(err));
+        return err;
+    }
+    ledc_timer.freq_hz = frequency;
+#endif
+    pwmFrequency = frequency;
+    ESP_LOGI(TAG, "PWM frequency: %lu Hz", frequency);
+    return ESP_OK;
 }
 
 #if CONFIG_NIGHT_LED_CLUSTER
@@ -136,17 +1064,68 @@ void led_driver_set_night_led(bool on) {
 
 void led_driver_init()
 {
+    calibration_load();
+
+#if CONFIG_LED_SIMULATED
+    led_sim_init();
+#else
     ledc_timer_config(&ledc_timer);
     
-    fadeEventQueue = xQueueCreate(10, sizeof(int32_t)*3);
-    
-    for(int chan = 0; chan < 2; chan++) {
+    for(int chan = 0; chan < LED_CHANNELS; chan++) {
         ledc_channel_config(&ledcChannel[chan]);
     }
+#endif
+
+    fadeQueueSignal = xSemaphoreCreateBinary();
 
-    xTaskCreate(fadeTask, "fadeTask", 2048, nullptr, 15, nullptr);
+    xTaskCreate(fadeTask, "fadeTask", 3072, nullptr, FADE_TASK_PRIORITY, nullptr);
     
+#if !CONFIG_LED_SIMULATED
     ledc_fade_func_install(0);
+#endif
+
+#if CONFIG_ENERGY_METER
+    energy_meter_init(PWMBase);
+#endif
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t mixCommands[] = {
+        {
+            .name = "mix",
+            .description = "Channel duties over the color temperature range. Usage: matter esp light mix",
+            .handler = led_mix_handler,
+        },
+    };
+    light_console_add_commands(mixCommands, sizeof(mixCommands) / sizeof(mixCommands[0]));
+#endif
+#if CONFIG_LED_NEUTRAL_CHANNEL && CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("mix", led_driver_mix_check);
+#endif
+
+#if CONFIG_LED_FIXED_LATENCY && CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t latencyCommands[] = {
+        {
+            .name = "latency",
+            .description = "Fixed command to output latency jitter. Usage: matter esp light latency",
+            .handler = led_latency_handler,
+        },
+    };
+    light_console_add_commands(latencyCommands, sizeof(latencyCommands) / sizeof(latencyCommands[0]));
+#endif
+#if CONFIG_LED_FIXED_LATENCY && CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("latency", led_driver_latency_check);
+#endif
+
+#if CONFIG_LED_SKEW_MEASURE && !CONFIG_LED_SIMULATED && CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "skew",
+            .description = "Measure led channel update skew. Usage: matter esp light skew [count]",
+            .handler = led_skew_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
 
 #if CONFIG_NIGHT_LED_CLUSTER
     // Set pin for output
@@ -158,10 +1137,26 @@ void led_driver_init()
 
 void led_driver_set_bounds(uint16_t warm, uint16_t cold, uint8_t minBrightness, uint8_t maxBrightness)
 {
-    MiredsWarm = warm;
-    MiredsCold = cold;
-    MinBrightness = minBrightness;
-    MaxBrightness = maxBrightness;
+    const led_calibration_t *calibration = calibration_get();
+    if (calibration != nullptr) {
+        // Mix between measured channel color temperatures
+        warm = MATTER_TEMPERATURE_FACTOR / calibration->channel[LED_CHANNEL_WARM].kelvin;
+        cold = MATTER_TEMPERATURE_FACTOR / calibration->channel[LED_CHANNEL_COLD].kelvin;
+    }
+    bounds.store({ warm, cold, minBrightness, maxBrightness });
+
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    // Solved once per bounds, the fade path only interpolates the table
+    float channelMireds[LED_CHANNELS];
+    led_driver_channel_mireds(warm, cold, channelMireds);
+    int64_t start = esp_timer_get_time();
+    led_mix_table_t table = {};
+    table.miredsWarm = warm;
+    table.miredsCold = cold;
+    led_driver_solve_mix(channelMireds, &table);
+    mixTable.store(table);
+    ESP_LOGI(TAG, "Mix table: %d points, %d channels, solved in %lld us", LED_MIX_POINTS, LED_CHANNELS, esp_timer_get_time() - start);
+#endif
     
     ESP_LOGI(TAG, "Brightness min/max: %u/%u", minBrightness, maxBrightness);
     ESP_LOGI(TAG, "Color temp min/max: %u/%u", cold, warm);
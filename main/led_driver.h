@@ -1,14 +1,59 @@
 //
-// Two color led driver
+// Tunable white led driver
 //
 
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+// Fade time proportional to the duty change, led_driver_get_fade_time() for full range
+#define LED_FADE_AUTO UINT32_MAX
+// Retarget the fade in progress keeping its end time, LED_FADE_AUTO if idle
+#define LED_FADE_RETARGET (UINT32_MAX - 1)
+// Output limit scale
+#define LED_OUTPUT_LIMIT_FULL 1000
+
+// Output channels, duty arrays are in this order
+#define LED_CHANNEL_WARM 0
+#define LED_CHANNEL_COLD 1
+#define LED_CHANNEL_NEUTRAL 2
+#if CONFIG_LED_NEUTRAL_CHANNEL
+#define LED_CHANNELS 3
+#else
+#define LED_CHANNELS 2
+#endif
 
 void led_driver_init();
 void led_driver_set_bounds(uint16_t warm, uint16_t cool, uint8_t minBrightness, uint8_t maxBrightness);
-void led_driver_set_pwm(uint8_t brightness, int16_t temperature);
+typedef struct {
+    uint32_t requests;
+    uint32_t outputs;
+    uint32_t coalesced;         // requests merged into a later output
+    uint32_t merged;            // requests merged into the last queued one, fade queue full
+    uint64_t busyTime;          // us spent by the fade task
+    uint16_t outputLimit;       // current limit, LED_OUTPUT_LIMIT_FULL if not derated
+    uint32_t late;              // fixed latency outputs more than 1 ms after their deadline
+    uint32_t jitterMax;         // us, fixed latency output start after its deadline
+    uint64_t jitterSum;
+} led_driver_stats_t;
+
+// Output the current light state, fade time in ms or LED_FADE_AUTO.
+// receiveTime: us the command was received, 0 for now. CONFIG_LED_FIXED_LATENCY outputs at
+// receiveTime + CONFIG_LED_FIXED_LATENCY_MS
+void led_driver_update(uint32_t fadeTime, int64_t receiveTime = 0);
+void led_driver_get_stats(led_driver_stats_t *stats);
+// Scale of the brightness of both channels, color is kept. Applied on the next output
+void led_driver_set_output_limit(uint16_t limit);
+// Called from the fade task with request to output latency in us of every output
+void led_driver_set_latency_probe(void (*probe)(uint32_t latency));
+// Full range fade time in ms, CONFIG_FADE_TIME until set. Applied from the next output
+void led_driver_set_fade_time(uint32_t fadeTime);
+uint32_t led_driver_get_fade_time();
+// Retime the LEDC timer keeping the duty resolution, CONFIG_PWM_FREQUENCY until set
+esp_err_t led_driver_set_pwm_frequency(uint32_t frequency);
+uint32_t led_driver_get_pwm_frequency();
 #if CONFIG_NIGHT_LED_CLUSTER
 void led_driver_set_night_led(bool on);
 #endif
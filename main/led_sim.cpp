@@ -0,0 +1,241 @@
+//
+// Simulated led backend
+//
+// Replaces the LEDC output for load testing on boards without the led driver. Outputs are
+// recorded into a ring, latency from the attribute write to the output start is measured.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "led_sim.h"
+#include "led_driver.h"
+#include "light_console.h"
+
+#if CONFIG_LED_SIMULATED
+
+#define SIM_LOG_ENTRIES 32
+#define SIM_LATENCY_BUCKETS 8
+
+static const char *TAG = "led_sim";
+
+// Upper bounds of latency histogram buckets in us, last one is open
+static const uint32_t bucketBound[SIM_LATENCY_BUCKETS - 1] = { 500, 1000, 2000, 5000, 10000, 20000, 50000 };
+
+typedef struct {
+    int64_t time;               // us
+    uint32_t latency;           // us, 0 if not command driven
+    uint16_t pwm[LED_CHANNELS];
+    uint32_t fadeTime;
+} sim_output_t;
+
+typedef struct {
+    uint32_t commands;
+    uint32_t outputs;
+    uint32_t latencyCount;
+    uint32_t latencyMin;
+    uint32_t latencyMax;
+    uint64_t latencyTotal;
+    uint32_t histogram[SIM_LATENCY_BUCKETS];
+} sim_stats_t;
+
+static sim_output_t outputLog[SIM_LOG_ENTRIES];
+static uint32_t outputIndex;
+static sim_stats_t stats;
+static int64_t commandAt;               // us, first command not yet output, 0 if none
+static portMUX_TYPE simLock = portMUX_INITIALIZER_UNLOCKED;
+
+void led_sim_command() {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&simLock);
+    stats.commands++;
+    if (commandAt == 0) {
+        commandAt = now;
+    }
+    portEXIT_CRITICAL(&simLock);
+}
+
+void led_sim_output(const uint32_t *pwm, uint32_t fadeTime) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&simLock);
+    uint32_t latency = 0;
+    if (commandAt != 0) {
+        latency = uint32_t(now - commandAt);
+        commandAt = 0;
+        int bucket = 0;
+        while (bucket < SIM_LATENCY_BUCKETS - 1 && latency >= bucketBound[bucket]) {
+            bucket++;
+        }
+        stats.histogram[bucket]++;
+        if (stats.latencyCount == 0 || latency < stats.latencyMin) {
+            stats.latencyMin = latency;
+        }
+        if (latency > stats.latencyMax) {
+            stats.latencyMax = latency;
+        }
+        stats.latencyTotal += latency;
+        stats.latencyCount++;
+    }
+    sim_output_t *entry = &outputLog[outputIndex++ % SIM_LOG_ENTRIES];
+    entry->time = now;
+    entry->latency = latency;
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        entry->pwm[chan] = pwm[chan];
+    }
+    entry->fadeTime = fadeTime;
+    stats.outputs++;
+    portEXIT_CRITICAL(&simLock);
+
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    ESP_LOGD(TAG, "warm: %lu, cold: %lu, neutral: %lu, fade: %lu ms, latency: %lu us",
+             pwm[LED_CHANNEL_WARM], pwm[LED_CHANNEL_COLD], pwm[LED_CHANNEL_NEUTRAL], fadeTime, latency);
+#else
+    ESP_LOGD(TAG, "warm: %lu, cold: %lu, fade: %lu ms, latency: %lu us", pwm[LED_CHANNEL_WARM], pwm[LED_CHANNEL_COLD], fadeTime, latency);
+#endif
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static void led_sim_print_stats() {
+    sim_stats_t s;
+    portENTER_CRITICAL(&simLock);
+    s = stats;
+    portEXIT_CRITICAL(&simLock);
+
+    printf("commands: %lu, outputs: %lu\n", s.commands, s.outputs);
+    if (s.latencyCount != 0) {
+        printf("write->output latency min/avg/max: %lu/%llu/%lu us\n\t",
+               s.latencyMin, s.latencyTotal / s.latencyCount, s.latencyMax);
+        for (int bucket = 0; bucket < SIM_LATENCY_BUCKETS; bucket++) {
+            if (bucket < SIM_LATENCY_BUCKETS - 1) {
+                printf("<%lums: %lu ", bucketBound[bucket] / 1000, s.histogram[bucket]);
+            } else {
+                printf(">=%lums: %lu\n", bucketBound[bucket - 1] / 1000, s.histogram[bucket]);
+            }
+        }
+    }
+    printf("heap free: %u, min free: %u, largest block: %u\n",
+           heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+           heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+           heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+}
+
+static void led_sim_print_log() {
+    sim_output_t log[SIM_LOG_ENTRIES];
+    uint32_t index;
+    portENTER_CRITICAL(&simLock);
+    memcpy(log, outputLog, sizeof(log));
+    index = outputIndex;
+    portEXIT_CRITICAL(&simLock);
+
+    uint32_t count = index < SIM_LOG_ENTRIES ? index : SIM_LOG_ENTRIES;
+    for (uint32_t i = index - count; i != index; i++) {
+        const sim_output_t &entry = log[i % SIM_LOG_ENTRIES];
+#if CONFIG_LED_NEUTRAL_CHANNEL
+        printf("%lld ms: warm: %u, cold: %u, neutral: %u, fade: %lu ms, latency: %lu us\n", entry.time / 1000,
+               entry.pwm[LED_CHANNEL_WARM], entry.pwm[LED_CHANNEL_COLD], entry.pwm[LED_CHANNEL_NEUTRAL], entry.fadeTime, entry.latency);
+#else
+        printf("%lld ms: warm: %u, cold: %u, fade: %lu ms, latency: %lu us\n",
+               entry.time / 1000, entry.pwm[LED_CHANNEL_WARM], entry.pwm[LED_CHANNEL_COLD], entry.fadeTime, entry.latency);
+#endif
+    }
+}
+
+#if CONFIG_LED_SKEW_MEASURE
+// Latch model of the LEDC: a channel update takes effect on the timer overflow after its
+// driver call. Sequential updates latch each channel after its own call, batched updates are
+// issued with the timer held and latch together after the last call. callTime emulates the
+// driver call, interrupts and preemption between the calls are real.
+static int64_t led_sim_update_skew(bool batched, int64_t period, int64_t callTime) {
+    int64_t latchedAt[LED_CHANNELS];
+    for (int chan = 0; chan < LED_CHANNELS; chan++) {
+        int64_t calledAt = esp_timer_get_time() + callTime;
+        while (esp_timer_get_time() < calledAt) {
+        }
+        latchedAt[chan] = (esp_timer_get_time() / period + 1) * period;
+    }
+    if (batched) {
+        for (int chan = 0; chan < LED_CHANNELS - 1; chan++) {
+            latchedAt[chan] = latchedAt[LED_CHANNELS - 1];
+        }
+    }
+    return latchedAt[LED_CHANNELS - 1] - latchedAt[0];
+}
+
+// skew [count] [call us]
+static esp_err_t led_sim_skew(int argc, char **argv) {
+    const int count = argc > 0 ? atoi(argv[0]) : 100;
+    const int64_t callTime = argc > 1 ? atoi(argv[1]) : 20;
+    const int64_t period = 1000000 / led_driver_get_pwm_frequency();
+
+    for (int batched = 0; batched < 2; batched++) {
+        int64_t maxSkew = 0;
+        int64_t totalSkew = 0;
+        int split = 0;
+        for (int i = 0; i < count; i++) {
+            int64_t skew = led_sim_update_skew(batched, period, callTime);
+            maxSkew = skew > maxSkew ? skew : maxSkew;
+            totalSkew += skew;
+            split += skew != 0;
+            // Start the next update at a different timer phase
+            vTaskDelay(1);
+        }
+        printf("%s: samples: %d, split: %d, skew avg/max: %lld/%lld us, period: %lld us\n",
+               batched ? "batched" : "sequential", count, split, count ? totalSkew / count : 0, maxSkew, period);
+    }
+    return ESP_OK;
+}
+#endif
+
+static esp_err_t sim_handler(int argc, char **argv) {
+    if (argc == 0) {
+        led_sim_print_stats();
+        return ESP_OK;
+    }
+    if (strcmp(argv[0], "log") == 0) {
+        led_sim_print_log();
+        return ESP_OK;
+    }
+    if (strcmp(argv[0], "reset") == 0) {
+        portENTER_CRITICAL(&simLock);
+        memset(&stats, 0, sizeof(stats));
+        commandAt = 0;
+        portEXIT_CRITICAL(&simLock);
+        return ESP_OK;
+    }
+    printf("Usage: sim [log|reset]\n");
+    return ESP_ERR_INVALID_ARG;
+}
+#endif
+
+void led_sim_init() {
+    ESP_LOGW(TAG, "Simulated led output");
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "sim",
+            .description = "Simulated led output stats. Usage: matter esp light sim [log|reset]",
+            .handler = sim_handler,
+        },
+#if CONFIG_LED_SKEW_MEASURE
+        // Same command as with the LEDC output, skew of the latch model
+        {
+            .name = "skew",
+            .description = "Measure simulated led channel update skew. Usage: matter esp light skew [count] [call us]",
+            .handler = led_sim_skew,
+        },
+#endif
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
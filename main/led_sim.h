@@ -0,0 +1,16 @@
+//
+// Simulated led backend
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#if CONFIG_LED_SIMULATED
+void led_sim_init();
+// Light attribute write received
+void led_sim_command();
+// Output the fade engine would start on the LEDC
+void led_sim_output(const uint32_t *pwm, uint32_t fadeTime);
+#endif
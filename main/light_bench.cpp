@@ -0,0 +1,254 @@
+//
+// Synthetic load generator
+//
+// Feeds app_driver_attribute_update from esp_timer callbacks at a fixed rate, optionally with
+// concurrent button toggles, then reports throughput, command to output latency percentiles,
+// coalesced and merged fade requests and the CPU share of the light path.
+// Only the driver path is measured: commands bypass the data model, and the schedule and the
+// reporting policy are suspended meanwhile, so the data model keeps its values and the
+// schedule is not overridden. The light state is restored afterwards.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_matter.h>
+
+#include "app_priv.h"
+#include "light_driver.h"
+#include "led_driver.h"
+#include "light_state.h"
+#include "light_console.h"
+#include "report_policy.h"
+#include "schedule_engine.h"
+#include "light_bench.h"
+
+#if CONFIG_ENABLE_CHIP_SHELL
+
+using namespace chip::app::Clusters;
+
+#define BENCH_SAMPLES 2048
+#define BENCH_MAX_RATE 10000
+#define BENCH_MAX_SECONDS 600
+
+enum class BenchPattern : short
+{
+    level,
+    cct,
+    scene
+};
+
+static BenchPattern pattern;
+static uint32_t step;
+static uint16_t miredsCold;
+static uint16_t miredsWarm;
+static uint32_t commandCount;
+static uint32_t toggles;
+static uint64_t generatorTime;          // us spent in generator callbacks
+static uint32_t *samples;
+static volatile uint32_t latencySeen;
+
+// Runs in the fade task. Reservoir sampling keeps a uniform sample of all outputs
+static void bench_latency_probe(uint32_t latency) {
+    uint32_t seen = latencySeen++;
+    if (seen < BENCH_SAMPLES) {
+        samples[seen] = latency;
+    } else {
+        uint32_t slot = esp_random() % (seen + 1);
+        if (slot < BENCH_SAMPLES) {
+            samples[slot] = latency;
+        }
+    }
+}
+
+static uint32_t bench_triangle(uint32_t position, uint32_t min, uint32_t max) {
+    uint32_t span = max - min;
+    uint32_t phase = position % (2 * span);
+    return min + (phase < span ? phase : 2 * span - phase);
+}
+
+static void bench_set(uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t val) {
+    app_driver_attribute_update(app_driver_light_endpoint_id(), cluster_id, attribute_id, &val);
+}
+
+// Generator callbacks run in the esp_timer task, one at a time
+static void bench_command(void *arg) {
+    int64_t start = esp_timer_get_time();
+    switch (pattern) {
+    case BenchPattern::level:
+        bench_set(LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                  esp_matter_uint8(bench_triangle(step, 1, MATTER_BRIGHTNESS)));
+        break;
+    case BenchPattern::cct:
+        bench_set(ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                  esp_matter_uint16(bench_triangle(step, miredsCold, miredsWarm)));
+        break;
+    case BenchPattern::scene:
+        // Scene recall: level and color temperature together
+        bench_set(LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                  esp_matter_uint8(1 + esp_random() % MATTER_BRIGHTNESS));
+        bench_set(ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                  esp_matter_uint16(miredsCold + esp_random() % (miredsWarm - miredsCold + 1)));
+        break;
+    }
+    step++;
+    commandCount++;
+    generatorTime += esp_timer_get_time() - start;
+}
+
+static void bench_toggle(void *arg) {
+    int64_t start = esp_timer_get_time();
+    button_toggle_cb();
+    toggles++;
+    generatorTime += esp_timer_get_time() - start;
+}
+
+static int bench_compare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static esp_timer_handle_t bench_start_timer(esp_timer_cb_t callback, const char *name, uint32_t rate) {
+    const esp_timer_create_args_t timerArgs = {
+        .callback = callback,
+        .name = name,
+    };
+    esp_timer_handle_t timer = nullptr;
+    if (esp_timer_create(&timerArgs, &timer) == ESP_OK) {
+        esp_timer_start_periodic(timer, 1000000 / rate);
+    }
+    return timer;
+}
+
+static void bench_stop_timer(esp_timer_handle_t timer) {
+    if (timer != nullptr) {
+        esp_timer_stop(timer);
+        esp_timer_delete(timer);
+    }
+}
+
+// Put the driver back to the state of the unchanged data model
+static void bench_restore(const light_state_t &saved) {
+    if (light_state_get().power != saved.power) {
+        button_toggle_cb();
+    }
+    bench_set(LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id, esp_matter_uint8(saved.brightness));
+    bench_set(ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id, esp_matter_uint16(saved.mireds));
+}
+
+// bench <level|cct|scene> [rate Hz] [seconds] [toggle Hz]
+static esp_err_t bench_handler(int argc, char **argv) {
+    if (argc < 1 || argc > 4) {
+        printf("Usage: bench <level|cct|scene> [rate Hz] [seconds] [toggle Hz]\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strcmp(argv[0], "level") == 0) {
+        pattern = BenchPattern::level;
+    } else if (strcmp(argv[0], "cct") == 0) {
+        pattern = BenchPattern::cct;
+    } else if (strcmp(argv[0], "scene") == 0) {
+        pattern = BenchPattern::scene;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t rate = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100;
+    uint32_t seconds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5;
+    uint32_t toggleRate = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+    if (rate == 0 || rate > BENCH_MAX_RATE || seconds == 0 || seconds > BENCH_MAX_SECONDS || toggleRate > rate) {
+        printf("Rate 1..%d Hz, 1..%d s, toggle rate up to the command rate\n", BENCH_MAX_RATE, BENCH_MAX_SECONDS);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    samples = (uint32_t *)malloc(BENCH_SAMPLES * sizeof(uint32_t));
+    if (samples == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    miredsWarm = REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_WARM, MATTER_TEMPERATURE_FACTOR);
+    miredsCold = REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_COLD, MATTER_TEMPERATURE_FACTOR);
+    step = 0;
+    commandCount = 0;
+    toggles = 0;
+    generatorTime = 0;
+    latencySeen = 0;
+
+    light_state_t saved = light_state_get();
+    led_driver_stats_t before;
+    led_driver_get_stats(&before);
+    // Per-command logging would dominate the measurement
+    esp_log_level_set("light_driver", ESP_LOG_WARN);
+    esp_log_level_set("led_driver", ESP_LOG_WARN);
+    led_driver_set_latency_probe(bench_latency_probe);
+    report_policy_suspend(true);
+#if CONFIG_SCHEDULE_ENGINE
+    schedule_engine_suspend(true);
+#endif
+
+    int64_t begin = esp_timer_get_time();
+    esp_timer_handle_t commandTimer = bench_start_timer(bench_command, "bench", rate);
+    esp_timer_handle_t toggleTimer = toggleRate ? bench_start_timer(bench_toggle, "bench_toggle", toggleRate) : nullptr;
+    vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
+    bench_stop_timer(commandTimer);
+    bench_stop_timer(toggleTimer);
+    int64_t elapsed = esp_timer_get_time() - begin;
+
+    // Let the fade task drain its queue
+    vTaskDelay(pdMS_TO_TICKS(100));
+    led_driver_set_latency_probe(nullptr);
+    led_driver_stats_t after;
+    led_driver_get_stats(&after);
+
+    bench_restore(saved);
+#if CONFIG_SCHEDULE_ENGINE
+    schedule_engine_suspend(false);
+#endif
+    report_policy_suspend(false);
+    esp_log_level_set("light_driver", ESP_LOG_INFO);
+    esp_log_level_set("led_driver", ESP_LOG_INFO);
+
+    uint32_t count = latencySeen < BENCH_SAMPLES ? latencySeen : BENCH_SAMPLES;
+    qsort(samples, count, sizeof(uint32_t), bench_compare);
+    uint32_t outputs = after.outputs - before.outputs;
+    uint64_t busy = after.busyTime - before.busyTime;
+
+    printf("pattern %s, %lu Hz, toggles %lu Hz, %lld ms\n", argv[0], rate, toggleRate, elapsed / 1000);
+    printf("commands: %lu (%llu/s), toggles: %lu, outputs: %lu (%llu/s)\n",
+           commandCount, uint64_t(commandCount) * 1000000 / elapsed, toggles, outputs, uint64_t(outputs) * 1000000 / elapsed);
+    printf("fade requests: %lu, coalesced: %lu, merged: %lu\n",
+           after.requests - before.requests, after.coalesced - before.coalesced, after.merged - before.merged);
+#if CONFIG_LED_FIXED_LATENCY
+    printf("fixed latency jitter avg: %llu us, late: %lu\n",
+           outputs ? (after.jitterSum - before.jitterSum) / outputs : 0, after.late - before.late);
+#endif
+    if (after.outputLimit != LED_OUTPUT_LIMIT_FULL) {
+        printf("output limited to %u.%u%%\n", after.outputLimit / 10, after.outputLimit % 10);
+    }
+    if (count != 0) {
+        printf("command->output latency p50/p90/p99/max: %lu/%lu/%lu/%lu us (%lu samples)\n",
+               samples[count / 2], samples[count * 90 / 100], samples[count * 99 / 100], samples[count - 1], count);
+    }
+    printf("cpu: generator %llu.%llu%%, fade task %llu.%llu%%\n",
+           generatorTime * 100 / elapsed, generatorTime * 1000 / elapsed % 10, busy * 100 / elapsed, busy * 1000 / elapsed % 10);
+
+    free(samples);
+    samples = nullptr;
+    return ESP_OK;
+}
+
+void light_bench_init() {
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "bench",
+            .description = "Synthetic load. Usage: matter esp light bench <level|cct|scene> [rate Hz] [seconds] [toggle Hz]",
+            .handler = bench_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+}
+
+#endif
@@ -0,0 +1,11 @@
+//
+// Synthetic load generator
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+#if CONFIG_ENABLE_CHIP_SHELL
+void light_bench_init();
+#endif
@@ -0,0 +1,162 @@
+//
+// Light driver console commands
+//
+// Modules add their command tables here. The tables are chained in this module and
+// "matter esp light" is the single command set registered with the esp_matter console,
+// its engine holds only a few sets.
+//
+
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_matter_console.h>
+#include "light_console.h"
+
+#if CONFIG_ENABLE_CHIP_SHELL
+
+using namespace esp_matter;
+
+static const char *TAG = "light_console";
+
+typedef struct command_set {
+    const console::command_t *commands;
+    uint8_t count;
+    struct command_set *next;
+} command_set_t;
+
+static command_set_t *commandSets;
+static portMUX_TYPE setsLock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_LIGHT_SELF_CHECK
+typedef struct check_entry {
+    const char *name;
+    light_check_t check;
+    struct check_entry *next;
+} check_entry_t;
+
+static check_entry_t *checks;
+#endif
+
+static void light_console_print_help()
+{
+    for (const command_set_t *set = commandSets; set != nullptr; set = set->next) {
+        for (int i = 0; i < set->count; i++) {
+            printf("\t%-20s %s\n", set->commands[i].name, set->commands[i].description);
+        }
+    }
+}
+
+static esp_err_t light_console_dispatch(int argc, char **argv)
+{
+    if (argc <= 0 || strcmp(argv[0], "help") == 0) {
+        light_console_print_help();
+        return ESP_OK;
+    }
+    for (const command_set_t *set = commandSets; set != nullptr; set = set->next) {
+        for (int i = 0; i < set->count; i++) {
+            if (strcmp(argv[0], set->commands[i].name) == 0) {
+                return set->commands[i].handler(argc - 1, &argv[1]);
+            }
+        }
+    }
+    printf("Unknown light command: %s\n", argv[0]);
+    return ESP_ERR_INVALID_ARG;
+}
+
+// Modules register from their init, driver and main task. Sets are only appended
+void light_console_add_commands(const console::command_t *commands, uint8_t count)
+{
+    command_set_t *set = (command_set_t *)malloc(sizeof(command_set_t));
+    if (set == nullptr) {
+        ESP_LOGE(TAG, "No memory for light commands");
+        return;
+    }
+    set->commands = commands;
+    set->count = count;
+    set->next = nullptr;
+    // Keep registration order in the help
+    portENTER_CRITICAL(&setsLock);
+    command_set_t **last = &commandSets;
+    while (*last != nullptr) {
+        last = &(*last)->next;
+    }
+    *last = set;
+    portEXIT_CRITICAL(&setsLock);
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+// Run all checks or the named one, fixed inputs so results are reproducible
+static esp_err_t light_check_handler(int argc, char **argv)
+{
+    int passed = 0;
+    int failed = 0;
+    for (const check_entry_t *entry = checks; entry != nullptr; entry = entry->next) {
+        if (argc > 0 && strcmp(argv[0], entry->name) != 0) {
+            continue;
+        }
+        printf("%s:\n", entry->name);
+        bool pass = entry->check();
+        printf("%s: %s\n", entry->name, pass ? "PASS" : "FAIL");
+        if (pass) {
+            passed++;
+        } else {
+            failed++;
+        }
+    }
+    if (passed + failed == 0) {
+        printf("Checks:");
+        for (const check_entry_t *entry = checks; entry != nullptr; entry = entry->next) {
+            printf(" %s", entry->name);
+        }
+        printf("\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    printf("%d passed, %d failed\n", passed, failed);
+    return failed == 0 ? ESP_OK : ESP_FAIL;
+}
+
+void light_console_add_check(const char *name, light_check_t check)
+{
+    check_entry_t *entry = (check_entry_t *)malloc(sizeof(check_entry_t));
+    if (entry == nullptr) {
+        ESP_LOGE(TAG, "No memory for light check");
+        return;
+    }
+    entry->name = name;
+    entry->check = check;
+    entry->next = nullptr;
+    portENTER_CRITICAL(&setsLock);
+    check_entry_t **last = &checks;
+    while (*last != nullptr) {
+        last = &(*last)->next;
+    }
+    *last = entry;
+    portEXIT_CRITICAL(&setsLock);
+}
+#endif
+
+void light_console_register_commands()
+{
+#if CONFIG_LIGHT_SELF_CHECK
+    static const console::command_t checkCommands[] = {
+        {
+            .name = "check",
+            .description = "Run built-in driver checks. Usage: matter esp light check [name]",
+            .handler = light_check_handler,
+        },
+    };
+    light_console_add_commands(checkCommands, sizeof(checkCommands) / sizeof(checkCommands[0]));
+#endif
+
+    static const console::command_t command = {
+        .name = "light",
+        .description = "Light driver commands. Usage: matter esp light <command>",
+        .handler = light_console_dispatch,
+    };
+    console::add_commands(&command, 1);
+}
+
+#endif
@@ -0,0 +1,29 @@
+//
+// Light driver console commands
+//
+
+#pragma once
+
+#include <esp_matter_console.h>
+
+#if CONFIG_ENABLE_CHIP_SHELL
+// Add subcommands of "matter esp light", command set must be static
+void light_console_add_commands(const esp_matter::console::command_t *commands, uint8_t count);
+void light_console_register_commands();
+#endif
+
+#if CONFIG_LIGHT_SELF_CHECK
+// Built-in check of driver logic on target, prints its details, true if passed
+typedef bool (*light_check_t)();
+// Add a check run by "matter esp light check [name]", name must be static
+void light_console_add_check(const char *name, light_check_t check);
+
+// Reproducible pseudo random inputs of the checks: xorshift32 from LIGHT_CHECK_SEED
+#define LIGHT_CHECK_SEED 0x2545F491
+static inline uint32_t light_check_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+#endif
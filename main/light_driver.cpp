@@ -3,91 +3,267 @@
 */
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <esp_matter.h>
+#include <platform/PlatformManager.h>
 #include "common_macros.h"
 #include "app_priv.h"
 #include "light_driver.h"
 #include "led_driver.h"
+#include "light_state.h"
+#include "energy_meter.h"
+#include "calibration.h"
+#include "report_policy.h"
+#include "schedule_engine.h"
+#include "driver_tuning.h"
+#include "light_console.h"
 
 using namespace esp_matter;
 using namespace esp_matter::attribute;
 using namespace esp_matter::endpoint;
 using namespace chip::app::Clusters;
 
-static bool currentPowerState = false;
-static uint8_t currentBrightness;
-static uint16_t currentColorTemperature;
 static uint16_t light_endpoint_id;
+// Dim-to-warm: level -> mireds curve, used when CoupleColorTempToLevel option is set
+static std::atomic<bool> coupleColorTemp{false};
+static uint16_t coupleMireds[MATTER_BRIGHTNESS + 1];
+#if CONFIG_ROTARY_ENCODER
+// Encoder step sizes
+#define ENCODER_LEVEL_STEP 2
+#define ENCODER_MIREDS_STEP 4
+#endif
+// Level and color temperature bounds
+static uint16_t boundMiredsWarm;
+static uint16_t boundMiredsCold;
+static uint8_t boundMinBrightness;
+static uint8_t boundMaxBrightness;
 #if CONFIG_NIGHT_LED_CLUSTER
 static uint16_t night_light_endpoint_id;
 #endif
 
 static const char *TAG = "light_driver";
 
-// Set current brightness & color temperature
-static void led_driver_set_current() {
-    if (!currentPowerState) {
+// receiveTime: us, when the command was received, 0 if not a command
+static void app_driver_light_set_power(bool power, int64_t receiveTime)
+{
+    bool changed = light_state_update([power](light_state_t &state) {
+        if (state.power == power) {
+            // Already applied, e.g. local button toggle report
+            return false;
+        }
+        state.power = power;
+        return true;
+    });
+    if (!changed) {
         return;
     }
-    led_driver_set_pwm(currentBrightness, currentColorTemperature);
+    ESP_LOGI(TAG, "LED set power: %d", power);
+    led_driver_update(LED_FADE_AUTO, receiveTime);
 }
 
-static void app_driver_light_set_power(bool power)
+// Bake level -> mireds curve: warmest at min level, coupleMinMireds at max level
+static void app_driver_build_couple_curve(uint16_t miredsWarm, uint16_t coupleMinMireds, uint8_t minBrightness, uint8_t maxBrightness)
 {
-    ESP_LOGI(TAG, "LED set power: %d", power);
-    if (power) {
-        // Power on
-        led_driver_set_pwm(currentBrightness, currentColorTemperature);
-    } else {
-        // Power off
-        led_driver_set_pwm(0, currentColorTemperature);
+    const float gamma = CONFIG_COUPLE_COLOR_TEMP_CURVE / 100.0f;
+    for (int level = 0; level <= MATTER_BRIGHTNESS; level++) {
+        float t = 0;
+        if (level >= maxBrightness) {
+            t = 1;
+        } else if (level > minBrightness) {
+            t = float(level - minBrightness) / float(maxBrightness - minBrightness);
+        }
+        coupleMireds[level] = miredsWarm - uint16_t(lroundf((miredsWarm - coupleMinMireds) * powf(t, gamma)));
     }
-    currentPowerState = power;
 }
 
-static void app_driver_light_set_brightness(uint8_t brightness)
+// Output bounds and everything baked from them
+static void app_driver_light_set_bounds(uint16_t miredsWarm, uint16_t miredsCold, uint16_t coupleMinMireds, uint8_t minBrightness, uint8_t maxBrightness)
+{
+    led_driver_set_bounds(miredsWarm, miredsCold, minBrightness, maxBrightness);
+    boundMiredsWarm = miredsWarm;
+    boundMiredsCold = miredsCold;
+    boundMinBrightness = minBrightness;
+    boundMaxBrightness = maxBrightness;
+    app_driver_build_couple_curve(miredsWarm, coupleMinMireds, minBrightness, maxBrightness);
+}
+
+static void app_driver_light_set_brightness(uint8_t brightness, int64_t receiveTime)
 {
+    uint8_t oldBrightness = 0;
+    bool coupled = false;
+    light_state_t newState;
+    bool changed = light_state_update([&](light_state_t &state) {
+        if (state.brightness == brightness && state.power) {
+            // Already applied, e.g. scheduled level report
+            return false;
+        }
+        oldBrightness = state.brightness;
+        state.brightness = brightness;
+        // Level and coupled temperature go to the same fade
+        coupled = coupleColorTemp && coupleMireds[brightness] != state.mireds;
+        if (coupled) {
+            state.mireds = coupleMireds[brightness];
+        }
+        return true;
+    }, &newState);
+    if (!changed) {
+        return;
+    }
     // int value = REMAP_TO_RANGE(brightness, MATTER_BRIGHTNESS, STANDARD_BRIGHTNESS);
-    ESP_LOGI(TAG, "LED set brightness: %u, old: %u", brightness, currentBrightness);
-    currentBrightness = brightness;
+    ESP_LOGI(TAG, "LED set brightness: %u, old: %u", brightness, oldBrightness);
 
-    led_driver_set_current();
+    if (coupled) {
+        report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                             esp_matter_uint16(newState.mireds), ReportPhase::step);
+    }
+    if (newState.power) {
+        led_driver_update(LED_FADE_AUTO, receiveTime);
+    }
 }
 
-static void app_driver_light_set_temperature(uint16_t mireds)
+static void app_driver_light_set_temperature(uint16_t mireds, int64_t receiveTime)
 {
+    light_state_t newState;
+    bool changed = light_state_update([mireds](light_state_t &state) {
+        if (state.mireds == mireds && state.power) {
+            // Already applied, e.g. coupled temperature report
+            return false;
+        }
+        state.mireds = mireds;
+        return true;
+    }, &newState);
+    if (!changed) {
+        return;
+    }
     uint32_t kelvin = REMAP_TO_RANGE_INVERSE(mireds, STANDARD_TEMPERATURE_FACTOR);
     ESP_LOGI(TAG, "LED set temperature: %ldK, %u", kelvin, mireds);
-    currentColorTemperature = mireds;
-    led_driver_set_current();
+    if (newState.power) {
+        led_driver_update(LED_FADE_AUTO, receiveTime);
+    }
+}
+
+// Time left of a transition run by the driver, in 1/10 s
+static void app_driver_light_report_remaining(uint16_t remaining, ReportPhase phase)
+{
+    report_policy_update(light_endpoint_id, LevelControl::Id, LevelControl::Attributes::RemainingTime::Id,
+                         esp_matter_uint16(remaining), phase);
+    report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::RemainingTime::Id,
+                         esp_matter_uint16(remaining), phase);
+}
+
+// Scheduled change: slow fade, published through the reporting policy
+void app_driver_light_set_scheduled(uint8_t brightness, uint16_t mireds, uint32_t fadeTime)
+{
+    ESP_LOGI(TAG, "LED scheduled brightness: %u, temperature: %u, fade: %lu ms", brightness, mireds, fadeTime);
+    light_state_t newState;
+    light_state_update([brightness, mireds](light_state_t &state) {
+        state.brightness = brightness;
+        state.mireds = mireds;
+        return true;
+    }, &newState);
+    if (newState.power) {
+        led_driver_update(fadeTime);
+    }
+    report_policy_update(light_endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                         esp_matter_uint8(brightness), ReportPhase::step);
+    report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                         esp_matter_uint16(mireds), ReportPhase::step);
+    app_driver_light_report_remaining(fadeTime / 100, ReportPhase::step);
+}
+
+void app_driver_light_end_scheduled()
+{
+    app_driver_light_report_remaining(0, ReportPhase::end);
+}
+
+#if CONFIG_DRIVER_TUNING_CLUSTER
+// Tuned led color temperatures: new physical bounds, the color temperature is kept within them
+static void app_driver_light_set_color_range(uint16_t warmKelvin, uint16_t coldKelvin, int64_t receiveTime)
+{
+    uint16_t miredsWarm = REMAP_TO_RANGE_INVERSE(warmKelvin, MATTER_TEMPERATURE_FACTOR);
+    uint16_t miredsCold = REMAP_TO_RANGE_INVERSE(coldKelvin, MATTER_TEMPERATURE_FACTOR);
+    // Keep the configured couple limit, clamped into the new range
+    uint16_t coupleMinMireds = miredsCold;
+    attribute_t *attribute = attribute::get(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::CoupleColorTempToLevelMinMireds::Id);
+    if (attribute != nullptr) {
+        esp_matter_attr_val_t val = esp_matter_invalid(NULL);
+        attribute::get_val(attribute, &val);
+        coupleMinMireds = val.val.u16 < miredsCold ? miredsCold : val.val.u16 > miredsWarm ? miredsWarm : val.val.u16;
+    }
+    app_driver_light_set_bounds(miredsWarm, miredsCold, coupleMinMireds, boundMinBrightness, boundMaxBrightness);
+    report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTempPhysicalMaxMireds::Id,
+                         esp_matter_uint16(miredsWarm), ReportPhase::end);
+    report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTempPhysicalMinMireds::Id,
+                         esp_matter_uint16(miredsCold), ReportPhase::end);
+    report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::CoupleColorTempToLevelMinMireds::Id,
+                         esp_matter_uint16(coupleMinMireds), ReportPhase::end);
+
+    light_state_t state = light_state_get();
+    uint16_t mireds = state.mireds < miredsCold ? miredsCold : state.mireds > miredsWarm ? miredsWarm : state.mireds;
+    if (mireds != state.mireds) {
+        app_driver_light_set_temperature(mireds, receiveTime);
+        report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                             esp_matter_uint16(mireds), ReportPhase::end);
+    } else if (state.power) {
+        // Same color temperature, new channel mix
+        led_driver_update(LED_FADE_AUTO, receiveTime);
+    }
 }
 
-void app_driver_attribute_update(uint16_t endpoint_id,
-                                 uint32_t cluster_id,
-                                 uint32_t attribute_id,
-                                 esp_matter_attr_val_t *val)
+static esp_err_t app_driver_light_set_tuning(uint32_t attribute_id, esp_matter_attr_val_t *val, int64_t receiveTime)
+{
+    esp_err_t err = driver_tuning_update(attribute_id, val);
+    if (err == ESP_OK && (attribute_id == DRIVER_TUNING_WARM_KELVIN_ID || attribute_id == DRIVER_TUNING_COLD_KELVIN_ID)) {
+        driver_tuning_t tuning = driver_tuning_get();
+        app_driver_light_set_color_range(tuning.warmKelvin, tuning.coldKelvin, receiveTime);
+    }
+    return err;
+}
+#endif
+
+static esp_err_t app_driver_light_attribute_update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val,
+                                                   int64_t receiveTime)
 {
     if (endpoint_id == light_endpoint_id) {
         switch (cluster_id) {
         case OnOff::Id:
             if (attribute_id == OnOff::Attributes::OnOff::Id) {
-                app_driver_light_set_power(val->val.b);
+                app_driver_light_set_power(val->val.b, receiveTime);
             }
             break;
         case LevelControl::Id:
             if (attribute_id == LevelControl::Attributes::CurrentLevel::Id) {
-                app_driver_light_set_brightness(val->val.u8);
+#if CONFIG_SCHEDULE_ENGINE
+                if (val->val.u8 != light_state_get().brightness) {
+                    schedule_engine_override();
+                }
+#endif
+                app_driver_light_set_brightness(val->val.u8, receiveTime);
+            } else if (attribute_id == LevelControl::Attributes::Options::Id) {
+                coupleColorTemp = val->val.u8 & (uint8_t)LevelControl::OptionsBitmap::kCoupleColorTempToLevel;
+                ESP_LOGI(TAG, "Couple color temp to level: %d", coupleColorTemp.load());
             }
             break;
         case ColorControl::Id:
             if (attribute_id == ColorControl::Attributes::ColorTemperatureMireds::Id) {
-                app_driver_light_set_temperature(val->val.u16);
+#if CONFIG_SCHEDULE_ENGINE
+                if (val->val.u16 != light_state_get().mireds) {
+                    schedule_engine_override();
+                }
+#endif
+                app_driver_light_set_temperature(val->val.u16, receiveTime);
             }
             break;
+#if CONFIG_DRIVER_TUNING_CLUSTER
+        case DRIVER_TUNING_CLUSTER_ID:
+            return app_driver_light_set_tuning(attribute_id, val, receiveTime);
+#endif
         }
-        return;
+        return ESP_OK;
     }
 
 #if CONFIG_NIGHT_LED_CLUSTER
@@ -99,11 +275,20 @@ void app_driver_attribute_update(uint16_t endpoint_id,
             }
             break;
         }
-        return;
+        return ESP_OK;
     }
 #endif
+    return ESP_OK;
 }
 
+// Receive time is stamped before any processing, so CONFIG_LED_FIXED_LATENCY output does not depend on it
+esp_err_t app_driver_attribute_update(uint16_t endpoint_id,
+                                      uint32_t cluster_id,
+                                      uint32_t attribute_id,
+                                      esp_matter_attr_val_t *val)
+{
+    return app_driver_light_attribute_update(endpoint_id, cluster_id, attribute_id, val, esp_timer_get_time());
+}
 
 static void app_driver_light_set_defaults(uint16_t endpoint_id)
 {
@@ -135,6 +320,7 @@ static void app_driver_light_set_defaults(uint16_t endpoint_id)
         if (attribute != nullptr) {
             attribute::get_val(attribute, &val);
             ESP_LOGI(TAG, "Options: %u", val.val.u8);
+            coupleColorTemp = val.val.u8 & (uint8_t)LevelControl::OptionsBitmap::kCoupleColorTempToLevel;
         }
         attribute = attribute::get(endpoint_id, LevelControl::Id, LevelControl::Attributes::FeatureMap::Id);
         if (attribute != nullptr) {
@@ -149,13 +335,19 @@ static void app_driver_light_set_defaults(uint16_t endpoint_id)
         attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTempPhysicalMinMireds::Id);
         attribute::get_val(attribute, &val);
         auto miredsCold = val.val.u16;
+        uint16_t coupleMinMireds = miredsCold;
+        attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::CoupleColorTempToLevelMinMireds::Id);
+        if (attribute != nullptr) {
+            attribute::get_val(attribute, &val);
+            coupleMinMireds = val.val.u16;
+        }
         
-        led_driver_set_bounds(miredsWarm, miredsCold, minBrightness, maxBrightness);
+        app_driver_light_set_bounds(miredsWarm, miredsCold, coupleMinMireds, minBrightness, maxBrightness);
         
         attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id);
         attribute::get_val(attribute, &val);
         ESP_LOGI(TAG, "LED set default temperature");
-        app_driver_light_set_temperature(val.val.u16);
+        app_driver_light_set_temperature(val.val.u16, 0);
         break;
     }
     default:
@@ -166,12 +358,12 @@ static void app_driver_light_set_defaults(uint16_t endpoint_id)
     /* Setting power */
     attribute = attribute::get(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id);
     attribute::get_val(attribute, &val);
-    app_driver_light_set_power(val.val.b);
+    app_driver_light_set_power(val.val.b, 0);
 
     /* Setting brightness */
     attribute = attribute::get(endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id);
     attribute::get_val(attribute, &val);
-    app_driver_light_set_brightness(val.val.u8);
+    app_driver_light_set_brightness(val.val.u8, 0);
 }
 
 #if CONFIG_NIGHT_LED_CLUSTER
@@ -190,40 +382,151 @@ static void app_driver_night_led_set_defaults(uint16_t endpoint_id)
 namespace esp_matter::endpoint::color_temperature_light {
 using namespace cluster;
 
+// Light endpoint composition: clusters, features, extra attributes and commands.
+// Tables are constexpr, checked below at compile time and walked at endpoint creation.
+// esp_matter's data model stays dynamic: every entry still allocates its node at creation.
+typedef struct {
+    uint32_t id;
+    cluster_t *(*create)(endpoint_t *endpoint, config_t *config);
+} composition_cluster_t;
+
+typedef struct {
+    uint32_t cluster;
+    uint32_t id;                // feature bit, attribute or command id
+    bool (*create)(cluster_t *cluster, config_t *config);
+} composition_element_t;
+
+static constexpr composition_cluster_t lightClusters[] = {
+    { Descriptor::Id, [](endpoint_t *endpoint, config_t *config) { return descriptor::create(endpoint, &config->descriptor, CLUSTER_FLAG_SERVER); } },
+    { Identify::Id, [](endpoint_t *endpoint, config_t *config) { return identify::create(endpoint, &config->identify, CLUSTER_FLAG_SERVER); } },
+    { Groups::Id, [](endpoint_t *endpoint, config_t *config) { return groups::create(endpoint, &config->groups, CLUSTER_FLAG_SERVER); } },
+    { OnOff::Id, [](endpoint_t *endpoint, config_t *config) { return on_off::create(endpoint, &config->on_off, CLUSTER_FLAG_SERVER); } },
+    { LevelControl::Id, [](endpoint_t *endpoint, config_t *config) { return level_control::create(endpoint, &config->level_control, CLUSTER_FLAG_SERVER); } },
+    { ColorControl::Id, [](endpoint_t *endpoint, config_t *config) { return color_control::create(endpoint, &config->color_control, CLUSTER_FLAG_SERVER); } },
+    { ScenesManagement::Id, [](endpoint_t *endpoint, config_t *config) { return scenes_management::create(endpoint, &config->scenes_management, CLUSTER_FLAG_SERVER); } },
+};
+
+static constexpr composition_element_t lightFeatures[] = {
+    { OnOff::Id, uint32_t(OnOff::Feature::kLighting),
+      [](cluster_t *cluster, config_t *config) { return on_off::feature::lighting::add(cluster, &config->on_off_lighting) == ESP_OK; } },
+    { LevelControl::Id, uint32_t(LevelControl::Feature::kLighting),
+      [](cluster_t *cluster, config_t *config) { return level_control::feature::lighting::add(cluster, &config->level_control_lighting) == ESP_OK; } },
+    { ColorControl::Id, uint32_t(ColorControl::Feature::kColorTemperature),
+      [](cluster_t *cluster, config_t *config) { return color_control::feature::color_temperature::add(cluster, &config->color_control_color_temperature) == ESP_OK; } },
+};
+
+// Attribute and command entries take both ids from the generated type info, so an id can
+// not be listed under another cluster
+template <typename Attribute>
+constexpr composition_element_t composition_attribute(bool (*create)(cluster_t *cluster, config_t *config)) {
+    return { Attribute::GetClusterId(), Attribute::GetAttributeId(), create };
+}
+
+template <typename Command>
+constexpr composition_element_t composition_command(bool (*create)(cluster_t *cluster, config_t *config)) {
+    return { Command::GetClusterId(), Command::GetCommandId(), create };
+}
+
+// Not created by the color temperature feature. MinLevel and MaxLevel come with the level lighting feature
+static constexpr composition_element_t lightAttributes[] = {
+    composition_attribute<ColorControl::Attributes::RemainingTime::TypeInfo>([](cluster_t *cluster, config_t *config) {
+        return color_control::attribute::create_remaining_time(cluster, config->color_control_remaining_time) != nullptr; }),
+};
+
+static constexpr composition_element_t lightCommands[] = {
+    composition_command<Identify::Commands::TriggerEffect::Type>([](cluster_t *cluster, config_t *config) {
+        return identify::command::create_trigger_effect(cluster) != nullptr; }),
+    composition_command<OnOff::Commands::On::Type>([](cluster_t *cluster, config_t *config) {
+        return on_off::command::create_on(cluster) != nullptr; }),
+    composition_command<OnOff::Commands::Toggle::Type>([](cluster_t *cluster, config_t *config) {
+        return on_off::command::create_toggle(cluster) != nullptr; }),
+    composition_command<ColorControl::Commands::StopMoveStep::Type>([](cluster_t *cluster, config_t *config) {
+        return color_control::command::create_stop_move_step(cluster) != nullptr; }),
+    composition_command<ScenesManagement::Commands::CopyScene::Type>([](cluster_t *cluster, config_t *config) {
+        return scenes_management::command::create_copy_scene(cluster) != nullptr; }),
+    composition_command<ScenesManagement::Commands::CopySceneResponse::Type>([](cluster_t *cluster, config_t *config) {
+        return scenes_management::command::create_copy_scene_response(cluster) != nullptr; }),
+};
+
+template <size_t N>
+constexpr bool composition_has_cluster(const composition_cluster_t (&clusters)[N], uint32_t id) {
+    for (size_t i = 0; i < N; i++) {
+        if (clusters[i].id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <size_t N>
+constexpr bool composition_clusters_unique(const composition_cluster_t (&clusters)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            if (clusters[i].id == clusters[j].id) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Every element belongs to a composed cluster and is listed once
+template <size_t N>
+constexpr bool composition_elements_valid(const composition_element_t (&elements)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (!composition_has_cluster(lightClusters, elements[i].cluster)) {
+            return false;
+        }
+        for (size_t j = i + 1; j < N; j++) {
+            if (elements[i].cluster == elements[j].cluster && elements[i].id == elements[j].id) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Global attributes (0xFFF8 and up) are maintained by esp_matter
+template <size_t N>
+constexpr bool composition_attributes_local(const composition_element_t (&attributes)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (attributes[i].id >= 0xFFF8) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(composition_clusters_unique(lightClusters), "Duplicate light cluster");
+static_assert(composition_elements_valid(lightFeatures), "Invalid light feature");
+static_assert(composition_elements_valid(lightAttributes) && composition_attributes_local(lightAttributes), "Invalid light attribute");
+static_assert(composition_elements_valid(lightCommands), "Invalid light command");
+
+template <size_t N>
+static void composition_add(endpoint_t *endpoint, const composition_element_t (&elements)[N], config_t *config) {
+    for (const composition_element_t &element : elements) {
+        cluster_t *cluster = cluster::get(endpoint, element.cluster);
+        if (cluster == nullptr || !element.create(cluster, config)) {
+            ESP_LOGE(TAG, "Failed to add 0x%lx to cluster 0x%lx", element.id, element.cluster);
+        }
+    }
+}
+
 endpoint_t *createTemperatureLight(esp_matter::node_t *node, config_t *config, uint8_t flags, void *priv_data) {
     endpoint_t *endpoint = endpoint::create(node, flags, priv_data);
     assert(endpoint != nullptr && "Failed to create color temperature light endpoint");
 
-    cluster_t *descriptor_cluster = cluster::descriptor::create(endpoint, &(config->descriptor), CLUSTER_FLAG_SERVER);
-    assert(descriptor_cluster != nullptr && "Failed to create descriptor cluster");
-
+    for (const composition_cluster_t &entry : lightClusters) {
+        cluster_t *cluster = entry.create(endpoint, config);
+        assert(cluster != nullptr && "Failed to create light cluster");
+    }
     esp_err_t err = add_device_type(endpoint, get_device_type_id(), get_device_type_version());
     assert(err == ESP_OK && "Failed to add device type");
 
-    cluster_t *identify_cluster = identify::create(endpoint, &(config->identify), CLUSTER_FLAG_SERVER);
-    identify::command::create_trigger_effect(identify_cluster);
-    groups::create(endpoint, &(config->groups), CLUSTER_FLAG_SERVER);
-    cluster_t *on_off_cluster = on_off::create(endpoint, &(config->on_off), CLUSTER_FLAG_SERVER);
-    on_off::feature::lighting::add(on_off_cluster, &(config->on_off_lighting));
-    on_off::command::create_on(on_off_cluster);
-    on_off::command::create_toggle(on_off_cluster);
-    cluster_t *level_control_cluster = level_control::create(endpoint, &(config->level_control), CLUSTER_FLAG_SERVER);
-    // level_control::feature::on_off::add(level_control_cluster);
-    level_control::feature::lighting::add(level_control_cluster, &(config->level_control_lighting));
-    // Add brightness level min/max, if needed
-    if (config->level_control_lighting.min_level != 1 ||
-        config->level_control_lighting.min_level != MATTER_BRIGHTNESS) {
-            attribute::create(level_control_cluster, LevelControl::Attributes::MinLevel::Id, MATTER_ATTRIBUTE_FLAG_READABLE, esp_matter_uint8(config->level_control_lighting.min_level));
-            attribute::create(level_control_cluster, LevelControl::Attributes::MaxLevel::Id, MATTER_ATTRIBUTE_FLAG_READABLE, esp_matter_uint8(config->level_control_lighting.max_level));
-    }
-    cluster_t *color_control_cluster = color_control::create(endpoint, &(config->color_control), CLUSTER_FLAG_SERVER);
-    color_control::feature::color_temperature::add(color_control_cluster, &(config->color_control_color_temperature));
-    color_control::attribute::create_remaining_time(color_control_cluster, config->color_control_remaining_time);
-    color_control::command::create_stop_move_step(color_control_cluster);
-    cluster_t *scenes_management_cluster = scenes_management::create(endpoint, &(config->scenes_management), CLUSTER_FLAG_SERVER);
-    scenes_management::command::create_copy_scene(scenes_management_cluster);
-    scenes_management::command::create_copy_scene_response(scenes_management_cluster);
-
+    // Features first, they create the attributes and commands they require
+    composition_add(endpoint, lightFeatures, config);
+    composition_add(endpoint, lightAttributes, config);
+    composition_add(endpoint, lightCommands, config);
     return endpoint;
 }
 }
@@ -233,7 +536,12 @@ void app_driver_create_endpoints(esp_matter::node_t *node) {
     color_temperature_light::config_t light_config;
     light_config.on_off.on_off = DEFAULT_POWER;
     light_config.on_off_lighting.start_up_on_off = nullptr;
+#if CONFIG_DRIVER_TUNING_CLUSTER
+    const driver_tuning_t tuning = driver_tuning_get();
+    light_config.level_control.current_level = tuning.defaultBrightness;
+#else
     light_config.level_control.current_level = CONFIG_DEFAULT_BRIGHTNESS;
+#endif
     light_config.level_control.on_level = nullptr;
     light_config.level_control_lighting.start_up_current_level = nullptr;
     light_config.level_control_lighting.min_level = 1;
@@ -242,16 +550,32 @@ void app_driver_create_endpoints(esp_matter::node_t *node) {
     light_config.color_control.color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
     light_config.color_control.enhanced_color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
     
-    light_config.color_control_color_temperature.color_temp_physical_max_mireds = REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_WARM, MATTER_TEMPERATURE_FACTOR);
-    light_config.color_control_color_temperature.color_temp_physical_min_mireds = REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_COLD, MATTER_TEMPERATURE_FACTOR);
-    light_config.color_control_color_temperature.couple_color_temp_to_level_min_mireds = REMAP_TO_RANGE_INVERSE(CONFIG_COLOR_TEMP_COLD, MATTER_TEMPERATURE_FACTOR);
+    // Physical bounds: measured color temperatures of the unit, if calibrated
+#if CONFIG_DRIVER_TUNING_CLUSTER
+    uint32_t warmKelvin = tuning.warmKelvin;
+    uint32_t coldKelvin = tuning.coldKelvin;
+#else
+    uint32_t warmKelvin = CONFIG_COLOR_TEMP_WARM;
+    uint32_t coldKelvin = CONFIG_COLOR_TEMP_COLD;
+#endif
+    const led_calibration_t *calibration = calibration_get();
+    if (calibration != nullptr) {
+        warmKelvin = calibration->channel[LED_CHANNEL_WARM].kelvin;
+        coldKelvin = calibration->channel[LED_CHANNEL_COLD].kelvin;
+    }
+    light_config.color_control_color_temperature.color_temp_physical_max_mireds = REMAP_TO_RANGE_INVERSE(warmKelvin, MATTER_TEMPERATURE_FACTOR);
+    light_config.color_control_color_temperature.color_temp_physical_min_mireds = REMAP_TO_RANGE_INVERSE(coldKelvin, MATTER_TEMPERATURE_FACTOR);
+    light_config.color_control_color_temperature.couple_color_temp_to_level_min_mireds = REMAP_TO_RANGE_INVERSE(coldKelvin, MATTER_TEMPERATURE_FACTOR);
     light_config.color_control_color_temperature.start_up_color_temperature_mireds = nullptr;
 
     // endpoint handles can be used to add/modify clusters.
+    size_t freeHeap = esp_get_free_heap_size();
+    int64_t start = esp_timer_get_time();
     endpoint_t *endpoint = color_temperature_light::createTemperatureLight(node, &light_config, ENDPOINT_FLAG_NONE, nullptr);
     
     light_endpoint_id = endpoint::get_id(endpoint);
-    ESP_LOGI(TAG, "Light created with endpoint_id %d", light_endpoint_id);
+    ESP_LOGI(TAG, "Light created with endpoint_id %d in %lld us, heap: %u bytes", light_endpoint_id,
+             esp_timer_get_time() - start, freeHeap - esp_get_free_heap_size());
     
     // Mark deferred persistence for some attributes that might be changed rapidly
     cluster_t *level_control_cluster = cluster::get(endpoint, LevelControl::Id);
@@ -262,6 +586,13 @@ void app_driver_create_endpoints(esp_matter::node_t *node) {
     cluster_t *color_control_cluster = cluster::get(endpoint, ColorControl::Id);
     attribute_t *color_temp_attribute = attribute::get(color_control_cluster, ColorControl::Attributes::ColorTemperatureMireds::Id);
     attribute::set_deferred_persistence(color_temp_attribute);
+
+#if CONFIG_ENERGY_METER
+    energy_meter_create_cluster(endpoint);
+#endif
+#if CONFIG_DRIVER_TUNING_CLUSTER
+    driver_tuning_create_cluster(endpoint);
+#endif
     
 #if CONFIG_NIGHT_LED_CLUSTER
     esp_matter::endpoint::on_off_light::config_t night_light_config;
@@ -274,6 +605,10 @@ void app_driver_create_endpoints(esp_matter::node_t *node) {
 #endif
 }
 
+uint16_t app_driver_light_endpoint_id() {
+    return light_endpoint_id;
+}
+
 /* Starting driver with default values */
 void app_driver_restore_matter_state() {
     app_driver_light_set_defaults(light_endpoint_id);
@@ -283,28 +618,95 @@ void app_driver_restore_matter_state() {
 }
 
 // Button toggle callback
+// Output is switched right away, data model update is deferred to the Matter task,
+// so local control does not wait for the Matter stack lock, e.g. while offline
 void button_toggle_cb()
 {
-    uint16_t endpoint_id = light_endpoint_id;
-    uint32_t cluster_id = OnOff::Id;
-    uint32_t attribute_id = OnOff::Attributes::OnOff::Id;
+    light_state_t newState;
+    light_state_update([](light_state_t &state) {
+        state.power = !state.power;
+        return true;
+    }, &newState);
+    ESP_LOGI(TAG, "LED toggle power: %d", newState.power);
+    led_driver_update(LED_FADE_AUTO);
+    report_policy_update(light_endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id, esp_matter_bool(newState.power), ReportPhase::end);
+}
 
-    attribute_t *attribute = attribute::get(endpoint_id, cluster_id, attribute_id);
+#if CONFIG_ROTARY_ENCODER
+// Encoder turn callback
+// Runs in the sampling timer: the output follows the knob right away, the data model gets
+// throttled step reports while turning and the final values once the knob stops
+void encoder_turn_cb(int32_t steps, bool temperature)
+{
+    light_state_t newState;
+    if (steps == 0) {
+        newState = light_state_get();
+        report_policy_update(light_endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                             esp_matter_uint8(newState.brightness), ReportPhase::end);
+        report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                             esp_matter_uint16(newState.mireds), ReportPhase::end);
+        return;
+    }
 
-    esp_matter_attr_val_t val = esp_matter_invalid(NULL);
-    attribute::get_val(attribute, &val);
-    val.val.b = !val.val.b;
-    attribute::update(endpoint_id, cluster_id, attribute_id, &val);
+    bool coupled = false;
+    bool changed = light_state_update([&](light_state_t &state) {
+        if (!state.power) {
+            return false;
+        }
+        if (temperature) {
+            // Clockwise is cooler
+            int32_t mireds = int32_t(state.mireds) - steps * ENCODER_MIREDS_STEP;
+            mireds = mireds < boundMiredsCold ? boundMiredsCold : mireds > boundMiredsWarm ? boundMiredsWarm : mireds;
+            if (mireds == state.mireds) {
+                return false;
+            }
+            state.mireds = mireds;
+            return true;
+        }
+        int32_t brightness = int32_t(state.brightness) + steps * ENCODER_LEVEL_STEP;
+        brightness = brightness < boundMinBrightness ? boundMinBrightness : brightness > boundMaxBrightness ? boundMaxBrightness : brightness;
+        if (brightness == state.brightness) {
+            return false;
+        }
+        state.brightness = brightness;
+        coupled = coupleColorTemp && coupleMireds[brightness] != state.mireds;
+        if (coupled) {
+            state.mireds = coupleMireds[brightness];
+        }
+        return true;
+    }, &newState);
+    if (!changed) {
+        return;
+    }
+#if CONFIG_SCHEDULE_ENGINE
+    schedule_engine_override();
+#endif
+    led_driver_update(LED_FADE_AUTO);
+    if (!temperature) {
+        report_policy_update(light_endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                             esp_matter_uint8(newState.brightness), ReportPhase::step);
+    }
+    if (temperature || coupled) {
+        report_policy_update(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                             esp_matter_uint16(newState.mireds), ReportPhase::step);
+    }
 }
+#endif
 
 // Print hardware config
 static void printHardwareConfig() {
     ESP_LOGI(TAG, "Warm led pin: %i", CONFIG_LED_WARM_GPIO);
     ESP_LOGI(TAG, "Cold led pin: %i", CONFIG_LED_COLD_GPIO);
+#if CONFIG_LED_NEUTRAL_CHANNEL
+    ESP_LOGI(TAG, "Neutral led pin: %i", CONFIG_LED_NEUTRAL_GPIO);
+#endif
 #if CONFIG_NIGHT_LED_CLUSTER
     ESP_LOGI(TAG, "Night led pin: %i", CONFIG_NIGHT_LED_GPIO);
 #endif
     ESP_LOGI(TAG, "Button pin: %i", CONFIG_BUTTON_GPIO);
+#if CONFIG_ROTARY_ENCODER && !CONFIG_ENCODER_SIMULATED
+    ESP_LOGI(TAG, "Encoder pins: %i/%i", CONFIG_ENCODER_A_GPIO, CONFIG_ENCODER_B_GPIO);
+#endif
 #if CONFIG_INDICATOR_LED_INVERT
     ESP_LOGI(TAG, "Indicator led pin: %i (inverted)", CONFIG_INDICATOR_LED_GPIO);
 #else
@@ -315,4 +717,10 @@ static void printHardwareConfig() {
 void app_driver_init() {
     printHardwareConfig();
     led_driver_init();
+#if CONFIG_DRIVER_TUNING_CLUSTER
+    driver_tuning_init();
+#endif
+#if CONFIG_LIGHT_SELF_CHECK
+    light_console_add_check("seqlock", light_state_check);
+#endif
 }
@@ -2,6 +2,8 @@
 // Matter Light driver definitions
 //
 
+#pragma once
+
 /** Standard max values (used for remapping attributes) */
 #define STANDARD_BRIGHTNESS 255
 #define STANDARD_TEMPERATURE_FACTOR 1000000
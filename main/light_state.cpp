@@ -0,0 +1,240 @@
+//
+// Shared light state
+//
+
+#include <esp_timer.h>
+#include <stdio.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "light_state.h"
+
+// mireds: bits 0-15, brightness: 16-23, power: 24, version: 25-31
+static std::atomic<uint32_t> lightState{0};
+
+static uint32_t light_state_pack(const light_state_t &state) {
+    return uint32_t(state.mireds) | uint32_t(state.brightness) << 16 | uint32_t(state.power) << 24 | uint32_t(state.version & 0x7f) << 25;
+}
+
+static light_state_t light_state_unpack(uint32_t packed) {
+    light_state_t state;
+    state.mireds = packed & 0xffff;
+    state.brightness = (packed >> 16) & 0xff;
+    state.power = (packed >> 24) & 1;
+    state.version = packed >> 25;
+    return state;
+}
+
+light_state_t light_state_get() {
+    return light_state_unpack(lightState.load(std::memory_order_acquire));
+}
+
+bool light_state_compare_exchange(light_state_t &expected, const light_state_t &desired) {
+    uint32_t packed = light_state_pack(expected);
+    if (lightState.compare_exchange_strong(packed, light_state_pack(desired), std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return true;
+    }
+    expected = light_state_unpack(packed);
+    return false;
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+#define CHECK_WORDS 6
+#define CHECK_WRITERS 2
+#define CHECK_READERS 2
+#define CHECK_TIME 500000               // us
+#define CHECK_READER_PRIORITY (configMAX_PRIORITIES - 3)
+#define CHECK_MAX_LOAD 100              // us, one copy with interrupts
+
+// Every word is derived from the first one, a torn copy mixes words of different writes
+typedef struct {
+    uint32_t word[CHECK_WORDS];
+} check_value_t;
+
+typedef struct {
+    SeqLock<check_value_t> value;
+    int64_t deadline;                   // us
+    std::atomic<int> nextWriter;
+    std::atomic<uint32_t> lastWrite[CHECK_WRITERS];
+    std::atomic<uint32_t> writes;
+    std::atomic<uint32_t> reads;
+    std::atomic<uint32_t> changes;
+    std::atomic<uint32_t> torn;
+    std::atomic<bool> inStore;
+    std::atomic<uint32_t> preempted;
+    std::atomic<uint32_t> maxLoad;
+    SemaphoreHandle_t done;
+} check_context_t;
+
+static check_value_t light_state_check_value(uint32_t n) {
+    check_value_t value;
+    for (int i = 0; i < CHECK_WORDS; i++) {
+        value.word[i] = n * (2 * i + 1) ^ (uint32_t(i) << 24);
+    }
+    return value;
+}
+
+static void checkWriterTask(void *pvParameters) {
+    check_context_t *context = (check_context_t *)pvParameters;
+    uint32_t writer = context->nextWriter.fetch_add(1);
+    uint32_t n = writer;
+    uint32_t writes = 0;
+    while (esp_timer_get_time() < context->deadline) {
+        n += CHECK_WRITERS;
+        context->value.store(light_state_check_value(n));
+        writes++;
+    }
+    context->lastWrite[writer] = n;
+    context->writes += writes;
+    xSemaphoreGive(context->done);
+    vTaskDelete(nullptr);
+}
+
+static void checkReaderTask(void *pvParameters) {
+    check_context_t *context = (check_context_t *)pvParameters;
+    uint32_t last = 0;
+    uint32_t reads = 0;
+    uint32_t changes = 0;
+    uint32_t torn = 0;
+    while (esp_timer_get_time() < context->deadline) {
+        check_value_t value = context->value.load();
+        check_value_t expected = light_state_check_value(value.word[0]);
+        if (memcmp(&value, &expected, sizeof(value)) != 0) {
+            torn++;
+        }
+        if (value.word[0] != last) {
+            changes++;
+            last = value.word[0];
+        }
+        reads++;
+    }
+    context->reads += reads;
+    context->changes += changes;
+    context->torn += torn;
+    xSemaphoreGive(context->done);
+    vTaskDelete(nullptr);
+}
+
+// Low priority writer that is nearly always inside store()
+static void checkPreemptedWriterTask(void *pvParameters) {
+    check_context_t *context = (check_context_t *)pvParameters;
+    uint32_t n = 0;
+    uint32_t writes = 0;
+    while (esp_timer_get_time() < context->deadline) {
+        n++;
+        context->inStore = true;
+        context->value.store(light_state_check_value(n));
+        context->inStore = false;
+        writes++;
+    }
+    context->lastWrite[0] = n;
+    context->writes += writes;
+    xSemaphoreGive(context->done);
+    vTaskDelete(nullptr);
+}
+
+// High priority reader waking every tick on the writer's core, like fadeTask. A load that
+// waits for the preempted writer never returns
+static void checkPreemptingReaderTask(void *pvParameters) {
+    check_context_t *context = (check_context_t *)pvParameters;
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    while (esp_timer_get_time() < context->deadline) {
+        vTaskDelay(1);
+        bool preempted = context->inStore;
+        int64_t start = esp_timer_get_time();
+        check_value_t value = context->value.load();
+        uint32_t time = esp_timer_get_time() - start;
+        check_value_t expected = light_state_check_value(value.word[0]);
+        if (memcmp(&value, &expected, sizeof(value)) != 0) {
+            torn++;
+        }
+        if (preempted) {
+            context->preempted++;
+        }
+        if (time > context->maxLoad) {
+            context->maxLoad = time;
+        }
+        reads++;
+    }
+    context->reads += reads;
+    context->torn += torn;
+    xSemaphoreGive(context->done);
+    vTaskDelete(nullptr);
+}
+
+static bool light_state_check_wait(check_context_t &context, int tasks) {
+    int finished = 0;
+    while (finished < tasks && xSemaphoreTake(context.done, pdMS_TO_TICKS(10000)) == pdTRUE) {
+        finished++;
+    }
+    if (finished < tasks) {
+        printf("check tasks did not finish\n");
+        return false;
+    }
+    return true;
+}
+
+static void light_state_check_reset(check_context_t &context) {
+    context.value.store(light_state_check_value(0));
+    context.nextWriter = 0;
+    context.writes = 0;
+    context.reads = 0;
+    context.changes = 0;
+    context.torn = 0;
+    context.inStore = false;
+    context.preempted = 0;
+    context.maxLoad = 0;
+    context.deadline = esp_timer_get_time() + CHECK_TIME;
+}
+
+// Writers and readers of one SeqLock busy on both cores, no copy may be torn. Then a high
+// priority reader on the core of a low priority writer must not wait for it. Busy tasks run
+// at idle priority and are time sliced with the idle tasks, so the watchdog is fed
+bool light_state_check() {
+    // Static, tasks left behind by a timeout must not use a dead stack
+    static check_context_t context;
+    if (context.done == nullptr) {
+        context.done = xSemaphoreCreateCounting(CHECK_WRITERS + CHECK_READERS, 0);
+    }
+    light_state_check_reset(context);
+    for (int i = 0; i < CHECK_WRITERS; i++) {
+        xTaskCreatePinnedToCore(checkWriterTask, "checkWriter", 2048, &context, tskIDLE_PRIORITY, nullptr, i % portNUM_PROCESSORS);
+    }
+    for (int i = 0; i < CHECK_READERS; i++) {
+        xTaskCreatePinnedToCore(checkReaderTask, "checkReader", 2048, &context, tskIDLE_PRIORITY, nullptr, (i + 1) % portNUM_PROCESSORS);
+    }
+    if (!light_state_check_wait(context, CHECK_WRITERS + CHECK_READERS)) {
+        return false;
+    }
+
+    // The last write of one of the writers is kept
+    check_value_t value = context.value.load();
+    bool last = false;
+    for (int writer = 0; writer < CHECK_WRITERS; writer++) {
+        check_value_t expected = light_state_check_value(context.lastWrite[writer]);
+        last = last || memcmp(&value, &expected, sizeof(value)) == 0;
+    }
+    printf("%d writers, %d readers, %d ms: writes %lu, reads %lu, changes seen %lu, torn %lu, final %s\n",
+           CHECK_WRITERS, CHECK_READERS, CHECK_TIME / 1000, uint32_t(context.writes), uint32_t(context.reads),
+           uint32_t(context.changes), uint32_t(context.torn), last ? "ok" : "wrong");
+    bool ok = context.torn == 0 && context.changes > 0 && last;
+
+    // A reader preempting the writer on one core, as fadeTask preempts a bounds update
+    light_state_check_reset(context);
+    xTaskCreatePinnedToCore(checkPreemptedWriterTask, "checkWriter", 2048, &context, tskIDLE_PRIORITY, nullptr, 0);
+    xTaskCreatePinnedToCore(checkPreemptingReaderTask, "checkReader", 2048, &context, CHECK_READER_PRIORITY, nullptr, 0);
+    if (!light_state_check_wait(context, 2)) {
+        return false;
+    }
+    value = context.value.load();
+    check_value_t expected = light_state_check_value(context.lastWrite[0]);
+    last = memcmp(&value, &expected, sizeof(value)) == 0;
+    printf("preempted writer, %d ms: writes %lu, reads %lu, during a write %lu, torn %lu, max load %lu us, final %s\n",
+           CHECK_TIME / 1000, uint32_t(context.writes), uint32_t(context.reads), uint32_t(context.preempted),
+           uint32_t(context.torn), uint32_t(context.maxLoad), last ? "ok" : "wrong");
+    return ok && context.torn == 0 && context.preempted > 0 && context.maxLoad <= CHECK_MAX_LOAD && last;
+}
+#endif
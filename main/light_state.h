@@ -0,0 +1,117 @@
+//
+// Shared light state
+//
+// Power, level and color temperature are packed into one atomic word with a short version,
+// writers update it with compare-and-swap and never block, readers get a consistent tuple.
+// Rarely changed multi-word data (bounds) is kept in a double buffered seqlock.
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef struct {
+    bool power;
+    uint8_t brightness;
+    uint16_t mireds;
+    uint8_t version;            // incremented on every update, wraps at 128
+} light_state_t;
+
+light_state_t light_state_get();
+// Store desired if the state is still expected, expected is reloaded otherwise
+bool light_state_compare_exchange(light_state_t &expected, const light_state_t &desired);
+
+// Lock-free read-modify-write. update() gets the current state by reference and returns false
+// to leave it unchanged, it may be called more than once under contention.
+template <typename Update>
+bool light_state_update(Update update, light_state_t *result = nullptr) {
+    light_state_t expected = light_state_get();
+    light_state_t desired;
+    do {
+        desired = expected;
+        if (!update(desired)) {
+            if (result != nullptr) {
+                *result = expected;
+            }
+            return false;
+        }
+        desired.version = (expected.version + 1) & 0x7f;
+    } while (!light_state_compare_exchange(expected, desired));
+    if (result != nullptr) {
+        *result = desired;
+    }
+    return true;
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+// Stress of a SeqLock by writers and readers on both cores, then a high priority reader
+// preempting a writer on one core, for "light check seqlock"
+bool light_state_check();
+#endif
+
+// Double buffered sequence lock for small trivially copyable values. A writer fills the slot
+// readers are not directed to and then publishes it, so a reader that preempts a writer on
+// its core copies the published slot and never waits for the writer. A reader retries only
+// when it was preempted itself for two writes. Data words are relaxed atomics so concurrent
+// copies are well defined. Writers are serialised, one finding another mid-write yields for
+// a tick after a few spins so a lower priority writer on its core can finish.
+template <typename T>
+class SeqLock {
+public:
+    T load() const {
+        uint32_t copy[Words];
+        for (;;) {
+            const Slot &slot = slots[current.load(std::memory_order_acquire)];
+            uint32_t start = slot.sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < Words; i++) {
+                copy[i] = slot.data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((start & 1) == 0 && slot.sequence.load(std::memory_order_relaxed) == start) {
+                break;
+            }
+        }
+        T value;
+        memcpy(&value, copy, sizeof(T));
+        return value;
+    }
+
+    void store(const T &value) {
+        uint32_t copy[Words] = {};
+        memcpy(copy, &value, sizeof(T));
+        for (int spins = 0; writing.exchange(true, std::memory_order_acquire); spins++) {
+            if (spins == WriterSpins) {
+                vTaskDelay(1);
+                spins = 0;
+            }
+        }
+        uint32_t index = current.load(std::memory_order_relaxed) ^ 1;
+        Slot &slot = slots[index];
+        uint32_t start = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < Words; i++) {
+            slot.data[i].store(copy[i], std::memory_order_relaxed);
+        }
+        slot.sequence.store(start + 2, std::memory_order_release);
+        current.store(index, std::memory_order_release);
+        writing.store(false, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t Words = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    static constexpr int WriterSpins = 100;
+    struct Slot {
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint32_t> data[Words] = {};
+    };
+    Slot slots[2];
+    std::atomic<uint32_t> current{0};
+    std::atomic<bool> writing{false};
+};
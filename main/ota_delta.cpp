@@ -0,0 +1,68 @@
+//
+// Full images with delta OTA enabled
+//
+// With CONFIG_ENABLE_DELTA_OTA the Matter OTA image processor feeds every block to the
+// patcher (linker --wrap, see CMakeLists.txt). A download starting with the app image
+// magic is a full image, not a patch: its blocks are passed to the processor's merged
+// stream callback as they are, the way patched output is, and the empty patch is not
+// finalized. The image is verified by esp_ota_end in both cases.
+//
+
+#include <esp_log.h>
+#include <esp_app_format.h>
+
+#include "ota_pipeline.h"
+
+#if CONFIG_ENABLE_DELTA_OTA
+#include <esp_delta_ota.h>
+
+static const char *TAG = "ota_delta";
+
+typedef enum {
+    OTA_IMAGE_UNKNOWN,
+    OTA_IMAGE_PATCH,
+    OTA_IMAGE_FULL,
+} ota_image_kind_t;
+
+// Download in progress, set on the Matter thread
+static esp_delta_ota_cfg_t deltaConfig;
+static ota_image_kind_t imageKind;
+
+extern "C" {
+esp_delta_ota_handle_t __real_esp_delta_ota_init(esp_delta_ota_cfg_t *cfg);
+esp_err_t __real_esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size);
+esp_err_t __real_esp_delta_ota_finalize(esp_delta_ota_handle_t handle);
+}
+
+extern "C" esp_delta_ota_handle_t __wrap_esp_delta_ota_init(esp_delta_ota_cfg_t *cfg) {
+    deltaConfig = *cfg;
+    imageKind = OTA_IMAGE_UNKNOWN;
+    return __real_esp_delta_ota_init(cfg);
+}
+
+extern "C" esp_err_t __wrap_esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size) {
+    if (size <= 0) {
+        return __real_esp_delta_ota_feed_patch(handle, buf, size);
+    }
+    if (imageKind == OTA_IMAGE_UNKNOWN) {
+        imageKind = buf[0] == ESP_IMAGE_HEADER_MAGIC ? OTA_IMAGE_FULL : OTA_IMAGE_PATCH;
+        ESP_LOGI(TAG, "%s image", imageKind == OTA_IMAGE_FULL ? "Full" : "Delta");
+    }
+    if (imageKind == OTA_IMAGE_FULL) {
+        return deltaConfig.write_cb(buf, size, deltaConfig.user_data);
+    }
+#if CONFIG_OTA_PIPELINED_WRITE
+    return ota_pipeline_feed_patch(handle, buf, size);
+#else
+    return __real_esp_delta_ota_feed_patch(handle, buf, size);
+#endif
+}
+
+extern "C" esp_err_t __wrap_esp_delta_ota_finalize(esp_delta_ota_handle_t handle) {
+    if (imageKind == OTA_IMAGE_FULL) {
+        return ESP_OK;
+    }
+    return __real_esp_delta_ota_finalize(handle);
+}
+
+#endif
@@ -0,0 +1,399 @@
+//
+// Pipelined OTA image write path
+//
+// esp_ota_write calls made by the Matter OTA image processor are redirected here
+// (linker --wrap, see CMakeLists.txt). Incoming blocks are collected into one of two
+// sector-sized buffers, while the other one is erased and written to the inactive
+// slot by otaWriterTask, so the BDX transfer is not stalled by flash operations.
+// An aborted download drops the collected data. "matter esp light check ota" compares
+// the throughput with direct slot writes on the target flash.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#if CONFIG_ENABLE_ENCRYPTED_OTA
+#include <esp_encrypted_img.h>
+#endif
+#if CONFIG_ENABLE_DELTA_OTA
+#include <esp_delta_ota.h>
+#endif
+
+#include <common_macros.h>
+#include "light_console.h"
+#include "ota_pipeline.h"
+
+#if CONFIG_OTA_PIPELINED_WRITE
+
+#define OTA_BUFFER_COUNT 2
+#define OTA_FLUSH_MARKER -1
+
+static const char *TAG = "ota_pipeline";
+
+typedef struct {
+    int index;
+    size_t length;
+} ota_block_t;
+
+static uint8_t otaBuffer[OTA_BUFFER_COUNT][CONFIG_OTA_WRITE_BUFFER_SIZE];
+static QueueHandle_t freeQueue;
+static QueueHandle_t writeQueue;
+static SemaphoreHandle_t flushDone;
+static TaskHandle_t writerTask;
+
+static esp_ota_handle_t otaHandle;
+static int fillIndex = -1;
+static size_t fillLength;
+// Set by the writer task, checked by the receive path
+static std::atomic<esp_err_t> writeError{ESP_OK};
+
+// Updated by the receive path and the writer task, read by the console
+static ota_pipeline_stats_t stats;
+static int64_t otaStart;
+static int64_t writeWrapperTime;    // time spent in __wrap_esp_ota_write, us
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+extern "C" {
+esp_err_t __real_esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle);
+esp_err_t __real_esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+esp_err_t __real_esp_ota_end(esp_ota_handle_t handle);
+esp_err_t __real_esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t __real_esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+#if CONFIG_ENABLE_ENCRYPTED_OTA
+esp_err_t __real_esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args);
+#endif
+#if CONFIG_ENABLE_DELTA_OTA
+esp_err_t __real_esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size);
+#endif
+}
+
+static void otaWriterTask(void *pvParameters) {
+    ota_block_t block;
+
+    for (;;) {
+        xQueueReceive(writeQueue, &block, portMAX_DELAY);
+        if (block.index == OTA_FLUSH_MARKER) {
+            xSemaphoreGive(flushDone);
+            continue;
+        }
+        if (writeError == ESP_OK) {
+            int64_t start = esp_timer_get_time();
+            esp_err_t err = __real_esp_ota_write(otaHandle, otaBuffer[block.index], block.length);
+            // Erase time is accounted by the erase wrapper
+            int64_t time = esp_timer_get_time() - start;
+            portENTER_CRITICAL(&statsLock);
+            stats.write += time;
+            stats.bytes += block.length;
+            portEXIT_CRITICAL(&statsLock);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Slot write failed: %s", esp_err_to_name(err));
+                writeError = err;
+            }
+        }
+        xQueueSend(freeQueue, &block.index, portMAX_DELAY);
+    }
+}
+
+static void ota_pipeline_take_buffer() {
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(freeQueue, &fillIndex, portMAX_DELAY);
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.stall += time;
+    portEXIT_CRITICAL(&statsLock);
+    fillLength = 0;
+}
+
+static void ota_pipeline_submit() {
+    ota_block_t block = { fillIndex, fillLength };
+    xQueueSend(writeQueue, &block, portMAX_DELAY);
+    fillIndex = -1;
+    fillLength = 0;
+}
+
+// Wait for the writer to drain queued blocks
+static void ota_pipeline_wait_writer() {
+    ota_block_t marker = { OTA_FLUSH_MARKER, 0 };
+    int64_t start = esp_timer_get_time();
+    xQueueSend(writeQueue, &marker, portMAX_DELAY);
+    xSemaphoreTake(flushDone, portMAX_DELAY);
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.stall += time;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+// Write out collected data and wait for the writer to drain
+static void ota_pipeline_flush() {
+    if (fillIndex < 0) {
+        return;
+    }
+    if (fillLength != 0) {
+        ota_pipeline_submit();
+    } else {
+        xQueueSend(freeQueue, &fillIndex, portMAX_DELAY);
+        fillIndex = -1;
+    }
+    ota_pipeline_wait_writer();
+}
+
+// Drop collected data, blocks already queued are skipped by the writer
+static void ota_pipeline_discard() {
+    if (fillIndex < 0) {
+        return;
+    }
+    writeError = ESP_ERR_INVALID_STATE;
+    xQueueSend(freeQueue, &fillIndex, portMAX_DELAY);
+    fillIndex = -1;
+    fillLength = 0;
+    ota_pipeline_wait_writer();
+}
+
+static void ota_pipeline_init() {
+    if (writerTask != nullptr) {
+        return;
+    }
+    freeQueue = xQueueCreate(OTA_BUFFER_COUNT, sizeof(int));
+    writeQueue = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(ota_block_t));
+    flushDone = xSemaphoreCreateBinary();
+    ABORT_APP_ON_FAILURE(freeQueue != nullptr && writeQueue != nullptr && flushDone != nullptr, ESP_LOGE(TAG, "Failed to create OTA pipeline"));
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        xQueueSend(freeQueue, &i, 0);
+    }
+    xTaskCreate(otaWriterTask, "otaWriterTask", 3072, nullptr, 4, &writerTask);
+}
+
+// Wrappers
+
+extern "C" esp_err_t __wrap_esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle) {
+    ota_pipeline_init();
+    portENTER_CRITICAL(&statsLock);
+    memset(&stats, 0, sizeof(stats));
+    writeWrapperTime = 0;
+    otaStart = esp_timer_get_time();
+    portEXIT_CRITICAL(&statsLock);
+    writeError = ESP_OK;
+
+    esp_err_t err = __real_esp_ota_begin(partition, image_size, out_handle);
+    if (err == ESP_OK) {
+        otaHandle = *out_handle;
+        ota_pipeline_take_buffer();
+    }
+    return err;
+}
+
+extern "C" esp_err_t __wrap_esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+    if (handle != otaHandle || fillIndex < 0) {
+        return __real_esp_ota_write(handle, data, size);
+    }
+    esp_err_t err = writeError;
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int64_t start = esp_timer_get_time();
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size > 0) {
+        size_t chunk = CONFIG_OTA_WRITE_BUFFER_SIZE - fillLength;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(otaBuffer[fillIndex] + fillLength, bytes, chunk);
+        fillLength += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if (fillLength == CONFIG_OTA_WRITE_BUFFER_SIZE) {
+            ota_pipeline_submit();
+            ota_pipeline_take_buffer();
+        }
+    }
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    writeWrapperTime += time;
+    portEXIT_CRITICAL(&statsLock);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t __wrap_esp_ota_end(esp_ota_handle_t handle) {
+    if (handle != otaHandle) {
+        return __real_esp_ota_end(handle);
+    }
+    ota_pipeline_flush();
+    portENTER_CRITICAL(&statsLock);
+    stats.total = esp_timer_get_time() - otaStart;
+    portEXIT_CRITICAL(&statsLock);
+    otaHandle = 0;
+    esp_err_t err = writeError;
+    if (err != ESP_OK) {
+        __real_esp_ota_abort(handle);
+        return err;
+    }
+    ota_pipeline_print_stats();
+    return __real_esp_ota_end(handle);
+}
+
+extern "C" esp_err_t __wrap_esp_ota_abort(esp_ota_handle_t handle) {
+    if (handle == otaHandle) {
+        ota_pipeline_discard();
+        otaHandle = 0;
+    }
+    return __real_esp_ota_abort(handle);
+}
+
+extern "C" esp_err_t __wrap_esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (xTaskGetCurrentTaskHandle() != writerTask) {
+        return __real_esp_partition_erase_range(partition, offset, size);
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = __real_esp_partition_erase_range(partition, offset, size);
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.erase += time;
+    stats.write -= time;
+    portEXIT_CRITICAL(&statsLock);
+    return err;
+}
+
+#if CONFIG_ENABLE_ENCRYPTED_OTA
+extern "C" esp_err_t __wrap_esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = __real_esp_encrypted_img_decrypt_data(ctx, args);
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.decrypt += time;
+    portEXIT_CRITICAL(&statsLock);
+    return err;
+}
+#endif
+
+#if CONFIG_ENABLE_DELTA_OTA
+// Called by the patcher wrapper in ota_delta.cpp
+esp_err_t ota_pipeline_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size) {
+    int64_t start = esp_timer_get_time();
+    // Slot writes from the patcher run in this task, writeWrapperTime is not changed by others
+    int64_t writeStart = writeWrapperTime;
+    esp_err_t err = __real_esp_delta_ota_feed_patch(handle, buf, size);
+    int64_t time = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&statsLock);
+    stats.patch += time - (writeWrapperTime - writeStart);
+    portEXIT_CRITICAL(&statsLock);
+    return err;
+}
+#endif
+
+#if CONFIG_LIGHT_SELF_CHECK
+#define OTA_CHECK_SIZE (256 * 1024)         // bytes written to the inactive slot by a run
+#define OTA_CHECK_BLOCK 1024                // BDX block
+#define OTA_CHECK_TOLERANCE 5               // % the pipelined run may be slower than the direct one
+
+// Write a pattern the way the image processor does, a tick per block stands for BDX receive.
+// Returns the time in us, 0 on error. The image is aborted, the running slot is not touched
+static int64_t ota_pipeline_check_run(const esp_partition_t *partition, bool pipelined) {
+    static uint8_t block[OTA_CHECK_BLOCK];
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = i * 7;
+    }
+    esp_ota_handle_t handle;
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = pipelined ? esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle) :
+                                __real_esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+    for (size_t offset = 0; err == ESP_OK && offset < OTA_CHECK_SIZE; offset += sizeof(block)) {
+        vTaskDelay(1);
+        err = pipelined ? esp_ota_write(handle, block, sizeof(block)) : __real_esp_ota_write(handle, block, sizeof(block));
+    }
+    if (err == ESP_OK && pipelined) {
+        ota_pipeline_flush();
+        err = writeError;
+    }
+    int64_t time = esp_timer_get_time() - start;
+    if (pipelined) {
+        esp_ota_abort(handle);
+    } else {
+        __real_esp_ota_abort(handle);
+    }
+    if (err != ESP_OK) {
+        printf("%s run failed: %s\n", pipelined ? "Pipelined" : "Direct", esp_err_to_name(err));
+        return 0;
+    }
+    return time;
+}
+
+// Throughput of the pipelined write path against direct slot writes on the same flash
+static bool ota_pipeline_check() {
+    if (otaHandle != 0) {
+        printf("OTA download in progress\n");
+        return false;
+    }
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(nullptr);
+    if (partition == nullptr) {
+        printf("No OTA slot to write\n");
+        return false;
+    }
+    int64_t direct = ota_pipeline_check_run(partition, false);
+    int64_t pipelined = ota_pipeline_check_run(partition, true);
+    if (direct == 0 || pipelined == 0) {
+        return false;
+    }
+    ota_pipeline_stats_t s;
+    ota_pipeline_get_stats(&s);
+
+    printf("Slot %s, %d KB in %d byte blocks, a tick per block\n", partition->label, OTA_CHECK_SIZE / 1024, OTA_CHECK_BLOCK);
+    printf("direct: %lld ms, %llu KB/s\n", direct / 1000, uint64_t(OTA_CHECK_SIZE) * 1000000 / 1024 / direct);
+    printf("pipelined: %lld ms, %llu KB/s, stall: %lld ms, erase: %lld ms, write: %lld ms\n",
+           pipelined / 1000, uint64_t(OTA_CHECK_SIZE) * 1000000 / 1024 / pipelined,
+           s.stall / 1000, s.erase / 1000, s.write / 1000);
+    return pipelined * 100 <= direct * (100 + OTA_CHECK_TOLERANCE);
+}
+#endif
+
+// Public interface
+
+// Consistent snapshot, the download may be running
+static void ota_pipeline_snapshot(ota_pipeline_stats_t *out, int64_t *wrapperTime) {
+    bool running = otaHandle != 0;
+    portENTER_CRITICAL(&statsLock);
+    *out = stats;
+    *wrapperTime = writeWrapperTime;
+    if (out->total == 0 && running) {
+        out->total = esp_timer_get_time() - otaStart;
+    }
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void ota_pipeline_get_stats(ota_pipeline_stats_t *out) {
+    int64_t wrapperTime;
+    ota_pipeline_snapshot(out, &wrapperTime);
+}
+
+void ota_pipeline_print_stats() {
+    ota_pipeline_stats_t s;
+    int64_t wrapperTime;
+    ota_pipeline_snapshot(&s, &wrapperTime);
+
+    // Receive is what is left of the download time after processing on the Matter thread
+    int64_t receive = s.total - s.decrypt - s.patch - wrapperTime;
+    uint32_t rate = s.total > 0 ? uint32_t(uint64_t(s.bytes) * 1000000 / 1024 / s.total) : 0;
+
+    ESP_LOGI(TAG, "OTA %lu bytes in %lld ms, %lu KB/s", s.bytes, s.total / 1000, rate);
+    ESP_LOGI(TAG, "receive: %lld ms, decrypt: %lld ms, patch: %lld ms, stall: %lld ms",
+             receive / 1000, s.decrypt / 1000, s.patch / 1000, s.stall / 1000);
+    ESP_LOGI(TAG, "flash erase: %lld ms, flash write: %lld ms", s.erase / 1000, s.write / 1000);
+}
+
+#if CONFIG_LIGHT_SELF_CHECK
+void ota_pipeline_add_check() {
+    light_console_add_check("ota", ota_pipeline_check);
+}
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+//
+// Pipelined OTA image write path
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+#if CONFIG_OTA_PIPELINED_WRITE
+// Per-phase times of the last (or running) OTA download
+typedef struct {
+    uint32_t bytes;         // image bytes written to the inactive slot
+    int64_t total;          // esp_ota_begin -> esp_ota_end, us
+    int64_t decrypt;        // esp_encrypted_img_decrypt_data, us
+    int64_t patch;          // delta patching without slot writes, us
+    int64_t stall;          // receive path waiting for a free write buffer, us
+    int64_t erase;          // flash sector erase, us
+    int64_t write;          // flash write, us
+} ota_pipeline_stats_t;
+
+void ota_pipeline_get_stats(ota_pipeline_stats_t *stats);
+void ota_pipeline_print_stats();
+#if CONFIG_LIGHT_SELF_CHECK
+// Throughput check over the inactive slot, "matter esp light check ota"
+void ota_pipeline_add_check();
+#endif
+
+#if CONFIG_ENABLE_DELTA_OTA
+#include <esp_delta_ota.h>
+esp_err_t ota_pipeline_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size);
+#endif
+#endif
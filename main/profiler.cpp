@@ -0,0 +1,286 @@
+//
+// Sampling CPU profiler
+//
+// A periodic timer interrupt records the interrupted PC and the running task into a fixed
+// open-addressing histogram, nothing is allocated while sampling. Samples are taken on the
+// core servicing the timer interrupt and are deferred while the flash cache is disabled or
+// interrupts are masked, so critical sections are attributed to the code after them.
+// The reported overhead is the time spent in the sample callback only, interrupt entry,
+// exit and the gptimer dispatch are not included.
+// The dump is symbolised on the host by profileSymbolize.py.
+//
+
+#include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <esp_rom_sys.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <driver/gptimer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#if __riscv
+#include <riscv/rvruntime-frames.h>
+#else
+#include <xtensa_context.h>
+#endif
+
+#include "profiler.h"
+#include "light_console.h"
+
+#if CONFIG_SAMPLING_PROFILER
+
+#define PROFILER_TASKS 24             // tasks attributed in samples, others are dropped
+#define PROFILER_TASKS_MARGIN 4       // tasks created between counting and the state snapshot
+#define PROFILER_PROBES 8
+
+static const char *TAG = "profiler";
+
+typedef struct {
+    uint32_t pc;
+    uint32_t count;
+    uint8_t task;
+} profiler_slot_t;
+
+typedef struct {
+    TaskHandle_t handle;
+    char name[configMAX_TASK_NAME_LEN];
+} profiler_task_t;
+
+static profiler_slot_t slots[CONFIG_PROFILER_SLOTS];
+static profiler_task_t tasks[PROFILER_TASKS];
+static uint8_t taskCount;
+static uint32_t samples;
+static uint32_t dropped;
+static uint64_t sampleCycles;           // cpu cycles spent in the sampling interrupt
+
+static gptimer_handle_t sampleTimer;
+static bool running;
+static int64_t startTime;               // us
+static int64_t runTime;                 // us, accumulated over start/stop
+
+static TaskStatus_t *taskStart;
+static UBaseType_t taskStartCount;
+static configRUN_TIME_COUNTER_TYPE totalStart;
+
+static uint8_t profiler_task_index(TaskHandle_t handle) {
+    for (uint8_t i = 0; i < taskCount; i++) {
+        if (tasks[i].handle == handle) {
+            return i;
+        }
+    }
+    if (taskCount == PROFILER_TASKS) {
+        return UINT8_MAX;
+    }
+    tasks[taskCount].handle = handle;
+    strncpy(tasks[taskCount].name, pcTaskGetName(handle), configMAX_TASK_NAME_LEN - 1);
+    return taskCount++;
+}
+
+static bool profiler_sample(gptimer_handle_t timer, const gptimer_alarm_event_data_t *event, void *arg) {
+    uint32_t entry = esp_cpu_get_cycle_count();
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+    uint32_t pc;
+    // The interrupt entry saves the interrupted context frame on the task stack and stores its
+    // address to pxTopOfStack, the first member of the TCB
+#if __riscv
+    // Only the outermost interrupt stores the frame: with this one nested in another ISR, mepc
+    // is the PC of that ISR, the frame is still the one of the interrupted task
+    const RvExcFrame *frame = *(RvExcFrame **)handle;
+    pc = frame->mepc;
+#else
+    // EPC1 is overwritten by the window exceptions of the ISR call chain. A level 1 interrupt
+    // does not nest, the frame is the one of the interrupted task
+    const XtExcFrame *frame = *(XtExcFrame **)handle;
+    pc = frame->pc;
+#endif
+    uint8_t task = profiler_task_index(handle);
+
+    samples++;
+    bool stored = false;
+    if (task != UINT8_MAX) {
+        uint32_t hash = ((pc >> 1) ^ (uint32_t(task) * 0x9e3779b1)) % CONFIG_PROFILER_SLOTS;
+        for (int probe = 0; probe < PROFILER_PROBES; probe++) {
+            profiler_slot_t *slot = &slots[(hash + probe) % CONFIG_PROFILER_SLOTS];
+            if (slot->count == 0) {
+                slot->pc = pc;
+                slot->task = task;
+            }
+            if (slot->pc == pc && slot->task == task) {
+                slot->count++;
+                stored = true;
+                break;
+            }
+        }
+    }
+    if (!stored) {
+        dropped++;
+    }
+    sampleCycles += esp_cpu_get_cycle_count() - entry;
+    return false;
+}
+
+// Run time snapshot of all tasks, *state is reallocated. Count of tasks, 0 if out of memory
+static UBaseType_t profiler_task_state(TaskStatus_t **state, configRUN_TIME_COUNTER_TYPE *total) {
+    UBaseType_t size = uxTaskGetNumberOfTasks() + PROFILER_TASKS_MARGIN;
+    free(*state);
+    *state = (TaskStatus_t *)malloc(size * sizeof(TaskStatus_t));
+    if (*state == nullptr) {
+        ESP_LOGE(TAG, "No memory for %u task states", size);
+        return 0;
+    }
+    return uxTaskGetSystemState(*state, size, total);
+}
+
+static void profiler_start() {
+    if (running) {
+        return;
+    }
+    memset(slots, 0, sizeof(slots));
+    memset(tasks, 0, sizeof(tasks));
+    taskCount = 0;
+    samples = 0;
+    dropped = 0;
+    sampleCycles = 0;
+    runTime = 0;
+    taskStartCount = profiler_task_state(&taskStart, &totalStart);
+
+    startTime = esp_timer_get_time();
+    running = true;
+    gptimer_start(sampleTimer);
+}
+
+static void profiler_stop() {
+    if (!running) {
+        return;
+    }
+    gptimer_stop(sampleTimer);
+    running = false;
+    runTime += esp_timer_get_time() - startTime;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static uint32_t profiler_overhead() {
+    int64_t elapsed = runTime + (running ? esp_timer_get_time() - startTime : 0);
+    if (elapsed == 0) {
+        return 0;
+    }
+    // Per mille of one core
+    return uint32_t(sampleCycles * 1000 / (uint64_t(elapsed) * esp_rom_get_cpu_ticks_per_us()));
+}
+
+// Compact dump: header, T <task> <name>, S <pc> <task> <count>
+static void profiler_dump() {
+    bool wasRunning = running;
+    profiler_stop();
+
+    printf("# profile rate %d Hz, samples %lu, dropped %lu, callback overhead %lu.%lu%%\n",
+           CONFIG_PROFILER_SAMPLE_RATE, samples, dropped, profiler_overhead() / 10, profiler_overhead() % 10);
+    for (uint8_t i = 0; i < taskCount; i++) {
+        printf("T %u %s\n", i, tasks[i].name);
+    }
+    for (int i = 0; i < CONFIG_PROFILER_SLOTS; i++) {
+        if (slots[i].count != 0) {
+            printf("S %08lx %u %lu\n", slots[i].pc, slots[i].task, slots[i].count);
+        }
+    }
+    printf("# end\n");
+
+    if (wasRunning) {
+        gptimer_start(sampleTimer);
+        startTime = esp_timer_get_time();
+        running = true;
+    }
+}
+
+// FreeRTOS run time per task since profile start
+static void profiler_tasks() {
+    TaskStatus_t *taskNow = nullptr;
+    configRUN_TIME_COUNTER_TYPE totalNow = 0;
+    UBaseType_t count = profiler_task_state(&taskNow, &totalNow);
+    configRUN_TIME_COUNTER_TYPE total = (totalNow - totalStart) * portNUM_PROCESSORS;
+    if (total == 0) {
+        total = 1;
+    }
+
+    printf("%-16s %10s %5s %6s\n", "task", "run us", "cpu%", "stack");
+    for (UBaseType_t i = 0; i < count; i++) {
+        configRUN_TIME_COUNTER_TYPE start = 0;
+        for (UBaseType_t j = 0; j < taskStartCount; j++) {
+            if (taskStart[j].xHandle == taskNow[i].xHandle) {
+                start = taskStart[j].ulRunTimeCounter;
+                break;
+            }
+        }
+        configRUN_TIME_COUNTER_TYPE delta = taskNow[i].ulRunTimeCounter - start;
+        printf("%-16s %10lu %5lu %6lu\n", taskNow[i].pcTaskName, (uint32_t)delta,
+               (uint32_t)(uint64_t(delta) * 100 / total), (uint32_t)taskNow[i].usStackHighWaterMark);
+    }
+    free(taskNow);
+}
+
+static esp_err_t profile_handler(int argc, char **argv) {
+    if (argc == 1 && strcmp(argv[0], "start") == 0) {
+        profiler_start();
+        return ESP_OK;
+    }
+    if (argc == 1 && strcmp(argv[0], "stop") == 0) {
+        profiler_stop();
+        return ESP_OK;
+    }
+    if (argc == 1 && strcmp(argv[0], "dump") == 0) {
+        profiler_dump();
+        return ESP_OK;
+    }
+    if (argc == 1 && strcmp(argv[0], "tasks") == 0) {
+        profiler_tasks();
+        return ESP_OK;
+    }
+    printf("%s, samples %lu, callback overhead %lu.%lu%%\n", running ? "Running" : "Stopped", samples,
+           profiler_overhead() / 10, profiler_overhead() % 10);
+    printf("Usage: profile [start|stop|dump|tasks]\n");
+    return argc == 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+#endif
+
+void profiler_init() {
+    const gptimer_config_t timerConfig = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+        .intr_priority = 1,
+    };
+    esp_err_t err = gptimer_new_timer(&timerConfig, &sampleTimer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Sample timer failed: %s", esp_err_to_name(err));
+        return;
+    }
+    const gptimer_event_callbacks_t callbacks = {
+        .on_alarm = profiler_sample,
+    };
+    gptimer_register_event_callbacks(sampleTimer, &callbacks, nullptr);
+    const gptimer_alarm_config_t alarm = {
+        .alarm_count = 1000000 / CONFIG_PROFILER_SAMPLE_RATE,
+        .reload_count = 0,
+        .flags = {
+            .auto_reload_on_alarm = true,
+        },
+    };
+    gptimer_set_alarm_action(sampleTimer, &alarm);
+    gptimer_enable(sampleTimer);
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "profile",
+            .description = "Sampling CPU profiler. Usage: matter esp light profile [start|stop|dump|tasks]",
+            .handler = profile_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
@@ -0,0 +1,9 @@
+//
+// Sampling CPU profiler
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+void profiler_init();
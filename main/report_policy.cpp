@@ -0,0 +1,234 @@
+//
+// Reporting policy for fast-changing light attributes
+//
+// Every driver-originated change of the light attributes (local control, schedules, level
+// coupled color temperature, color range) goes through here. Intermediate transition values
+// are coalesced, so subscribers get at most one report per CONFIG_REPORT_MIN_INTERVAL ms,
+// plus the final value. RemainingTime of driver transitions is reported only when it starts,
+// ends, grows or jumps. A value still waiting out the interval is dropped once a controller
+// writes the attribute, so it never overwrites a newer value.
+// Transitions run by the LevelControl and ColorControl servers for controller commands are
+// written and reported by the servers.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_matter.h>
+#include <platform/PlatformManager.h>
+
+#include "report_policy.h"
+#include "light_console.h"
+
+using namespace esp_matter;
+using namespace chip::app::Clusters;
+
+#define REPORT_ENTRIES 10
+
+static const char *TAG = "report_policy";
+
+typedef struct {
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    esp_matter_attr_val_t val;          // latest value
+    esp_matter_attr_val_t reported;     // last reported value
+    bool pending;
+    bool used;
+    int64_t lastReport;                 // us
+    uint32_t sent;
+    uint32_t suppressed;
+    uint32_t dropped;                   // pending value superseded by a controller write
+} report_entry_t;
+
+static report_entry_t entries[REPORT_ENTRIES];
+static portMUX_TYPE entriesLock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t reportTimer;
+static volatile bool suspended;
+static bool flushing;                   // Matter context only
+static const int64_t minInterval = int64_t(CONFIG_REPORT_MIN_INTERVAL) * 1000;
+
+static report_entry_t *report_policy_entry(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id) {
+    for (int i = 0; i < REPORT_ENTRIES; i++) {
+        report_entry_t *entry = &entries[i];
+        if (!entry->used) {
+            entry->used = true;
+            entry->endpoint_id = endpoint_id;
+            entry->cluster_id = cluster_id;
+            entry->attribute_id = attribute_id;
+            return entry;
+        }
+        if (entry->endpoint_id == endpoint_id && entry->cluster_id == cluster_id && entry->attribute_id == attribute_id) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+static report_entry_t *report_policy_find(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id) {
+    for (int i = 0; i < REPORT_ENTRIES && entries[i].used; i++) {
+        report_entry_t *entry = &entries[i];
+        if (entry->endpoint_id == endpoint_id && entry->cluster_id == cluster_id && entry->attribute_id == attribute_id) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+static bool report_policy_remaining_time(const report_entry_t *entry) {
+    return (entry->cluster_id == LevelControl::Id && entry->attribute_id == LevelControl::Attributes::RemainingTime::Id) ||
+           (entry->cluster_id == ColorControl::Id && entry->attribute_id == ColorControl::Attributes::RemainingTime::Id);
+}
+
+// RemainingTime is reported only when it starts, ends, grows or jumps
+static bool report_policy_significant(const report_entry_t *entry, const esp_matter_attr_val_t &val) {
+    uint16_t last = entry->reported.val.u16;
+    uint16_t value = val.val.u16;
+    if (value == 0 || last == 0) {
+        return value != last;
+    }
+    return value > last || last - value >= CONFIG_REPORT_REMAINING_TIME_DELTA;
+}
+
+// Runs in Matter context. arg is 1 + index of an entry to report right away, 0 for none
+static void report_policy_flush(intptr_t arg) {
+    int64_t now = esp_timer_get_time();
+    int64_t nextDue = INT64_MAX;
+
+    for (int i = 0; i < REPORT_ENTRIES; i++) {
+        report_entry_t *entry = &entries[i];
+        esp_matter_attr_val_t val;
+        bool due = false;
+
+        portENTER_CRITICAL(&entriesLock);
+        if (entry->used && entry->pending) {
+            if (now - entry->lastReport >= minInterval || i + 1 == arg) {
+                due = true;
+                val = entry->val;
+                entry->pending = false;
+                entry->reported = val;
+                entry->lastReport = now;
+                entry->sent++;
+            } else if (entry->lastReport + minInterval < nextDue) {
+                nextDue = entry->lastReport + minInterval;
+            }
+        }
+        portEXIT_CRITICAL(&entriesLock);
+
+        if (due) {
+            flushing = true;
+            attribute::update(entry->endpoint_id, entry->cluster_id, entry->attribute_id, &val);
+            flushing = false;
+        }
+    }
+
+    if (nextDue != INT64_MAX && !esp_timer_is_active(reportTimer)) {
+        esp_timer_start_once(reportTimer, nextDue - now);
+    }
+}
+
+static void report_policy_timer_cb(void *arg) {
+    chip::DeviceLayer::PlatformMgr().ScheduleWork(report_policy_flush, 0);
+}
+
+void report_policy_update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t val, enum ReportPhase phase) {
+    bool immediate = phase == ReportPhase::end;
+    bool schedule = false;
+    int64_t delay = minInterval;
+    intptr_t index = 0;
+    if (suspended) {
+        return;
+    }
+
+    portENTER_CRITICAL(&entriesLock);
+    report_entry_t *entry = report_policy_entry(endpoint_id, cluster_id, attribute_id);
+    if (entry != nullptr) {
+        if (report_policy_remaining_time(entry) && !immediate) {
+            // Significant changes are reported right away, the others not at all
+            immediate = report_policy_significant(entry, val);
+        }
+        if (report_policy_remaining_time(entry) && !immediate) {
+            entry->suppressed++;
+        } else {
+            if (entry->pending) {
+                // Superseded before it was reported
+                entry->suppressed++;
+            }
+            entry->val = val;
+            entry->pending = true;
+            delay = entry->lastReport + minInterval - esp_timer_get_time();
+            schedule = immediate || delay <= 0;
+            index = entry - entries + 1;
+        }
+    }
+    portEXIT_CRITICAL(&entriesLock);
+
+    if (entry == nullptr) {
+        ESP_LOGE(TAG, "No report entry for 0x%lx/0x%lx", cluster_id, attribute_id);
+        return;
+    }
+    if (schedule) {
+        chip::DeviceLayer::PlatformMgr().ScheduleWork(report_policy_flush, immediate ? index : 0);
+    } else if (!esp_timer_is_active(reportTimer)) {
+        esp_timer_start_once(reportTimer, delay);
+    }
+}
+
+void report_policy_external(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const esp_matter_attr_val_t &val) {
+    if (flushing) {
+        return;
+    }
+    portENTER_CRITICAL(&entriesLock);
+    report_entry_t *entry = report_policy_find(endpoint_id, cluster_id, attribute_id);
+    if (entry != nullptr) {
+        if (entry->pending) {
+            entry->pending = false;
+            entry->dropped++;
+        }
+        // Significance of the next RemainingTime is judged against this value
+        entry->reported = val;
+    }
+    portEXIT_CRITICAL(&entriesLock);
+}
+
+void report_policy_suspend(bool suspend) {
+    suspended = suspend;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t report_stats_handler(int argc, char **argv) {
+    for (int i = 0; i < REPORT_ENTRIES; i++) {
+        report_entry_t entry;
+        portENTER_CRITICAL(&entriesLock);
+        entry = entries[i];
+        portEXIT_CRITICAL(&entriesLock);
+        if (!entry.used) {
+            continue;
+        }
+        printf("%u/0x%04lx/0x%04lx: sent: %lu, suppressed: %lu, dropped: %lu\n",
+               entry.endpoint_id, entry.cluster_id, entry.attribute_id, entry.sent, entry.suppressed, entry.dropped);
+    }
+    return ESP_OK;
+}
+#endif
+
+void report_policy_init() {
+    const esp_timer_create_args_t timerArgs = {
+        .callback = report_policy_timer_cb,
+        .name = "report_policy",
+    };
+    esp_timer_create(&timerArgs, &reportTimer);
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const console::command_t commands[] = {
+        {
+            .name = "reports",
+            .description = "Attribute reports sent/suppressed/dropped by the reporting policy. Usage: matter esp light reports",
+            .handler = report_stats_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
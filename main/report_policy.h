@@ -0,0 +1,27 @@
+//
+// Reporting policy for fast-changing light attributes
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <esp_matter.h>
+
+// Position of an attribute change in a transition
+enum class ReportPhase : short
+{
+    step,   // Reported at most every CONFIG_REPORT_MIN_INTERVAL ms, the latest value wins.
+            // RemainingTime only on significant change, right away
+    end     // Always reported
+};
+
+// Publish driver-originated attribute change to the data model following the policy.
+// Thread safe, the update itself runs in Matter context.
+void report_policy_update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t val, enum ReportPhase phase);
+// Attribute written by a controller or a server, in Matter context: a pending driver value
+// of it is dropped
+void report_policy_external(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const esp_matter_attr_val_t &val);
+// Synthetic load running: driver-originated changes are not published, the data model keeps
+// its values
+void report_policy_suspend(bool suspend);
+void report_policy_init();
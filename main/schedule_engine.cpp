@@ -0,0 +1,298 @@
+//
+// Circadian schedule engine
+//
+// Day curve of a few points is baked into a table of SCHEDULE_SLOT_MINUTES slots.
+// At every slot boundary the light fades to the next slot value over the whole slot,
+// so changes are imperceptible and no commands are needed from controllers.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_matter.h>
+#include <system/SystemClock.h>
+
+#include "app_priv.h"
+#include "light_driver.h"
+#include "led_driver.h"
+#include "light_console.h"
+#include "schedule_engine.h"
+
+#if CONFIG_SCHEDULE_ENGINE
+
+#define SCHEDULE_SLOT_MINUTES 5
+#define SCHEDULE_SLOTS (24 * 60 / SCHEDULE_SLOT_MINUTES)
+#define SCHEDULE_TICK_MS 10000
+
+static const char *TAG = "schedule";
+static const char *NVS_NAMESPACE = "schedule";
+static const char *NVS_KEY_POINTS = "points";
+static const char *NVS_KEY_UTC_OFFSET = "utcoff";
+
+typedef struct {
+    uint16_t mireds;
+    uint8_t level;
+} schedule_slot_t;
+
+static schedule_point_t points[CONFIG_SCHEDULE_POINTS];
+static size_t pointCount;
+static int32_t utcOffset;               // minutes
+static schedule_slot_t slots[SCHEDULE_SLOTS];
+
+static esp_timer_handle_t tickTimer;
+static int currentSlot = -1;
+static volatile int64_t overrideUntil;  // epoch minute, 0 if not overridden
+static volatile bool suspended;
+
+// Local epoch minute, false if real time is not known yet
+static bool schedule_engine_now(int64_t *minute) {
+    chip::System::Clock::Milliseconds64 realTime;
+    if (chip::System::SystemClock().GetClock_RealTimeMS(realTime) != CHIP_NO_ERROR) {
+        return false;
+    }
+    *minute = int64_t(realTime.count() / 60000) + utcOffset;
+    return true;
+}
+
+static void schedule_engine_build_table() {
+    if (pointCount == 0) {
+        return;
+    }
+    for (int slot = 0; slot < SCHEDULE_SLOTS; slot++) {
+        int minute = slot * SCHEDULE_SLOT_MINUTES;
+        // Points are sorted, find the last point not after minute, wrapping over midnight
+        size_t prev = pointCount - 1;
+        for (size_t i = 0; i < pointCount; i++) {
+            if (points[i].minute <= minute) {
+                prev = i;
+            }
+        }
+        size_t next = (prev + 1) % pointCount;
+        const schedule_point_t &a = points[prev];
+        const schedule_point_t &b = points[next];
+
+        int span = (b.minute - a.minute + 24 * 60) % (24 * 60);
+        int offset = (minute - a.minute + 24 * 60) % (24 * 60);
+        if (span == 0) {
+            slots[slot] = { a.mireds, a.level };
+            continue;
+        }
+        slots[slot].mireds = a.mireds + (int(b.mireds) - int(a.mireds)) * offset / span;
+        slots[slot].level = a.level + (int(b.level) - int(a.level)) * offset / span;
+    }
+}
+
+// Epoch minute of the next schedule point after minute
+static int64_t schedule_engine_next_point(int64_t minute) {
+    int dayMinute = minute % (24 * 60);
+    int delta = 24 * 60;
+    for (size_t i = 0; i < pointCount; i++) {
+        int d = (points[i].minute - dayMinute + 24 * 60) % (24 * 60);
+        if (d == 0) {
+            d = 24 * 60;
+        }
+        if (d < delta) {
+            delta = d;
+        }
+    }
+    return minute + delta;
+}
+
+static void schedule_engine_tick(void *arg) {
+    int64_t minute;
+    if (suspended || pointCount == 0 || !schedule_engine_now(&minute)) {
+        return;
+    }
+    if (overrideUntil != 0) {
+        if (minute < overrideUntil) {
+            return;
+        }
+        ESP_LOGI(TAG, "Override ended");
+        overrideUntil = 0;
+        currentSlot = -1;
+    }
+
+    int slot = (minute % (24 * 60)) / SCHEDULE_SLOT_MINUTES;
+    if (slot == currentSlot) {
+        return;
+    }
+    // Fade to the next slot value until the next slot boundary
+    int nextSlot = (slot + 1) % SCHEDULE_SLOTS;
+    uint32_t fadeTime = uint32_t(SCHEDULE_SLOT_MINUTES - minute % SCHEDULE_SLOT_MINUTES) * 60000;
+    if (currentSlot == -1) {
+        // Schedule (re)started, catch up quickly
+        nextSlot = slot;
+        fadeTime = led_driver_get_fade_time();
+    }
+    currentSlot = slot;
+    app_driver_light_set_scheduled(slots[nextSlot].level, slots[nextSlot].mireds, fadeTime);
+}
+
+static void schedule_engine_load() {
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t length = sizeof(points);
+    if (nvs_get_blob(handle, NVS_KEY_POINTS, points, &length) == ESP_OK) {
+        pointCount = length / sizeof(schedule_point_t);
+    }
+    nvs_get_i32(handle, NVS_KEY_UTC_OFFSET, &utcOffset);
+    nvs_close(handle);
+}
+
+static esp_err_t schedule_engine_save() {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (pointCount == 0) {
+        nvs_erase_key(handle, NVS_KEY_POINTS);
+    } else {
+        err = nvs_set_blob(handle, NVS_KEY_POINTS, points, pointCount * sizeof(schedule_point_t));
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_i32(handle, NVS_KEY_UTC_OFFSET, utcOffset);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static void schedule_engine_print() {
+    int64_t minute;
+    if (schedule_engine_now(&minute)) {
+        printf("Local time: %02d:%02d, UTC offset: %ld min\n", int(minute % (24 * 60) / 60), int(minute % 60), utcOffset);
+    } else {
+        printf("Time not set, UTC offset: %ld min\n", utcOffset);
+    }
+    for (size_t i = 0; i < pointCount; i++) {
+        printf("%02d:%02d %luK level %u\n", points[i].minute / 60, points[i].minute % 60,
+               REMAP_TO_RANGE_INVERSE(uint32_t(points[i].mireds), MATTER_TEMPERATURE_FACTOR), points[i].level);
+    }
+    if (overrideUntil != 0) {
+        printf("Overridden until next point\n");
+    }
+}
+
+// set <hh:mm> <kelvin> <level> [<hh:mm> <kelvin> <level> ...]
+static esp_err_t schedule_engine_set(int argc, char **argv) {
+    if (argc == 0 || argc % 3 != 0 || argc / 3 > CONFIG_SCHEDULE_POINTS) {
+        printf("Usage: set <hh:mm> <kelvin> <level> ..., up to %d points\n", CONFIG_SCHEDULE_POINTS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    schedule_point_t newPoints[CONFIG_SCHEDULE_POINTS];
+    size_t count = argc / 3;
+    for (size_t i = 0; i < count; i++) {
+        int hour, min;
+        uint32_t kelvin = strtoul(argv[i * 3 + 1], nullptr, 10);
+        int level = atoi(argv[i * 3 + 2]);
+        if (sscanf(argv[i * 3], "%d:%d", &hour, &min) != 2 || hour < 0 || hour > 23 || min < 0 || min > 59 ||
+            kelvin == 0 || level < 1 || level > MATTER_BRIGHTNESS) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        newPoints[i].minute = hour * 60 + min;
+        newPoints[i].mireds = REMAP_TO_RANGE_INVERSE(kelvin, MATTER_TEMPERATURE_FACTOR);
+        newPoints[i].level = level;
+    }
+    // Sort by time of day
+    for (size_t i = 1; i < count; i++) {
+        for (size_t j = i; j > 0 && newPoints[j].minute < newPoints[j - 1].minute; j--) {
+            schedule_point_t point = newPoints[j];
+            newPoints[j] = newPoints[j - 1];
+            newPoints[j - 1] = point;
+        }
+    }
+
+    esp_timer_stop(tickTimer);
+    memcpy(points, newPoints, count * sizeof(schedule_point_t));
+    pointCount = count;
+    schedule_engine_build_table();
+    overrideUntil = 0;
+    currentSlot = -1;
+    esp_timer_start_periodic(tickTimer, SCHEDULE_TICK_MS * 1000);
+    return schedule_engine_save();
+}
+
+static esp_err_t schedule_handler(int argc, char **argv) {
+    if (argc == 0) {
+        schedule_engine_print();
+        return ESP_OK;
+    }
+    if (strcmp(argv[0], "set") == 0) {
+        return schedule_engine_set(argc - 1, argv + 1);
+    }
+    if (strcmp(argv[0], "clear") == 0) {
+        esp_timer_stop(tickTimer);
+        pointCount = 0;
+        overrideUntil = 0;
+        currentSlot = -1;
+        app_driver_light_end_scheduled();
+        return schedule_engine_save();
+    }
+    if (strcmp(argv[0], "time") == 0 && argc == 2) {
+        // Accept time-set without a TimeSynchronization client, UTC seconds
+        uint64_t seconds = strtoull(argv[1], nullptr, 10);
+        CHIP_ERROR err = chip::System::SystemClock().SetClock_RealTime(chip::System::Clock::Microseconds64(seconds * 1000000));
+        currentSlot = -1;
+        return err == CHIP_NO_ERROR ? ESP_OK : ESP_FAIL;
+    }
+    if (strcmp(argv[0], "utcoffset") == 0 && argc == 2) {
+        utcOffset = atoi(argv[1]);
+        currentSlot = -1;
+        return schedule_engine_save();
+    }
+    printf("Usage: schedule [set <hh:mm> <kelvin> <level> ...|clear|time <utc seconds>|utcoffset <minutes>]\n");
+    return ESP_ERR_INVALID_ARG;
+}
+#endif
+
+// Public interface
+
+void schedule_engine_override() {
+    int64_t minute;
+    if (suspended || pointCount == 0 || !schedule_engine_now(&minute)) {
+        return;
+    }
+    if (overrideUntil == 0) {
+        app_driver_light_end_scheduled();
+    }
+    overrideUntil = schedule_engine_next_point(minute);
+}
+
+void schedule_engine_suspend(bool suspend) {
+    suspended = suspend;
+}
+
+void schedule_engine_init() {
+    schedule_engine_load();
+    schedule_engine_build_table();
+    ESP_LOGI(TAG, "Schedule points: %u", pointCount);
+
+    const esp_timer_create_args_t timerArgs = {
+        .callback = schedule_engine_tick,
+        .name = "schedule",
+    };
+    esp_timer_create(&timerArgs, &tickTimer);
+    esp_timer_start_periodic(tickTimer, SCHEDULE_TICK_MS * 1000);
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "schedule",
+            .description = "Circadian schedule. Usage: matter esp light schedule [set <hh:mm> <kelvin> <level> ...|clear|time <utc seconds>|utcoffset <minutes>]",
+            .handler = schedule_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
@@ -0,0 +1,22 @@
+//
+// Circadian schedule engine
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+#if CONFIG_SCHEDULE_ENGINE
+// Schedule point: local time of day -> color temperature, level
+typedef struct {
+    uint16_t minute;        // minute of day
+    uint16_t mireds;
+    uint8_t level;
+} schedule_point_t;
+
+void schedule_engine_init();
+// Manual change of level or color temperature, schedule yields until its next point
+void schedule_engine_override();
+// Synthetic load running: the schedule is neither applied nor overridden
+void schedule_engine_suspend(bool suspend);
+#endif
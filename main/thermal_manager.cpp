@@ -0,0 +1,215 @@
+//
+// Thermal foldback of the led output
+//
+// Temperature of the chip or of an NTC near the leds is sampled at a low rate and filtered.
+// Above CONFIG_THERMAL_DERATE_START the output limit falls linearly to CONFIG_THERMAL_MIN_OUTPUT
+// at CONFIG_THERMAL_DERATE_END. Output is restored only when the temperature falls
+// CONFIG_THERMAL_HYSTERESIS below the derating point, and the limit moves in small steps,
+// so the fixture settles at its maximum sustainable brightness.
+//
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "led_driver.h"
+#include "light_console.h"
+#include "thermal_manager.h"
+
+#if CONFIG_THERMAL_FOLDBACK
+
+#if CONFIG_THERMAL_SENSOR_NTC
+#include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
+#else
+#include <driver/temperature_sensor.h>
+#endif
+
+#define THERMAL_STEP_DOWN 50                // max limit change per sample, permille
+#define THERMAL_STEP_UP 10
+#define THERMAL_NTC_SUPPLY 3300             // divider supply, mV
+
+static const char *TAG = "thermal";
+
+typedef struct {
+    float temperature;                      // filtered, C
+    float maxTemperature;
+    uint16_t limit;                         // permille
+    uint16_t minLimit;
+    uint32_t deratings;                     // times derating started
+    uint64_t deratedTime;                   // ms
+    uint32_t errors;                        // failed sensor reads
+} thermal_stats_t;
+
+static thermal_stats_t stats = {
+    .temperature = NAN,
+    .maxTemperature = -INFINITY,
+    .limit = LED_OUTPUT_LIMIT_FULL,
+    .minLimit = LED_OUTPUT_LIMIT_FULL,
+};
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t sampleTimer;
+
+#if CONFIG_THERMAL_SENSOR_NTC
+static adc_oneshot_unit_handle_t adcHandle;
+static adc_cali_handle_t caliHandle;
+
+static bool thermal_sensor_init() {
+    adc_oneshot_unit_init_cfg_t unitConfig = {
+        .unit_id = ADC_UNIT_1,
+    };
+    if (adc_oneshot_new_unit(&unitConfig, &adcHandle) != ESP_OK) {
+        return false;
+    }
+    adc_oneshot_chan_cfg_t channelConfig = {
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    if (adc_oneshot_config_channel(adcHandle, adc_channel_t(CONFIG_THERMAL_NTC_ADC_CHANNEL), &channelConfig) != ESP_OK) {
+        return false;
+    }
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t caliConfig = {
+        .unit_id = ADC_UNIT_1,
+        .chan = adc_channel_t(CONFIG_THERMAL_NTC_ADC_CHANNEL),
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    return adc_cali_create_scheme_curve_fitting(&caliConfig, &caliHandle) == ESP_OK;
+#else
+    adc_cali_line_fitting_config_t caliConfig = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    return adc_cali_create_scheme_line_fitting(&caliConfig, &caliHandle) == ESP_OK;
+#endif
+}
+
+// NTC from the ADC input to ground, series resistor to the supply
+static bool thermal_sensor_read(float *celsius) {
+    int mv;
+    if (adc_oneshot_get_calibrated_result(adcHandle, caliHandle, adc_channel_t(CONFIG_THERMAL_NTC_ADC_CHANNEL), &mv) != ESP_OK ||
+        mv <= 0 || mv >= THERMAL_NTC_SUPPLY) {
+        return false;
+    }
+    float resistance = float(CONFIG_THERMAL_NTC_SERIES_RESISTOR) * mv / (THERMAL_NTC_SUPPLY - mv);
+    float kelvin = 1.0f / (1.0f / 298.15f + logf(resistance / CONFIG_THERMAL_NTC_R25) / CONFIG_THERMAL_NTC_BETA);
+    *celsius = kelvin - 273.15f;
+    return true;
+}
+#else
+static temperature_sensor_handle_t sensorHandle;
+
+static bool thermal_sensor_init() {
+    temperature_sensor_config_t config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(20, 100);
+    return temperature_sensor_install(&config, &sensorHandle) == ESP_OK &&
+           temperature_sensor_enable(sensorHandle) == ESP_OK;
+}
+
+static bool thermal_sensor_read(float *celsius) {
+    return temperature_sensor_get_celsius(sensorHandle, celsius) == ESP_OK;
+}
+#endif
+
+// Output limit of the derating curve at a temperature
+static uint16_t thermal_manager_curve(float temperature) {
+    const float start = CONFIG_THERMAL_DERATE_START;
+    const float end = CONFIG_THERMAL_DERATE_END;
+    const uint16_t minLimit = CONFIG_THERMAL_MIN_OUTPUT * 10;
+    if (temperature <= start) {
+        return LED_OUTPUT_LIMIT_FULL;
+    }
+    if (temperature >= end) {
+        return minLimit;
+    }
+    return LED_OUTPUT_LIMIT_FULL - uint16_t((LED_OUTPUT_LIMIT_FULL - minLimit) * (temperature - start) / (end - start));
+}
+
+static void thermal_manager_sample(void *arg) {
+    float raw;
+    if (!thermal_sensor_read(&raw)) {
+        portENTER_CRITICAL(&statsLock);
+        stats.errors++;
+        portEXIT_CRITICAL(&statsLock);
+        return;
+    }
+
+    portENTER_CRITICAL(&statsLock);
+    float temperature = isnan(stats.temperature) ? raw : stats.temperature + (raw - stats.temperature) / 4;
+    uint16_t limit = stats.limit;
+    uint16_t target = thermal_manager_curve(temperature);
+    if (target >= limit) {
+        // Cooling: restore only below the derating point by the hysteresis
+        uint16_t restore = thermal_manager_curve(temperature + CONFIG_THERMAL_HYSTERESIS);
+        target = restore > limit ? restore : limit;
+    }
+    uint16_t newLimit = target < limit ? (limit - target > THERMAL_STEP_DOWN ? limit - THERMAL_STEP_DOWN : target)
+                                       : (target - limit > THERMAL_STEP_UP ? limit + THERMAL_STEP_UP : target);
+    if (limit == LED_OUTPUT_LIMIT_FULL && newLimit < limit) {
+        stats.deratings++;
+    }
+    if (limit < LED_OUTPUT_LIMIT_FULL) {
+        stats.deratedTime += CONFIG_THERMAL_SAMPLE_INTERVAL;
+    }
+    stats.temperature = temperature;
+    stats.maxTemperature = temperature > stats.maxTemperature ? temperature : stats.maxTemperature;
+    stats.limit = newLimit;
+    stats.minLimit = newLimit < stats.minLimit ? newLimit : stats.minLimit;
+    portEXIT_CRITICAL(&statsLock);
+
+    if (newLimit != limit) {
+        if (newLimit == LED_OUTPUT_LIMIT_FULL || limit == LED_OUTPUT_LIMIT_FULL) {
+            ESP_LOGW(TAG, "%s at %.1fC", newLimit == LED_OUTPUT_LIMIT_FULL ? "Output restored" : "Output derating", temperature);
+        }
+        // Ride along a fade in progress instead of restarting it
+        led_driver_set_output_limit(newLimit);
+        led_driver_update(LED_FADE_RETARGET);
+    }
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t thermal_handler(int argc, char **argv) {
+    thermal_stats_t s;
+    portENTER_CRITICAL(&statsLock);
+    s = stats;
+    portEXIT_CRITICAL(&statsLock);
+    printf("Temperature: %.1fC, max: %.1fC, derating %d-%dC to %d%%, hysteresis %dC\n",
+           s.temperature, s.maxTemperature, CONFIG_THERMAL_DERATE_START, CONFIG_THERMAL_DERATE_END,
+           CONFIG_THERMAL_MIN_OUTPUT, CONFIG_THERMAL_HYSTERESIS);
+    printf("Output limit: %u.%u%%, min: %u.%u%%, deratings: %lu, derated: %llu s, sensor errors: %lu\n",
+           s.limit / 10, s.limit % 10, s.minLimit / 10, s.minLimit % 10, s.deratings, s.deratedTime / 1000, s.errors);
+    return ESP_OK;
+}
+#endif
+
+void thermal_manager_init() {
+    if (!thermal_sensor_init()) {
+        ESP_LOGE(TAG, "Temperature sensor init failed, no thermal foldback");
+        return;
+    }
+    const esp_timer_create_args_t timerArgs = {
+        .callback = thermal_manager_sample,
+        .name = "thermal",
+    };
+    esp_timer_create(&timerArgs, &sampleTimer);
+    esp_timer_start_periodic(sampleTimer, uint64_t(CONFIG_THERMAL_SAMPLE_INTERVAL) * 1000);
+    thermal_manager_sample(nullptr);
+
+#if CONFIG_ENABLE_CHIP_SHELL
+    static const esp_matter::console::command_t commands[] = {
+        {
+            .name = "thermal",
+            .description = "Temperature and output derating. Usage: matter esp light thermal",
+            .handler = thermal_handler,
+        },
+    };
+    light_console_add_commands(commands, sizeof(commands) / sizeof(commands[0]));
+#endif
+}
+
+#endif
@@ -0,0 +1,12 @@
+//
+// Thermal foldback of the led output
+//
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#if CONFIG_THERMAL_FOLDBACK
+void thermal_manager_init();
+#endif
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+#
+# Make led calibration record for the factory partition, prints it as hex
+# Usage: makeCalibration.py warmKelvin coldKelvin warmGain coldGain warmDeadZone coldDeadZone [curve points...]
+#        [--neutral kelvin gain deadZone]
+#
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x4C41434C
+VERSION = 2
+HEADER = '<IHHHH'
+CHANNEL = '<HHH'
+
+parser = argparse.ArgumentParser(usage='makeCalibration.py warmKelvin coldKelvin warmGain coldGain warmDeadZone coldDeadZone '
+                                       '[curve points...] [--neutral kelvin gain deadZone]')
+parser.add_argument('values', type=int, nargs='+')
+parser.add_argument('--neutral', type=int, nargs=3, metavar=('KELVIN', 'GAIN', 'DEADZONE'),
+                    help='neutral white channel')
+args = parser.parse_args()
+
+if len(args.values) < 6:
+    parser.print_usage()
+    sys.exit(1)
+
+warm, cold, gain_warm, gain_cold, dead_warm, dead_cold = args.values[:6]
+curve = args.values[6:]
+if warm <= 0 or cold <= warm:
+    sys.exit('Invalid color temperatures')
+if args.neutral and not warm < args.neutral[0] < cold:
+    sys.exit('Neutral color temperature must be between warm and cold')
+if len(curve) == 1:
+    sys.exit('Curve needs at least two points')
+
+channels = [(warm, gain_warm, dead_warm), (cold, gain_cold, dead_cold)]
+if args.neutral:
+    channels.append(tuple(args.neutral))
+
+size = struct.calcsize(HEADER) + struct.calcsize(CHANNEL) * len(channels) + 2 * len(curve)
+record = struct.pack(HEADER, MAGIC, VERSION, size, len(channels), len(curve))
+for channel in channels:
+    record += struct.pack(CHANNEL, *channel)
+record += struct.pack('<%dH' % len(curve), *curve)
+record += struct.pack('<I', zlib.crc32(record))
+print(record.hex())
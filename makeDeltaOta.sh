@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Make delta OTA image against the release running on devices.
+# Patch is compressed (heatshrink) and applied by the OTA requestor
+# into the inactive slot (CONFIG_ENABLE_DELTA_OTA).
+#
+
+if (( "$#" < 1 )); then
+    echo "Usage: $0 base.bin [new.bin] [encryption_public_key.pem]" >&2
+    exit 1
+fi
+
+base_binary=$1
+new_binary=${2:-"build/LightWarmCold.bin"}
+encryption_key=$3
+out_dir=${OTA_OUT_DIR:-"build/delta_ota"}
+
+source ./factoryData.sh
+
+eval $(grep -E 'PROJECT_VER(_NUMBER)? ' CMakeLists.txt | sed -E 's/set\(([A-Z_]+) "?([^")]*)"?\)/\1=\2/')
+
+DELTA_OTA_TOOLS=$(find managed_components -path "*esp_delta_ota*" -name "esp_delta_ota_patch_gen.py" -print -quit 2>/dev/null)
+if [[ ${#DELTA_OTA_TOOLS} == 0 ]]; then
+    echo "esp_delta_ota_patch_gen.py not found, run idf.py reconfigure first."
+    exit 1
+fi
+OTA_IMAGE_TOOL=$ESP_MATTER_PATH/connectedhomeip/connectedhomeip/src/app/ota_image_tool.py
+
+mkdir -p $out_dir
+patch_file=$out_dir/LightWarmCold-$PROJECT_VER.patch
+
+python $DELTA_OTA_TOOLS create_patch --chip "$IDF_TARGET" --base_binary "$base_binary" --new_binary "$new_binary" --patch_file_name "$patch_file" || exit 1
+
+# Host check: patch applied to base must reproduce the new image
+python $DELTA_OTA_TOOLS verify_patch --chip "$IDF_TARGET" --base_binary "$base_binary" --new_binary "$new_binary" --patch_file_name "$patch_file" || exit 1
+
+if [[ ${#encryption_key} != 0 ]]; then
+    # CONFIG_ENABLE_ENCRYPTED_OTA: image is decrypted before patching
+    ENC_IMG_TOOL=$(find managed_components -name "esp_enc_img_gen.py" -print -quit 2>/dev/null)
+    python $ENC_IMG_TOOL encrypt "$patch_file" "$encryption_key" "$patch_file.enc" || exit 1
+    patch_file=$patch_file.enc
+fi
+
+ota_file=$out_dir/LightWarmCold-$PROJECT_VER-delta-ota.bin
+python $OTA_IMAGE_TOOL create -v 0x$VENDOR_ID -p 0x$PRODUCT_ID -vn $PROJECT_VER_NUMBER -vs "$PROJECT_VER" -da sha256 "$patch_file" "$ota_file" || exit 1
+
+full_size=$(stat -c %s "$new_binary")
+delta_size=$(stat -c %s "$ota_file")
+echo "Delta OTA image: $ota_file"
+echo "Size: $delta_size bytes, full image: $full_size bytes, ratio: $(( full_size / (delta_size ? delta_size : 1) ))x"
@@ -25,6 +25,18 @@ if ! [[ "$count" =~ ^[1-9][0-9]*$ ]]; then
     exit 1
 fi
 
+calibration_args=()
+if [[ -n "$CAL_WARM_KELVIN" ]]; then
+    calibration=$(./makeCalibration.py $CAL_WARM_KELVIN $CAL_COLD_KELVIN $CAL_GAIN $CAL_DEAD_ZONE $CAL_CURVE ${CAL_NEUTRAL:+--neutral $CAL_NEUTRAL}) || exit 1
+    mkdir -p $factory_partition_path
+    printf "led-calibration,namespace,\nrecord,data,hex2bin\n" > $factory_partition_path/calibration-config.csv
+    echo "record" > $factory_partition_path/calibration-values.csv
+    for (( i = 0; i < count; i++ )); do
+        echo "$calibration" >> $factory_partition_path/calibration-values.csv
+    done
+    calibration_args=(--csv $factory_partition_path/calibration-config.csv --mcsv $factory_partition_path/calibration-values.csv)
+fi
+
 MATTER_CRED_PATH=$ESP_MATTER_PATH/connectedhomeip/connectedhomeip/credentials/test
 esp-matter-mfg-tool \
     --outdir $factory_partition_path \
@@ -42,4 +54,5 @@ esp-matter-mfg-tool \
     --pai \
     --key "$MATTER_CRED_PATH/attestation/Chip-Test-PAI-$VENDOR_ID-$PRODUCT_ID-Key.pem" \
     --cert "$MATTER_CRED_PATH/attestation/Chip-Test-PAI-$VENDOR_ID-$PRODUCT_ID-Cert.pem" \
-    --cert-dclrn "$MATTER_CRED_PATH/certification-declaration/Chip-Test-CD-$VENDOR_ID-$PRODUCT_ID.der"
+    --cert-dclrn "$MATTER_CRED_PATH/certification-declaration/Chip-Test-CD-$VENDOR_ID-$PRODUCT_ID.der" \
+    "${calibration_args[@]}"
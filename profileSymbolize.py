@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Symbolise a "matter esp light profile dump" against the application ELF
+# Usage: profileSymbolize.py dump.txt [build/LightWarmCold.elf] [--top N]
+#
+
+import argparse
+import collections
+import shutil
+import subprocess
+import sys
+
+TOOLCHAINS = ['riscv32-esp-elf-addr2line', 'xtensa-esp32-elf-addr2line', 'xtensa-esp32s3-elf-addr2line']
+
+
+def find_addr2line():
+    for tool in TOOLCHAINS:
+        if shutil.which(tool):
+            return tool
+    sys.exit('addr2line not found, run from an ESP-IDF environment or use --addr2line')
+
+
+def parse(lines):
+    header = ''
+    tasks = {}
+    samples = []
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == '#' and 'profile' in line:
+            header = line.strip()
+        elif fields[0] == 'T' and len(fields) >= 3:
+            tasks[int(fields[1])] = ' '.join(fields[2:])
+        elif fields[0] == 'S' and len(fields) == 4:
+            samples.append((int(fields[1], 16), int(fields[2]), int(fields[3])))
+    return header, tasks, samples
+
+
+def symbolise(addr2line, elf, addresses):
+    output = subprocess.run([addr2line, '-f', '-C', '-e', elf] + ['0x%08x' % a for a in addresses],
+                            capture_output=True, text=True, check=True).stdout.splitlines()
+    names = {}
+    for i, address in enumerate(addresses):
+        function = output[2 * i] if 2 * i < len(output) else '??'
+        location = output[2 * i + 1] if 2 * i + 1 < len(output) else '??'
+        names[address] = (function, location.split('/')[-1])
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('dump')
+    parser.add_argument('elf', nargs='?', default='build/LightWarmCold.elf')
+    parser.add_argument('--top', type=int, default=20)
+    parser.add_argument('--addr2line')
+    args = parser.parse_args()
+
+    with open(args.dump) as f:
+        header, tasks, samples = parse(f)
+    if not samples:
+        sys.exit('No samples in dump')
+    names = symbolise(args.addr2line or find_addr2line(), args.elf, sorted({pc for pc, _, _ in samples}))
+
+    total = sum(count for _, _, count in samples)
+    by_function = collections.Counter()
+    by_task = collections.Counter()
+    by_task_function = collections.defaultdict(collections.Counter)
+    for pc, task, count in samples:
+        function = names[pc][0]
+        name = tasks.get(task, str(task))
+        by_function[function] += count
+        by_task[name] += count
+        by_task_function[name][function] += count
+
+    print(header)
+    print('\nTop functions:')
+    for function, count in by_function.most_common(args.top):
+        print('%6.2f%% %7d  %s' % (100.0 * count / total, count, function))
+    for task, task_count in by_task.most_common():
+        print('\n%s: %.2f%%' % (task, 100.0 * task_count / total))
+        for function, count in by_task_function[task].most_common(args.top // 2 or 1):
+            print('  %6.2f%% %7d  %s' % (100.0 * count / total, count, function))
+
+
+if __name__ == '__main__':
+    main()
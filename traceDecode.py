@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+#
+# Decode attribute traffic trace
+#
+# Input is a console log with "TRACE <hex>" lines from "matter esp light trace dump [flash]",
+# or a raw "trace" partition image read with esptool read_flash. Blocks are ordered by
+# sequence number, a time going back between blocks marks a reboot.
+#
+# Usage: traceDecode.py trace.log [--binary] [--csv]
+#
+
+import argparse
+import re
+import struct
+import sys
+
+BLOCK_SIZE = 256
+HEADER = struct.Struct('<HHII')
+MAGIC = 0x5254
+
+KIND_NONE = 0
+KIND_FALSE = 1
+KIND_TRUE = 2
+KIND_UNSIGNED = 3
+KIND_SIGNED = 4
+KIND_REPEATED_KEY = 0x10
+
+NAMES = {
+    (0x0006, 0x0000): 'OnOff',
+    (0x0006, 0x4003): 'StartUpOnOff',
+    (0x0008, 0x0000): 'CurrentLevel',
+    (0x0008, 0x0010): 'OnOffTransitionTime',
+    (0x0008, 0x4000): 'StartUpCurrentLevel',
+    (0x0300, 0x0002): 'RemainingTime',
+    (0x0300, 0x0007): 'ColorTemperatureMireds',
+    (0x0300, 0x0008): 'ColorMode',
+    (0x0300, 0x4010): 'StartUpColorTemperatureMireds',
+}
+
+TRACE_RE = re.compile(r'TRACE ([0-9a-f]+)')
+
+
+def varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def read_blocks(path, binary):
+    blocks = {}
+    if binary:
+        with open(path, 'rb') as f:
+            image = f.read()
+        chunks = [image[i:i + BLOCK_SIZE] for i in range(0, len(image) - BLOCK_SIZE + 1, BLOCK_SIZE)]
+    else:
+        with open(path, errors='replace') as f:
+            chunks = [bytes.fromhex(match.group(1)) for match in map(TRACE_RE.search, f) if match]
+    for chunk in chunks:
+        if len(chunk) < HEADER.size:
+            continue
+        magic, used, sequence, time = HEADER.unpack_from(chunk)
+        if magic != MAGIC or HEADER.size + used > len(chunk):
+            continue
+        blocks[sequence] = (time, chunk[HEADER.size:HEADER.size + used])
+    return [(sequence,) + blocks[sequence] for sequence in sorted(blocks)]
+
+
+def decode_block(time, data):
+    pos = 0
+    key = None
+    while pos < len(data):
+        delta, pos = varint(data, pos)
+        time += delta
+        kind = data[pos]
+        pos += 1
+        if not kind & KIND_REPEATED_KEY:
+            endpoint, pos = varint(data, pos)
+            cluster, pos = varint(data, pos)
+            attribute, pos = varint(data, pos)
+            key = (endpoint, cluster, attribute)
+        kind &= ~KIND_REPEATED_KEY
+        value = None
+        if kind in (KIND_UNSIGNED, KIND_SIGNED):
+            value, pos = varint(data, pos)
+            if kind == KIND_SIGNED:
+                value = (value >> 1) ^ -(value & 1)
+        elif kind in (KIND_FALSE, KIND_TRUE):
+            value = kind == KIND_TRUE
+        yield (time,) + key + (value,)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('input')
+    parser.add_argument('--binary', action='store_true', help='input is a raw partition image')
+    parser.add_argument('--csv', action='store_true')
+    args = parser.parse_args()
+
+    blocks = read_blocks(args.input, args.binary)
+    if not blocks:
+        print('No trace blocks found', file=sys.stderr)
+        return 1
+    if args.csv:
+        print('boot,time_ms,endpoint,cluster,attribute,value')
+
+    boot = 0
+    lastTime = 0
+    lastSequence = None
+    count = 0
+    for sequence, time, data in blocks:
+        if lastSequence is not None and (time < lastTime or sequence != lastSequence + 1):
+            boot += 1
+            if not args.csv:
+                print('--- %s ---' % ('reboot' if time < lastTime else 'blocks %d-%d lost' % (lastSequence + 1, sequence - 1)))
+        lastSequence = sequence
+        for time, endpoint, cluster, attribute, value in decode_block(time, data):
+            lastTime = time
+            count += 1
+            value = '-' if value is None else str(int(value))
+            if args.csv:
+                print('%d,%d,%d,0x%04x,0x%04x,%s' % (boot, time, endpoint, cluster, attribute, value))
+            else:
+                name = NAMES.get((cluster, attribute), '0x%04x/0x%04x' % (cluster, attribute))
+                print('%10.3f %2d %-30s %s' % (time / 1000, endpoint, name, value))
+    if not args.csv:
+        size = sum(len(data) for _, _, data in blocks)
+        print('%d records in %d blocks, %.1f bytes/record' % (count, len(blocks), size / max(count, 1)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())